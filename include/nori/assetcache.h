@@ -0,0 +1,140 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_ASSETCACHE_H)
+#define __NORI_ASSETCACHE_H
+
+#include <nori/common.h>
+#include <functional>
+#include <typeinfo>
+#include <memory>
+#include <mutex>
+#include <map>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Process-wide cache of immutable asset buffers
+ *
+ * Assets (mesh geometry, texel data, ..) are identified by a key that
+ * combines the resolved file path with all parameters that influence
+ * the loaded representation. Repeated requests for the same key return
+ * the same reference-counted buffer instead of loading another copy.
+ *
+ * The cache only holds weak references: an asset is released as soon as
+ * the last object using it is destroyed.
+ */
+class AssetCache {
+public:
+    /// Return the global cache instance
+    static AssetCache &getInstance();
+
+    /**
+     * \brief Look up an asset, loading it on a cache miss
+     *
+     * \param key
+     *    Resolved file path and load parameters identifying the asset
+     * \param loader
+     *    Function creating the asset when it is not yet in the cache.
+     *    \c T must provide a <tt>size_t getMemoryUsage() const</tt> method.
+     */
+    template <typename T>
+    std::shared_ptr<const T> acquire(const std::string &key,
+            const std::function<std::shared_ptr<T>()> &loader) {
+        std::string fullKey = std::string(typeid(T).name()) + ":" + key;
+
+        /* The map lock only covers the lookup, so that unrelated assets
+           load concurrently. Each key has its own lock that is held while
+           loading, so concurrent requests for the same key wait for the
+           first one instead of loading the asset twice. */
+        std::shared_ptr<Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::shared_ptr<Entry> &slot = m_entries[fullKey];
+            if (!slot)
+                slot = std::make_shared<Entry>();
+            entry = slot;
+        }
+
+        std::lock_guard<std::mutex> entryLock(entry->mutex);
+        std::shared_ptr<const void> cached = entry->asset.lock();
+        if (cached) {
+            std::shared_ptr<const T> result = std::static_pointer_cast<const T>(cached);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_hits++;
+            m_savedMemory += result->getMemoryUsage();
+            return result;
+        }
+
+        std::shared_ptr<const T> result = loader();
+        if (!result)
+            throw NoriException("AssetCache: unable to load \"%s\"", key);
+        entry->asset = std::weak_ptr<const void>(result);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_misses++;
+        m_totalMemory += result->getMemoryUsage();
+        return result;
+    }
+
+    /**
+     * \brief Record that a user of a shared asset keeps a private copy of
+     * part of it (e.g. transformed vertex positions)
+     *
+     * The copy is subtracted from the memory saved by sharing.
+     */
+    void addPrivateCopy(size_t size) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_savedMemory -= std::min(size, m_savedMemory);
+    }
+
+    /// Return the number of requests that were served from the cache
+    size_t getHitCount() const { return m_hits; }
+
+    /// Return the number of assets that had to be loaded
+    size_t getMissCount() const { return m_misses; }
+
+    /// Return the amount of memory saved by sharing cached assets
+    size_t getSavedMemory() const { return m_savedMemory; }
+
+    /// Return a human-readable summary of the cache statistics
+    std::string toString() const;
+
+private:
+    AssetCache() { }
+    AssetCache(const AssetCache &) = delete;
+    AssetCache &operator=(const AssetCache &) = delete;
+
+private:
+    /// Cached asset of a key, and the lock that serializes loading it
+    struct Entry {
+        std::mutex mutex;
+        std::weak_ptr<const void> asset;
+    };
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::shared_ptr<Entry>> m_entries;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+    size_t m_totalMemory = 0;
+    size_t m_savedMemory = 0;
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_ASSETCACHE_H */
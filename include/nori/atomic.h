@@ -0,0 +1,56 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_ATOMIC_H)
+#define __NORI_ATOMIC_H
+
+#include <nori/common.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Floating point value with an atomic addition that can be stored
+ * in a \c std::vector
+ */
+class AtomicFloat {
+public:
+    AtomicFloat(float value = 0.0f) : m_value(value) { }
+    AtomicFloat(const AtomicFloat &other) : m_value(other.get()) { }
+
+    AtomicFloat &operator=(const AtomicFloat &other) {
+        m_value.store(other.get(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    float get() const { return m_value.load(std::memory_order_relaxed); }
+
+    void add(float value) {
+        float current = get();
+        while (!m_value.compare_exchange_weak(current, current + value,
+                                              std::memory_order_relaxed))
+            ;
+    }
+
+private:
+    std::atomic<float> m_value;
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_ATOMIC_H */
@@ -24,6 +24,7 @@
 #define __NORI_PARALLEL_H
 
 #include <nori/color.h>
+#include <nori/atomic.h>
 #include <nori/vector.h>
 #include <tbb/mutex.h>
 
@@ -47,6 +48,8 @@ NORI_NAMESPACE_BEGIN
  */
 class ImageBlock : public Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> {
 public:
+    typedef Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Base;
+
     /**
      * Create a new image block of the specified maximum size
      * \param size
@@ -126,6 +129,43 @@ protected:
     mutable tbb::mutex m_mutex;
 };
 
+/**
+ * \brief Image buffer for contributions that land on arbitrary pixels
+ *
+ * Techniques such as light tracing or Metropolis light transport add
+ * ("splat") their samples at pixels that are not known in advance, from
+ * many threads at once. Instead of locking like \ref ImageBlock, every
+ * channel is accumulated with an atomic addition. Samples are not filtered
+ * and not normalized; the result is scaled when it is added to an image.
+ */
+class SplatBuffer {
+public:
+    /// Create an empty buffer for an image of the given size
+    SplatBuffer(const Vector2i &size = Vector2i(0, 0)) { init(size); }
+
+    /// Resize and clear the buffer
+    void init(const Vector2i &size);
+
+    /// Clear all contents
+    void clear();
+
+    /// Return the size of the buffer in pixels
+    const Vector2i &getSize() const { return m_size; }
+
+    /// Add a value to the pixel that contains \c pos (thread-safe)
+    void splat(const Point2f &pos, const Color3f &value);
+
+    /// Return the accumulated value of a pixel
+    Color3f get(int x, int y) const;
+
+    /// Add the buffer contents multiplied by \c scale to a bitmap
+    void addTo(Bitmap &bitmap, float scale) const;
+
+protected:
+    Vector2i m_size;
+    std::vector<AtomicFloat> m_data;
+};
+
 /**
  * \brief Spiraling block generator
  *
@@ -118,6 +118,13 @@ public:
      * or not to store photons on a surface
      */
     virtual bool isDiffuse() const { return false; }
+
+    /**
+     * \brief Return whether or not this BSDF only scatters into discrete
+     * directions (e.g. a mirror). Such BSDFs cannot be combined with other
+     * directional sampling techniques
+     */
+    virtual bool isDelta() const { return false; }
 };
 
 NORI_NAMESPACE_END
@@ -59,15 +59,24 @@ public:
      */
     void addShape(Shape *shape);
 
-    /// Build the BVH
-    void build();
+    /**
+     * \brief Build the BVH
+     *
+     * \param parallel
+     *    Distribute the build over the TBB worker threads. Set this to
+     *    \c false when building from within a rendering task, where
+     *    waiting on nested tasks could steal work that blocks on the
+     *    caller.
+     */
+    void build(bool parallel = true);
 
     /**
      * \brief Intersect a ray against all shapes registered
      * with the BVH
      *
-     * Detailed information about the intersection, if any, will be
-     * stored in the provided \ref Intersection data record. 
+     * Information about the intersection, if any, will be stored in the
+     * provided \ref Intersection data record. Detailed hit information
+     * (position, frames, ..) is computed on demand when it is accessed.
      *
      * The <tt>shadowRay</tt> parameter specifies whether this detailed
      * information is really needed. When set to \c true, the 
@@ -80,6 +89,42 @@ public:
     bool rayIntersect(const Ray3f &ray, Intersection &its, 
         bool shadowRay = false) const;
 
+    /// Maximum number of rays in a packet passed to \ref rayIntersectPacket()
+    static const uint32_t PacketSize = 16;
+
+    /**
+     * \brief Intersect a packet of up to \ref PacketSize rays against all
+     * shapes registered with the BVH
+     *
+     * The rays of the packet traverse the tree together. Subtrees are culled
+     * for the whole packet with an interval test that bounds the origins and
+     * reciprocal directions of all rays, before the individual rays are
+     * tested, and the child on the near side of the split plane is visited
+     * first, so that the closest hits shorten the rays early. Packets whose
+     * directions do not lie in a common octant are considered divergent and
+     * fall back to \ref rayIntersect() for each ray. Packets are most
+     * effective for rays through neighboring pixels, e.g. 4x4 pixel tiles.
+     *
+     * \param rays
+     *    Array of \c count rays
+     * \param its
+     *    Array of \c count intersection records, filled as in
+     *    \ref rayIntersect(). May be \c nullptr when \c shadowRay is set.
+     * \param count
+     *    Number of rays, at most \ref PacketSize
+     * \param shadowRay
+     *    Only determine whether or not there is an intersection
+     *
+     * \return A bit mask of the rays that found an intersection
+     */
+    uint32_t rayIntersectPacket(const Ray3f *rays, Intersection *its,
+        uint32_t count, bool shadowRay = false) const;
+
+    /// Return the amount of memory used by the tree nodes and index lists
+    size_t getMemoryUsage() const {
+        return sizeof(BVHNode) * m_nodes.size() + sizeof(uint32_t) * m_indices.size();
+    }
+
     /// Return the total number of shapes registered with the BVH
     uint32_t getShapeCount() const { return (uint32_t) m_shapes.size(); }
 
@@ -59,6 +59,34 @@ public:
         const Point2f &apertureSample,
         int channel=-1) const = 0;
 
+    /**
+     * \brief Connect a point in the scene to the camera (for light tracing)
+     *
+     * \param ref
+     *    A point in the scene
+     * \param position
+     *    Receives the position of the camera
+     * \param pixel
+     *    Receives the film position of \c ref in fractional pixel coordinates
+     * \return
+     *    The importance emitted towards \c ref per unit solid angle,
+     *    normalized over the whole film, or zero if \c ref does not
+     *    project onto the film
+     */
+    virtual float sampleImportance(const Point3f &ref, Point3f &position, Point2f &pixel) const {
+        return 0.0f;
+    }
+
+    /**
+     * \brief Return the density (with respect to solid angles) with which
+     * \ref sampleRay() generates the direction \c d for a film position
+     * that is uniformly distributed over the whole film
+     */
+    virtual float pdfDirection(const Vector3f &d) const { return 0.0f; }
+
+    /// Does the camera implement \ref sampleImportance() and \ref pdfDirection()?
+    virtual bool supportsLightTracing() const { return false; }
+
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
@@ -66,6 +94,16 @@ public:
     const ReconstructionFilter *getReconstructionFilter() const { return m_rfilter; }
 
     virtual bool hasChromaticAberrations() const { return false; }
+
+    /**
+     * \brief Return whether every sample of a camera with chromatic
+     * aberrations traces one path per color channel (the default)
+     *
+     * Otherwise, the renderer traces a single path for one randomly chosen
+     * channel (as in hero wavelength sampling) and weights it by the
+     * inverse selection probability.
+     */
+    virtual bool tracesAllChannels() const { return true; }
     /**
      * \brief Return the type of object (i.e. Mesh/Camera/etc.) 
      * provided by this instance
@@ -144,6 +144,7 @@ using std::endl;
 
 typedef Eigen::Matrix<float,    Eigen::Dynamic, Eigen::Dynamic> MatrixXf;
 typedef Eigen::Matrix<uint32_t, Eigen::Dynamic, Eigen::Dynamic> MatrixXu;
+typedef Eigen::Matrix<uint16_t, Eigen::Dynamic, Eigen::Dynamic> MatrixXus;
 typedef Eigen::Array<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Matf;
 
 /// Simple exception class, which stores a human-readable error description
@@ -195,6 +196,9 @@ extern std::string timeString(double time, bool precise = false);
 /// Convert a memory amount in bytes into a human-readable string
 extern std::string memString(size_t size, bool precise = false);
 
+/// Return the peak resident set size of the process in bytes (0 if unknown)
+extern size_t getPeakMemoryUsage();
+
 /// Measures associated with probability distributions
 enum EMeasure {
     EUnknownMeasure = 0,
@@ -43,6 +43,7 @@ public:
     void clear() {
         m_cdf.clear();
         m_cdf.push_back(0.0f);
+        m_alias.clear();
         m_normalized = false;
     }
 
@@ -175,6 +176,101 @@ public:
         return index;
     }
 
+    /**
+     * \brief Build an alias table for constant-time sampling
+     *
+     * Uses Vose's variant of Walker's alias method. The table complements
+     * the CDF, which remains available for \ref sample() and
+     * \ref sampleReuse(). This assumes that \ref normalize() has
+     * previously been called.
+     */
+    void buildAliasTable() {
+        size_t n = size();
+        m_alias.resize(n);
+
+        /* Partition the scaled probabilities into those below and above 1 */
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (size_t i=0; i<n; ++i) {
+            scaled[i] = (double) operator[](i) * n;
+            if (scaled[i] < 1.0)
+                small.push_back((uint32_t) i);
+            else
+                large.push_back((uint32_t) i);
+        }
+
+        /* Fill each underfull bin using the excess of an overfull one */
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back(), l = large.back();
+            small.pop_back();
+            m_alias[s].prob = (float) scaled[s];
+            m_alias[s].alias = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        /* The remaining bins are full up to roundoff errors */
+        for (uint32_t i : large) {
+            m_alias[i].prob = 1.0f;
+            m_alias[i].alias = i;
+        }
+        for (uint32_t i : small) {
+            m_alias[i].prob = 1.0f;
+            m_alias[i].alias = i;
+        }
+    }
+
+    /// Has an alias table been built using \ref buildAliasTable()?
+    bool hasAliasTable() const {
+        return !m_alias.empty();
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored
+     * distribution in constant time using the alias table
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleAlias(float sampleValue) const {
+        float remapped = sampleValue;
+        return sampleAliasReuse(remapped);
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored
+     * distribution in constant time using the alias table
+     *
+     * The original sample is value adjusted so that it can be "reused".
+     * Note that the resulting value differs from that of \ref sampleReuse(),
+     * though it is uniformly distributed on [0,1] as well.
+     *
+     * \param[in, out] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleAliasReuse(float &sampleValue) const {
+        float scaled = sampleValue * m_alias.size();
+        size_t index = std::min((size_t) scaled, m_alias.size() - 1);
+        /* Largest float below one, for sampleValue == 1 */
+        float u = std::min(scaled - index, 0.99999994f);
+
+        const AliasEntry &entry = m_alias[index];
+        if (u < entry.prob) {
+            sampleValue = u / entry.prob;
+            return index;
+        } else {
+            sampleValue = (u - entry.prob) / (1.0f - entry.prob);
+            return entry.alias;
+        }
+    }
+
     /**
      * \brief Turn the underlying distribution into a
      * human-readable string format
@@ -191,7 +287,14 @@ public:
         return result + "}]";
     }
 private:
+    /// Alias table entry: keep the bin with probability \c prob, otherwise pick \c alias
+    struct AliasEntry {
+        float prob;
+        uint32_t alias;
+    };
+
     std::vector<float> m_cdf;
+    std::vector<AliasEntry> m_alias;
     float m_sum, m_normalization;
     bool m_normalized;
 };
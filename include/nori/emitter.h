@@ -24,6 +24,7 @@
 NORI_NAMESPACE_BEGIN
 
 struct Intersection;
+struct LightBounds;
 /**
  * \brief Data record for conveniently querying and sampling the
  * direct illumination technique implemented by a emitter
@@ -38,7 +39,7 @@ struct EmitterQueryRecord {
     /// Direction between the hit point and the emitter point
     Vector3f wi;
     /// Probability
-    float pdf;
+    float pdf = 0.0f;
     /// Shadow ray
     Ray3f shadowRay;
 
@@ -102,11 +103,52 @@ public:
     virtual float pdf(const EmitterQueryRecord &lRec) const = 0;
 
 
+    /**
+     * \brief Return bounds of the emitted light for the light hierarchy
+     * (see \ref LightBVH)
+     *
+     * \return \c false if the emitter has no finite bounds (e.g. an
+     *    environment map). Such emitters are sampled uniformly.
+     */
+    virtual bool getLightBounds(LightBounds &bounds) const { return false; }
+
     /// Sample a photon
     virtual Color3f samplePhoton(Ray3f &ray, const Point2f &sample1, const Point2f &sample2) const {
+        Normal3f n;
+        float pdfPos, pdfDir;
+        return samplePhoton(ray, n, pdfPos, pdfDir, sample1, sample2);
+    }
+
+    /**
+     * \brief Sample a photon and return the densities of its origin and
+     * direction, as needed by bidirectional techniques
+     *
+     * \param ray      Receives the photon ray
+     * \param n        Receives the surface normal at the origin (zero for
+     *                 emitters that are located at a single point)
+     * \param pdfPos   Receives the density of the origin with respect to
+     *                 area (1 for emitters located at a single point)
+     * \param pdfDir   Receives the density of the direction with respect
+     *                 to solid angles
+     * \return The emitted power divided by the densities
+     */
+    virtual Color3f samplePhoton(Ray3f &ray, Normal3f &n, float &pdfPos, float &pdfDir,
+                                 const Point2f &sample1, const Point2f &sample2) const {
         throw NoriException("Emitter::samplePhoton(): not implemented!");
     }
 
+    /**
+     * \brief Return the densities with which \ref samplePhoton() emits a
+     * photon from \c p (with normal \c n) in direction \c d
+     */
+    virtual void pdfPhoton(const Point3f &p, const Normal3f &n, const Vector3f &d,
+                           float &pdfPos, float &pdfDir) const {
+        pdfPos = pdfDir = 0.0f;
+    }
+
+    /// Return whether the emitter is located at a single point
+    virtual bool isDeltaPosition() const { return false; }
+
 
     /**
      * \brief Virtual destructor
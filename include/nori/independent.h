@@ -0,0 +1,99 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_INDEPENDENT_H)
+#define __NORI_INDEPENDENT_H
+
+#include <nori/sampler.h>
+#include <nori/lowdiscrepancy.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Independent sampling - returns independent uniformly distributed
+ * random numbers on <tt>[0, 1)x[0, 1)</tt>.
+ *
+ * This class is essentially just a wrapper around the pcg32 pseudorandom
+ * number generator. For more details on what sample generators do in
+ * general, refer to the \ref Sampler class.
+ *
+ * The generator is reseeded in \ref generate() from (pixel, sample index,
+ * seed), and samples taken after \ref advance() continue that stream. The
+ * sample sequence of every pixel is hence independent of the thread count,
+ * the block size and the order in which blocks are rendered (although the
+ * image can differ in the last bits, since merging blocks changes the
+ * order of the floating point sums), and a render can be split into shards
+ * using \c sampleOffset.
+ */
+class Independent final : public PixelSampler {
+public:
+    Independent(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_sampleOffset = (uint32_t) propList.getInteger("sampleOffset", 0);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+    }
+
+    virtual ~Independent() { }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<Independent> cloned(new Independent());
+        cloned->m_sampleCount = m_sampleCount;
+        cloned->m_sampleOffset = m_sampleOffset;
+        cloned->m_seed = m_seed;
+        cloned->m_random = m_random;
+        return std::move(cloned);
+    }
+
+    void generate(const Point2i &pixel) {
+        PixelSampler::generate(pixel);
+        reseed();
+    }
+
+    float next1D() {
+        return m_random.nextFloat();
+    }
+    
+    Point2f next2D() {
+        return Point2f(
+            m_random.nextFloat(),
+            m_random.nextFloat()
+        );
+    }
+
+    virtual std::string toString() const override {
+        return tfm::format("Independent[sampleCount=%i, seed=%i]", m_sampleCount, m_seed);
+    }
+protected:
+    Independent() { }
+
+    /// Select a pcg32 stream per pixel and a starting state per sample index
+    void reseed() {
+        uint32_t pixelHash = LowDiscrepancy::hashPixel(m_pixel, m_seed);
+        m_random.seed(((uint64_t) LowDiscrepancy::mix(m_sampleIndex) << 32) | m_sampleIndex,
+                      ((uint64_t) m_seed << 32) | pixelHash);
+    }
+
+private:
+    uint32_t m_seed = 0;
+    pcg32 m_random;
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_INDEPENDENT_H */
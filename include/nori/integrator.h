@@ -54,6 +54,59 @@ public:
      */
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const = 0;
 
+    /**
+     * \brief Statically dispatched version of \ref Li() used by the
+     * render kernels (see \ref renderBlockKernel())
+     *
+     * Integrators that support specialized render kernels hide this
+     * function with a template that calls the sampler through its concrete
+     * type. The default implementation calls the virtual \ref Li().
+     */
+    template <typename SamplerType>
+    Color3f LiKernel(const Scene *scene, SamplerType *sampler, const Ray3f &ray) const {
+        return Li(scene, sampler, ray);
+    }
+
+    /**
+     * \brief Render one sample per pixel of an image block at once
+     *
+     * Integrators that process whole tiles (e.g. wavefront integrators)
+     * override this function. The default implementation returns \c false,
+     * in which case the renderer calls \ref Li() for every pixel sample.
+     *
+     * \param scene
+     *    A pointer to the underlying scene
+     * \param sampler
+     *    The sample generator associated with the block
+     * \param block
+     *    The (cleared) image block that receives the samples
+     * \return
+     *    \c true if the block was rendered by the integrator
+     */
+    virtual bool renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) const {
+        return false;
+    }
+
+    /**
+     * \brief Called by the renderer after every pass over the image (one
+     * sample per pixel), before the next pass starts
+     *
+     * Progressive integrators (e.g. stochastic progressive photon mapping)
+     * update their state between passes here.
+     */
+    virtual void endPass(const Scene *scene) { }
+
+    /**
+     * \brief Add the contributions that were splatted to arbitrary pixels
+     * (e.g. by light tracing, see \ref SplatBuffer) to the final image
+     *
+     * \param bitmap
+     *    The developed image
+     * \param sampleCount
+     *    Number of samples per pixel that were rendered
+     */
+    virtual void addSplats(Bitmap &bitmap, uint32_t sampleCount) const { }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.) 
      * provided by this instance
@@ -20,6 +20,8 @@
 #define __NORI_KDTREE_H
 
 #include <nori/bbox.h>
+#include <tbb/tbb.h>
+#include <cassert>
 
 NORI_NAMESPACE_BEGIN
 
@@ -181,13 +183,13 @@ public:
     //! @{ \name \c stl::vector-like interface
     // =============================================================
     /// Clear the kd-tree array
-    void clear() { m_nodes.clear(); m_bbox.reset(); }
+    void clear() { m_nodes.clear(); m_bbox.reset(); m_external = nullptr; m_externalSize = 0; }
     /// Resize the kd-tree array
     void resize(size_t size) { m_nodes.resize(size); }
     /// Reserve a certain amount of memory for the kd-tree array
     void reserve(size_t size) { m_nodes.reserve(size); }
     /// Return the size of the kd-tree
-    size_t size() const { return m_nodes.size(); }
+    size_t size() const { return m_external ? m_externalSize : m_nodes.size(); }
     /// Return the capacity of the kd-tree
     size_t capacity() const { return m_nodes.capacity(); }
     /// Append a kd-tree node to the node array
@@ -195,10 +197,12 @@ public:
         m_nodes.push_back(node);
         m_bbox.expandBy(node.getPosition());
     }
-    /// Return one of the KD-tree nodes by index
-    NodeType &operator[](size_t idx) { return m_nodes[idx]; }
+    /// Return one of the KD-tree nodes by index (not available when using external nodes)
+    NodeType &operator[](size_t idx) { assert(!m_external); return m_nodes[idx]; }
     /// Return one of the KD-tree nodes by index (const version)
-    const NodeType &operator[](size_t idx) const { return m_nodes[idx]; }
+    const NodeType &operator[](size_t idx) const { return getNodes()[idx]; }
+    /// Return the node array
+    const NodeType *getNodes() const { return m_external ? m_external : m_nodes.data(); }
     //! @}
     // =============================================================
 
@@ -211,6 +215,23 @@ public:
     /// Set the depth of the constructed KD-tree (be careful with this)
     void setDepth(size_t depth) { m_depth = depth; }
 
+    /**
+     * \brief Use the nodes of a tree that was built earlier from external
+     * memory (e.g. a memory-mapped file) instead of the own node array
+     *
+     * The memory is not copied and must remain valid while the tree is
+     * used. The tree is read-only afterwards.
+     */
+    void setExternalNodes(const NodeType *nodes, size_t count,
+                          const BoundingBoxType &bbox, size_t depth) {
+        m_nodes.clear();
+        m_nodes.shrink_to_fit();
+        m_external = nodes;
+        m_externalSize = count;
+        m_bbox = bbox;
+        m_depth = depth;
+    }
+
     /**
      * \brief Construct the KD-tree hierarchy
      *
@@ -243,8 +264,9 @@ public:
         for (size_t i=0; i<m_nodes.size(); ++i)
             indirection[i] = (IndexType) i;
 
-        m_depth = 0;
-        build(1, indirection.begin(), indirection.begin(), indirection.end());
+        std::vector<IndexType> temp(m_nodes.size());
+        m_depth = build(1, indirection.begin(), indirection.begin(), indirection.end(),
+                        temp.begin(), m_bbox);
         permute_inplace(&m_nodes[0], indirection);
 
         cout << "done." << endl;
@@ -258,17 +280,32 @@ public:
      * \param searchRadius  Search radius
      */
     void search(const PointType &p, float searchRadius, std::vector<IndexType> &results) const {
-        if (m_nodes.size() == 0)
+        results.clear();
+        search(p, searchRadius, [&](IndexType index) { results.push_back(index); });
+    }
+
+    /**
+     * \brief Run a search query without allocating memory
+     *
+     * \param p Search position
+     * \param searchRadius  Search radius
+     * \param functor
+     *      Function that is called with the index of every point
+     *      within the search radius
+     */
+    template <typename Functor>
+    void search(const PointType &p, float searchRadius, const Functor &functor) const {
+        if (size() == 0)
             return;
 
+        const NodeType *nodes = getNodes();
         IndexType *stack = (IndexType *) alloca((m_depth+1) * sizeof(IndexType));
-        IndexType index = 0, stackPos = 1, found = 0;
+        IndexType index = 0, stackPos = 1;
         float distSquared = searchRadius*searchRadius;
         stack[0] = 0;
-        results.clear();
 
         while (stackPos > 0) {
-            const NodeType &node = m_nodes[index];
+            const NodeType &node = nodes[index];
             IndexType nextIndex;
 
             /* Recurse on inner nodes */
@@ -281,7 +318,7 @@ public:
                 if (distToPlane > 0) {
                     /* The search query is located on the right side of the split.
                        Search this side first. */
-                    if (hasRightChild(index)) {
+                    if (node.getRightIndex(index) != 0) {
                         if (searchBoth)
                             stack[stackPos++] = node.getLeftIndex(index);
                         nextIndex = node.getRightIndex(index);
@@ -293,7 +330,7 @@ public:
                 } else {
                     /* The search query is located on the left side of the split.
                        Search this side first. */
-                    if (searchBoth && hasRightChild(index))
+                    if (searchBoth && node.getRightIndex(index) != 0)
                         stack[stackPos++] = node.getRightIndex(index);
 
                     nextIndex = node.getLeftIndex(index);
@@ -305,10 +342,8 @@ public:
             /* Check if the current point is within the query's search radius */
             const float pointDistSquared = (node.getPosition() - p).squaredNorm();
 
-            if (pointDistSquared < distSquared) {
-                ++found;
-                results.push_back(index);
-            }
+            if (pointDistSquared < distSquared)
+                functor(index);
 
             index = nextIndex;
         }
@@ -333,9 +368,10 @@ public:
      */
     size_t nnSearch(const PointType &p, float &_sqrSearchRadius,
             size_t k, SearchResult *results) const {
-        if (m_nodes.size() == 0)
+        if (size() == 0)
             return 0;
 
+        const NodeType *nodes = getNodes();
         IndexType *stack = (IndexType *) alloca((m_depth+1) * sizeof(IndexType));
         IndexType index = 0, stackPos = 1;
         float sqrSearchRadius = _sqrSearchRadius;
@@ -344,7 +380,7 @@ public:
         stack[0] = 0;
 
         while (stackPos > 0) {
-            const NodeType &node = m_nodes[index];
+            const NodeType &node = nodes[index];
             IndexType nextIndex;
 
             /* Recurse on inner nodes */
@@ -356,7 +392,7 @@ public:
                 if (distToPlane > 0) {
                     /* The search query is located on the right side of the split.
                        Search this side first. */
-                    if (hasRightChild(index)) {
+                    if (node.getRightIndex(index) != 0) {
                         if (searchBoth)
                             stack[stackPos++] = node.getLeftIndex(index);
                         nextIndex = node.getRightIndex(index);
@@ -368,7 +404,7 @@ public:
                 } else {
                     /* The search query is located on the left side of the split.
                        Search this side first. */
-                    if (searchBoth && hasRightChild(index))
+                    if (searchBoth && node.getRightIndex(index) != 0)
                         stack[stackPos++] = node.getRightIndex(index);
 
                     nextIndex = node.getLeftIndex(index);
@@ -436,67 +472,122 @@ public:
 protected:
     /// Return whether or not the inner node of the specified index has a right child node.
     bool hasRightChild(IndexType index) const {
-        return m_nodes[index].getRightIndex(index) != 0;
+        return getNodes()[index].getRightIndex(index) != 0;
     }
 
-    /// Tree construction routine
-    void build(size_t depth,
-              typename std::vector<IndexType>::iterator base,
-              typename std::vector<IndexType>::iterator rangeStart,
-              typename std::vector<IndexType>::iterator rangeEnd) {
+    /// Build-related parameters
+    enum {
+        /// Build the subtrees of ranges with more points than this in parallel
+        PARALLEL_THRESHOLD = 16384,
+
+        /// Process points in batches of this size when partitioning in parallel
+        GRAIN_SIZE = 4096
+    };
+
+    typedef typename std::vector<IndexType>::iterator IndexIterator;
+
+    /**
+     * \brief Tree construction routine
+     *
+     * Subtrees with more than \ref PARALLEL_THRESHOLD points are built in
+     * parallel, and the points of such ranges are counted and partitioned
+     * around the sliding midpoint in parallel as well.
+     *
+     * \param temp
+     *    Scratch memory for partitioning, which has the same offset from
+     *    the beginning of its array as \c rangeStart
+     * \param bbox
+     *    Bounding box of the points in the range
+     * \return
+     *    The depth of the subtree
+     */
+    size_t build(size_t depth, IndexIterator base, IndexIterator rangeStart,
+                 IndexIterator rangeEnd, IndexIterator temp, BoundingBoxType bbox) {
         if (rangeEnd <= rangeStart)
             throw NoriException("Internal error!");
 
-        m_depth = std::max(depth, m_depth);
-
         IndexType count = (IndexType) (rangeEnd-rangeStart);
 
         if (count == 1) {
             /* Create a leaf node */
             m_nodes[*rangeStart].setLeaf(true);
-            return;
+            return depth;
         }
 
-        int axis = 0;
-        typename std::vector<IndexType>::iterator split;
+        bool parallel = count > PARALLEL_THRESHOLD;
+        int axis = bbox.getLargestAxis();
+        IndexIterator split;
+        bool partitioned = false;
 
         switch (m_heuristic) {
             case Balanced: {
                     /* Build a balanced tree */
                     split = rangeStart + count/2;
-                    axis = m_bbox.getLargestAxis();
                 };
                 break;
 
             case SlidingMidpoint: {
                     /* Sliding midpoint rule: find a split that is close to the spatial median */
-                    axis = m_bbox.getLargestAxis();
-
                     Scalar midpoint = (Scalar) 0.5f
-                        * (m_bbox.max[axis]+m_bbox.min[axis]);
+                        * (bbox.max[axis]+bbox.min[axis]);
+                    auto isLeft = [&](IndexType i) {
+                        return m_nodes[i].getPosition()[axis] <= midpoint;
+                    };
 
-                    size_t nLT = std::count_if(rangeStart, rangeEnd,
-                        [&](IndexType i) {
-                            return m_nodes[i].getPosition()[axis] <= midpoint;
-                        }
-                    );
+                    size_t nLT;
+                    if (parallel) {
+                        nLT = tbb::parallel_reduce(
+                            tbb::blocked_range<IndexIterator>(rangeStart, rangeEnd, GRAIN_SIZE),
+                            (size_t) 0,
+                            [&](const tbb::blocked_range<IndexIterator> &range, size_t result) {
+                                return result + (size_t) std::count_if(range.begin(), range.end(), isLeft);
+                            },
+                            std::plus<size_t>()
+                        );
+                    } else {
+                        nLT = std::count_if(rangeStart, rangeEnd, isLeft);
+                    }
 
                     /* Re-adjust the split to pass through a nearby point */
                     split = rangeStart + nLT;
 
-                    if (split == rangeStart)
+                    if (split == rangeStart) {
                         ++split;
-                    else if (split == rangeEnd)
+                    } else if (split == rangeEnd) {
                         --split;
+                    } else if (parallel) {
+                        /* Partition around the midpoint and move the first point
+                           on the right side to the split position */
+                        auto less = [&](IndexIterator i1, IndexIterator i2) {
+                            return m_nodes[*i1].getPosition()[axis] < m_nodes[*i2].getPosition()[axis];
+                        };
+                        partition(rangeStart, rangeEnd, temp, isLeft);
+                        IndexIterator first = tbb::parallel_reduce(
+                            tbb::blocked_range<IndexIterator>(rangeStart + nLT, rangeEnd, GRAIN_SIZE),
+                            rangeStart + nLT,
+                            [&](const tbb::blocked_range<IndexIterator> &range, IndexIterator result) {
+                                for (IndexIterator it = range.begin(); it != range.end(); ++it)
+                                    if (less(it, result))
+                                        result = it;
+                                return result;
+                            },
+                            [&](IndexIterator i1, IndexIterator i2) { return less(i2, i1) ? i2 : i1; }
+                        );
+                        std::iter_swap(rangeStart + nLT, first);
+                        split = rangeStart + nLT;
+                        partitioned = true;
+                    }
                 };
                 break;
         }
 
-        std::nth_element(rangeStart, split, rangeEnd,
-            [&](IndexType i1, IndexType i2) {
-                return m_nodes[i1].getPosition()[axis] < m_nodes[i2].getPosition()[axis];
-            }
-        );
+        if (!partitioned) {
+            std::nth_element(rangeStart, split, rangeEnd,
+                [&](IndexType i1, IndexType i2) {
+                    return m_nodes[i1].getPosition()[axis] < m_nodes[i2].getPosition()[axis];
+                }
+            );
+        }
 
         NodeType &splitNode = m_nodes[*split];
         splitNode.setAxis(axis);
@@ -513,24 +604,93 @@ protected:
         std::iter_swap(rangeStart, split);
 
         /* Recursively build the children */
-        Scalar temp = m_bbox.max[axis],
-            splitPos = splitNode.getPosition()[axis];
-        m_bbox.max[axis] = splitPos;
-        build(depth+1, base, rangeStart+1, split+1);
-        m_bbox.max[axis] = temp;
-
-        if (split+1 != rangeEnd) {
-            temp = m_bbox.min[axis];
-            m_bbox.min[axis] = splitPos;
-            build(depth+1, base, split+1, rangeEnd);
-            m_bbox.min[axis] = temp;
+        Scalar splitPos = splitNode.getPosition()[axis];
+        BoundingBoxType leftBBox(bbox), rightBBox(bbox);
+        leftBBox.max[axis] = splitPos;
+        rightBBox.min[axis] = splitPos;
+
+        size_t leftDepth = depth, rightDepth = depth;
+        auto buildLeft = [&]() {
+            leftDepth = build(depth+1, base, rangeStart+1, split+1,
+                              temp + 1, leftBBox);
+        };
+        auto buildRight = [&]() {
+            if (split+1 != rangeEnd)
+                rightDepth = build(depth+1, base, split+1, rangeEnd,
+                                   temp + (split+1 - rangeStart), rightBBox);
+        };
+
+        if (parallel) {
+            tbb::parallel_invoke(buildLeft, buildRight);
+        } else {
+            buildLeft();
+            buildRight();
         }
+
+        return std::max(leftDepth, rightDepth);
+    }
+
+    /**
+     * \brief Stable parallel partition of a range of indices
+     *
+     * Every batch counts its points on the left side, the batches then
+     * copy their points to \c temp at offsets given by the prefix sums of
+     * the counts, and the result is copied back.
+     */
+    template <typename Predicate>
+    void partition(IndexIterator rangeStart, IndexIterator rangeEnd, IndexIterator temp,
+                   const Predicate &isLeft) const {
+        size_t count = (size_t) (rangeEnd - rangeStart);
+        size_t batches = (count + GRAIN_SIZE - 1) / GRAIN_SIZE;
+        std::vector<size_t> leftCounts(batches), leftOffsets(batches), rightOffsets(batches);
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, batches),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t b = range.begin(); b != range.end(); ++b) {
+                    IndexIterator first = rangeStart + b * GRAIN_SIZE;
+                    IndexIterator last = rangeStart + std::min(count, (b + 1) * GRAIN_SIZE);
+                    leftCounts[b] = (size_t) std::count_if(first, last, isLeft);
+                }
+            }
+        );
+
+        size_t left = 0, right = 0;
+        for (size_t b = 0; b < batches; ++b) {
+            leftOffsets[b] = left;
+            rightOffsets[b] = right;
+            left += leftCounts[b];
+            right += std::min(count, (b + 1) * GRAIN_SIZE) - b * GRAIN_SIZE - leftCounts[b];
+        }
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, batches),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t b = range.begin(); b != range.end(); ++b) {
+                    IndexIterator first = rangeStart + b * GRAIN_SIZE;
+                    IndexIterator last = rangeStart + std::min(count, (b + 1) * GRAIN_SIZE);
+                    IndexIterator l = temp + leftOffsets[b], r = temp + left + rightOffsets[b];
+                    for (IndexIterator it = first; it != last; ++it) {
+                        if (isLeft(*it))
+                            *l++ = *it;
+                        else
+                            *r++ = *it;
+                    }
+                }
+            }
+        );
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, count, GRAIN_SIZE),
+            [&](const tbb::blocked_range<size_t> &range) {
+                std::copy(temp + range.begin(), temp + range.end(), rangeStart + range.begin());
+            }
+        );
     }
 protected:
     std::vector<NodeType> m_nodes;
     BoundingBoxType m_bbox;
     Heuristic m_heuristic;
     size_t m_depth;
+    const NodeType *m_external = nullptr;
+    size_t m_externalSize = 0;
 };
 
 /**
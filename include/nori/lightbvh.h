@@ -0,0 +1,135 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_LIGHTBVH_H)
+#define __NORI_LIGHTBVH_H
+
+#include <nori/bbox.h>
+#include <map>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Spatial and directional bounds of the emission of one or more
+ * emitters, used to estimate their contribution at a point
+ */
+struct LightBounds {
+    /// Bounding box of the emitting surfaces
+    BoundingBox3f bounds;
+    /// Axis of the cone that bounds the emission normals
+    Vector3f w = Vector3f(0.0f, 0.0f, 1.0f);
+    /// Emitted power (luminance)
+    float phi = 0.0f;
+    /// Cosine of the half angle of the normal cone
+    float cosTheta_o = -1.0f;
+    /// Cosine of the angle beyond the normals up to which light is emitted
+    float cosTheta_e = 0.0f;
+    /// Do the surfaces emit on both sides?
+    bool twoSided = false;
+
+    LightBounds() { }
+
+    LightBounds(const BoundingBox3f &bounds, const Vector3f &w, float phi,
+                float cosTheta_o, float cosTheta_e, bool twoSided)
+        : bounds(bounds), w(w.normalized()), phi(phi), cosTheta_o(cosTheta_o),
+          cosTheta_e(cosTheta_e), twoSided(twoSided) { }
+
+    /// Return the center of the bounding box
+    Point3f getCentroid() const { return bounds.getCenter(); }
+
+    /**
+     * \brief Estimate the contribution of the bounded emitters at \c p
+     *
+     * Conservatively bounds the angle between the emission cone and the
+     * direction towards \c p and scales the power by the cosine of that
+     * angle and the inverse squared distance.
+     */
+    float importance(const Point3f &p) const;
+
+    /// Return bounds that contain both arguments
+    static LightBounds merge(const LightBounds &a, const LightBounds &b);
+};
+
+/**
+ * \brief Bounding volume hierarchy over the emitters of a scene
+ *
+ * Emitters are selected for next event estimation by traversing the tree
+ * and choosing each child with a probability proportional to its
+ * estimated importance at the shading point (\ref LightBounds). The tree
+ * is built top-down with the surface area orientation heuristic.
+ *
+ * Emitters without finite bounds (e.g. environment maps) are kept in a
+ * separate list and sampled uniformly, with the same probability as the
+ * whole tree. See "Importance Sampling of Many Lights With Adaptive Tree
+ * Splitting" by Alejandro Conty Estevez and Christopher Kulla (2018).
+ */
+class LightBVH {
+public:
+    /// Build the hierarchy over a set of emitters
+    void build(const std::vector<Emitter *> &emitters);
+
+    /**
+     * \brief Choose an emitter for the reference point \c ref
+     *
+     * \param ref
+     *    Point that is to be illuminated
+     * \param sample
+     *    A uniformly distributed sample on \f$[0,1]\f$
+     * \param pdf
+     *    Receives the probability of choosing the returned emitter
+     * \return
+     *    The chosen emitter, or \c nullptr if no emitter contributes
+     */
+    const Emitter *sample(const Point3f &ref, float sample, float &pdf) const;
+
+    /// Return the probability that \ref sample() chooses \c emitter for \c ref
+    float pdf(const Point3f &ref, const Emitter *emitter) const;
+
+    /// Return the number of nodes of the tree
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Return the number of emitters that are sampled uniformly
+    size_t getInfiniteCount() const { return m_infinite.size(); }
+
+private:
+    struct Node {
+        LightBounds bounds;
+        uint32_t childOrEmitter; ///< Index of the second child or the emitter
+        bool leaf;
+    };
+
+    uint32_t build(std::vector<std::pair<uint32_t, LightBounds>> &emitters,
+                   size_t start, size_t end, uint64_t bitTrail, int depth);
+
+    /// Probability of choosing the tree instead of an unbounded emitter
+    float treeProbability() const {
+        if (m_nodes.empty())
+            return 0.0f;
+        return 1.0f / (1.0f + m_infinite.size());
+    }
+
+private:
+    std::vector<const Emitter *> m_emitters;  ///< Bounded emitters
+    std::vector<const Emitter *> m_infinite;  ///< Emitters without bounds
+    std::vector<Node> m_nodes;
+    std::map<const Emitter *, uint64_t> m_bitTrails; ///< Path from the root to the emitter's leaf
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_LIGHTBVH_H */
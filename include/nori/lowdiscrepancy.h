@@ -0,0 +1,209 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_LOWDISCREPANCY_H)
+#define __NORI_LOWDISCREPANCY_H
+
+#include <nori/vector.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Helper functions for hashing, scrambling and low-discrepancy
+ * sequences used by the sample generators
+ *
+ * The scrambling follows "Practical Hash-based Owen Scrambling" by Brent
+ * Burley (JCGT 2020): an Owen scramble is approximated by a hash-based
+ * permutation that is applied in reversed bit order.
+ */
+class LowDiscrepancy {
+public:
+    /// Reverse the bits of a 32 bit integer
+    static inline uint32_t reverseBits(uint32_t x) {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+    }
+
+    /// Finalization mix of MurmurHash3, a fast integer hash with good avalanche
+    static inline uint32_t mix(uint32_t x) {
+        x ^= x >> 16;
+        x *= 0x85ebca6bu;
+        x ^= x >> 13;
+        x *= 0xc2b2ae35u;
+        x ^= x >> 16;
+        return x;
+    }
+
+    /// Combine a hash value with another integer
+    static inline uint32_t hashCombine(uint32_t seed, uint32_t value) {
+        return seed ^ (mix(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+    }
+
+    /// Hash a pixel position and a seed value
+    static inline uint32_t hashPixel(const Point2i &pixel, uint32_t seed) {
+        return mix(hashCombine(hashCombine(seed, (uint32_t) pixel.x()), (uint32_t) pixel.y()));
+    }
+
+    /// Interleave the lower 16 bits of two integers (Morton / Z-order code)
+    static inline uint32_t morton2D(uint32_t x, uint32_t y) {
+        auto spread = [](uint32_t v) {
+            v &= 0x0000ffffu;
+            v = (v | (v << 8)) & 0x00ff00ffu;
+            v = (v | (v << 4)) & 0x0f0f0f0fu;
+            v = (v | (v << 2)) & 0x33333333u;
+            v = (v | (v << 1)) & 0x55555555u;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+
+    /**
+     * \brief Hash-based permutation of Laine and Karras that only propagates
+     * changes from lower to higher bits
+     */
+    static inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    /**
+     * \brief Nested uniform (Owen) scrambling of a 32 bit fixed point value
+     *
+     * Applied to sample indices, this is also a random permutation that
+     * preserves the (0, m, 2)-net structure of power-of-two prefixes.
+     */
+    static inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+        return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+    }
+
+    /**
+     * \brief Return the first two dimensions of the Sobol sequence as 32 bit
+     * fixed point values
+     *
+     * The first dimension is the van der Corput sequence. The generator matrix
+     * of the second one has columns <tt>v_k = v_{k-1} ^ (v_{k-1} >> 1)</tt>.
+     */
+    static inline uint32_t sobol(uint32_t index, int dim) {
+        if (dim == 0)
+            return reverseBits(index);
+
+        uint32_t result = 0, v = 1u << 31;
+        for (; index != 0; index >>= 1, v ^= v >> 1) {
+            if (index & 1)
+                result ^= v;
+        }
+        return result;
+    }
+
+    /// Convert a 32 bit fixed point value to a float on [0, 1)
+    static inline float toFloat(uint32_t x) {
+        /* Largest float below one */
+        return std::min(x * (1.0f / 4294967296.0f), 0.99999994f);
+    }
+
+    /**
+     * \brief Return a 2D Owen-scrambled Sobol point
+     *
+     * The sample index is shuffled using \c seed, which decorrelates points
+     * drawn with different seeds (e.g. for different dimension pairs) while
+     * every prefix of <tt>2^k</tt> indices remains a scrambled (0, 2)-net.
+     */
+    static inline Point2f sobolOwen2D(uint32_t index, uint32_t seed) {
+        uint32_t shuffled = nestedUniformScramble(index, seed);
+        return Point2f(
+            toFloat(nestedUniformScramble(sobol(shuffled, 0), hashCombine(seed, 0))),
+            toFloat(nestedUniformScramble(sobol(shuffled, 1), hashCombine(seed, 1)))
+        );
+    }
+
+    /**
+     * \brief Random permutation of <tt>[0, l)</tt> by cycle walking a hash
+     *
+     * From "Correlated Multi-Jittered Sampling" by Andrew Kensler
+     * (Pixar Technical Memo 13-01, 2013)
+     */
+    static inline uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+        uint32_t w = l - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do {
+            i ^= p; i *= 0xe170893d;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8; i *= 0x0929eb3f;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1; i *= 1 | p >> 27;
+            i *= 0x6935fa69;
+            i ^= (i & w) >> 11; i *= 0x74dcb303;
+            i ^= (i & w) >> 2; i *= 0x9e501cc3;
+            i ^= (i & w) >> 2; i *= 0xc860a3df;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= l);
+        return (i + p) % l;
+    }
+
+    /// Hash an index and a pattern seed to a float on [0, 1) (Kensler 2013)
+    static inline float randomFloat(uint32_t i, uint32_t p) {
+        i ^= p;
+        i ^= i >> 17;
+        i ^= i >> 10; i *= 0xb36534e5;
+        i ^= i >> 12;
+        i ^= i >> 21; i *= 0x93fc4795;
+        i ^= 0xdf6e307f;
+        i ^= i >> 17; i *= 1 | p >> 18;
+        return std::min(i * (1.0f / 4294967808.0f), 0.99999994f);
+    }
+
+    /**
+     * \brief Return sample \c s of a correlated multi-jittered pattern with
+     * \c n samples
+     *
+     * The pattern is stratified in both 1D projections and in a grid of
+     * roughly square cells. Different values of \c p produce independent
+     * patterns; the order of the samples is randomized as well.
+     */
+    static inline Point2f correlatedMultiJitter(uint32_t s, uint32_t n, uint32_t p) {
+        uint32_t m = std::max(1u, (uint32_t) std::sqrt((float) n));
+        uint32_t k = (n + m - 1) / m;
+        s = permute(s, n, p * 0x51633e2d);
+        uint32_t sx = permute(s % m, m, p * 0x68bc21eb);
+        uint32_t sy = permute(s / m, k, p * 0x02e5be93);
+        float jx = randomFloat(s, p * 0x967a889b);
+        float jy = randomFloat(s, p * 0x368cc8b7);
+        return Point2f(
+            std::min((sx + (sy + jx) / k) / m, 0.99999994f),
+            std::min((s + jy) / n, 0.99999994f)
+        );
+    }
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_LOWDISCREPANCY_H */
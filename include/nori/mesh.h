@@ -22,9 +22,113 @@
 #include <nori/shape.h>
 #include <nori/texture.h>
 #include <nori/dpdf.h>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Encode a unit vector using the octahedral mapping
+ *
+ * The two resulting coordinates are quantized to 16 bits each and packed
+ * into a single 32 bit integer. See "A Survey of Efficient Representations
+ * for Independent Unit Vectors" by Cigolle et al. (JCGT 2014)
+ */
+inline uint32_t encodeOctahedral(const Vector3f &n) {
+    float invL1 = 1.0f / (std::abs(n.x()) + std::abs(n.y()) + std::abs(n.z()));
+    float u = n.x() * invL1, v = n.y() * invL1;
+    if (n.z() < 0.0f) {
+        float tu = (1.0f - std::abs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float tv = (1.0f - std::abs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = tu; v = tv;
+    }
+    uint32_t qu = (uint32_t) std::round(clamp(u * 0.5f + 0.5f, 0.0f, 1.0f) * 65535.0f);
+    uint32_t qv = (uint32_t) std::round(clamp(v * 0.5f + 0.5f, 0.0f, 1.0f) * 65535.0f);
+    return qu | (qv << 16);
+}
+
+/// Decode a unit vector that was encoded using \ref encodeOctahedral()
+inline Vector3f decodeOctahedral(uint32_t value) {
+    float u = (value & 0xFFFF) * (2.0f / 65535.0f) - 1.0f;
+    float v = (value >> 16) * (2.0f / 65535.0f) - 1.0f;
+    Vector3f n(u, v, 1.0f - std::abs(u) - std::abs(v));
+    if (n.z() < 0.0f) {
+        float tu = (1.0f - std::abs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float tv = (1.0f - std::abs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        n.x() = tu; n.y() = tv;
+    }
+    return n.normalized();
+}
+
+/**
+ * \brief Vertex and index buffers of a triangle mesh
+ *
+ * The buffers are immutable once loaded and stored in object space, which
+ * allows several \ref Mesh instances referencing the same file to share them
+ * (see \ref AssetCache) even when they are placed with different transforms.
+ * Vertex attributes can optionally be stored in reduced precision, in which
+ * case the accessors below decode them on the fly.
+ */
+struct MeshData {
+    MatrixXf      V;                     ///< Vertex positions
+    MatrixXf      N;                     ///< Vertex normals
+    MatrixXf      UV;                    ///< Vertex texture coordinates
+    MatrixXu      F;                     ///< Faces
+
+    MatrixXus     Vc;                    ///< Quantized vertex positions (relative to \ref bbox)
+    MatrixXu      Nc;                    ///< Octahedral encoded vertex normals
+    MatrixXus     UVc;                   ///< Quantized texture coordinates (relative to \ref uvBounds)
+
+    BoundingBox3f bbox;                  ///< Bounding box of the vertex positions
+    BoundingBox2f uvBounds;              ///< Bounding box of the texture coordinates
+
+    /// Return the total number of vertices
+    uint32_t getVertexCount() const { return (uint32_t) std::max(V.cols(), Vc.cols()); }
+
+    /// Return the position of a vertex (decoded if positions are quantized)
+    Point3f getVertex(uint32_t index) const {
+        if (V.size() > 0)
+            return V.col(index);
+        return bbox.min + bbox.getExtents().cwiseProduct(
+            Vc.col(index).cast<float>() * (1.0f / 65535.0f));
+    }
+
+    /// Return the normal of a vertex (decoded if normals are compressed)
+    Normal3f getVertexNormal(uint32_t index) const {
+        if (N.size() > 0)
+            return N.col(index);
+        return decodeOctahedral(Nc(0, index));
+    }
+
+    /// Return the texture coordinates of a vertex (decoded if compressed)
+    Point2f getVertexTexCoord(uint32_t index) const {
+        if (UV.size() > 0)
+            return UV.col(index);
+        return uvBounds.min + uvBounds.getExtents().cwiseProduct(
+            UVc.col(index).cast<float>() * (1.0f / 65535.0f));
+    }
+
+    /// Are there per-vertex normals?
+    bool hasVertexNormals() const { return N.size() > 0 || Nc.size() > 0; }
+
+    /// Are there per-vertex texture coordinates?
+    bool hasVertexTexCoords() const { return UV.size() > 0 || UVc.size() > 0; }
+
+    /**
+     * \brief Switch to a reduced-precision representation of the vertex
+     * attributes to save memory
+     *
+     * Normals are stored using 32 bit octahedral encoding and texture
+     * coordinates as 16 bit UNORM values relative to their bounding box.
+     * When \c quantizePositions is set, the vertex positions are also
+     * stored as 16 bit UNORM values relative to \ref bbox. This is lossy
+     * and should only be used for dense geometry.
+     */
+    void compress(bool quantizePositions);
+
+    /// Return the amount of memory used by the vertex and index buffers
+    size_t getMemoryUsage() const;
+};
+
 /**
  * \brief Triangle mesh
  *
@@ -39,7 +143,7 @@ public:
     virtual void activate() override;
 
     /// Return the total number of triangles in this shape
-    virtual uint32_t getPrimitiveCount() const override { return (uint32_t) m_F.cols(); }
+    virtual uint32_t getPrimitiveCount() const override { return (uint32_t) m_data->F.cols(); }
 
     //// Return an axis-aligned bounding box containing the given triangle
     virtual BoundingBox3f getBoundingBox(uint32_t index) const override;
@@ -72,13 +176,48 @@ public:
      * \return
      *   \c true if an intersection has been detected
      */
-    virtual bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const override;
+    virtual bool rayIntersect(uint32_t &index, const Ray3f &ray, float &u, float &v, float &t) const override;
 
-    /// Set intersection information: hit point, shading frame, UVs
-    virtual void setHitInformation(uint32_t index, const Ray3f &ray, Intersection & its) const override;
+    /// Compute on-demand intersection information: hit point, shading frame, UVs
+    virtual void setHitInformation(const Intersection &its, uint32_t fields) const override;
 
     /// Return the total number of vertices in this shape
-    uint32_t getVertexCount() const { return (uint32_t) m_V.cols(); }
+    uint32_t getVertexCount() const { return m_data->getVertexCount(); }
+
+    /// Return the world space position of a vertex (decoded if positions are quantized)
+    Point3f getVertex(uint32_t index) const {
+        if (m_vertexPositions)
+            return Point3f(m_vertexPositions[3 * index],
+                           m_vertexPositions[3 * index + 1],
+                           m_vertexPositions[3 * index + 2]);
+        return decodeVertex(index);
+    }
+
+    /// Return the world space normal of a vertex (decoded if normals are compressed)
+    Normal3f getVertexNormal(uint32_t index) const {
+        if (m_vertexNormals)
+            return Normal3f(m_vertexNormals[3 * index],
+                            m_vertexNormals[3 * index + 1],
+                            m_vertexNormals[3 * index + 2]);
+        return decodeNormal(index);
+    }
+
+    /// Return the texture coordinates of a vertex (decoded if compressed)
+    Point2f getVertexTexCoord(uint32_t index) const { return m_data->getVertexTexCoord(index); }
+
+    /// Does this mesh provide per-vertex normals?
+    bool hasVertexNormals() const { return m_data->hasVertexNormals(); }
+
+    /// Does this mesh provide per-vertex texture coordinates?
+    bool hasVertexTexCoords() const { return m_data->hasVertexTexCoords(); }
+
+    /// Return the amount of memory used by the vertex and index buffers of this instance
+    size_t getMemoryUsage() const { return m_data->getMemoryUsage() + getPrivateMemoryUsage(); }
+
+    /// Return the amount of memory used by the world space copies of this instance
+    size_t getPrivateMemoryUsage() const {
+        return (m_positions.size() + m_normals.size()) * sizeof(float);
+    }
 
     /**
      * \brief Uniformly sample a position on the mesh with
@@ -90,21 +229,32 @@ public:
     /// Return the surface area of the given triangle
     float surfaceArea(uint32_t index) const;
 
+    /// Return the total surface area
+    virtual float getSurfaceArea() const override { return m_pdf.getSum(); }
+
+    /// Return a cone that contains the face and vertex normals
+    virtual void getNormalCone(Vector3f &axis, float &cosTheta) const override;
+
     Point3f getInterpolatedVertex(uint32_t index, const Vector3f & bc) const;
     Normal3f getInterpolatedNormal(uint32_t index, const Vector3f & bc) const;
 
-    /// Return a pointer to the vertex positions
-    const MatrixXf &getVertexPositions() const { return m_V; }
+    /// Return a pointer to the object space vertex positions (empty if they are quantized)
+    const MatrixXf &getVertexPositions() const { return m_data->V; }
 
-    /// Return a pointer to the vertex normals (or \c nullptr if there are none)
-    const MatrixXf &getVertexNormals() const { return m_N; }
+    /// Return a pointer to the object space vertex normals (empty if there are none or if they are compressed)
+    const MatrixXf &getVertexNormals() const { return m_data->N; }
 
-    /// Return a pointer to the texture coordinates (or \c nullptr if there are none)
-    const MatrixXf &getVertexTexCoords() const { return m_UV; }
+    /// Return a pointer to the texture coordinates (empty if there are none or if they are compressed)
+    const MatrixXf &getVertexTexCoords() const { return m_data->UV; }
 
     /// Return a pointer to the triangle vertex index list
-    const MatrixXu &getIndices() const { return m_F; }
+    const MatrixXu &getIndices() const { return m_data->F; }
+
+    /// Return the (possibly shared) vertex and index buffers
+    const std::shared_ptr<const MeshData> &getData() const { return m_data; }
 
+    /// Return the object-to-world transformation of this instance
+    const Transform &getTransform() const { return m_toWorld; }
 
     /// Return the name of this mesh
     const std::string &getName() const { return m_name; }
@@ -116,12 +266,32 @@ protected:
     /// Create an empty mesh
     Mesh();
 
+    /**
+     * \brief Place the (possibly shared) object space buffers in the scene
+     *
+     * Transformed instances keep a private copy of the world space vertex
+     * positions and normals, so that ray intersection and shading run at
+     * the same speed as for untransformed meshes. Quantized positions and
+     * compressed normals are instead transformed on the fly to preserve
+     * their memory savings. Also computes the bounding box.
+     */
+    void setTransform(const Transform &toWorld);
+
+    /// Decode and transform a quantized vertex position
+    Point3f decodeVertex(uint32_t index) const;
+
+    /// Decode and transform a compressed vertex normal
+    Normal3f decodeNormal(uint32_t index) const;
+
 protected:
     std::string m_name;                  ///< Identifying name
-    MatrixXf      m_V;                   ///< Vertex positions
-    MatrixXf      m_N;                   ///< Vertex normals
-    MatrixXf      m_UV;                  ///< Vertex texture coordinates
-    MatrixXu      m_F;                   ///< Faces
+    std::shared_ptr<const MeshData> m_data; ///< Vertex and index buffers (in object space)
+    Transform m_toWorld;                 ///< Object-to-world transformation of this instance
+    bool m_hasTransform = false;         ///< Is \ref m_toWorld different from the identity?
+    MatrixXf m_positions;                ///< World space vertex positions of a transformed instance (if not quantized)
+    const float *m_vertexPositions = nullptr; ///< World space vertex positions (\ref m_positions or shared, if not quantized)
+    MatrixXf m_normals;                  ///< World space vertex normals of a transformed instance (if not compressed)
+    const float *m_vertexNormals = nullptr; ///< World space vertex normals (\ref m_normals or shared, if not compressed)
 
     DiscretePDF m_pdf;
 };
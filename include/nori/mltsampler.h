@@ -0,0 +1,166 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_MLTSAMPLER_H)
+#define __NORI_MLTSAMPLER_H
+
+#include <nori/sampler.h>
+#include <nori/lowdiscrepancy.h>
+#include <pcg32.h>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Sample generator of a Markov chain in primary sample space
+ *
+ * The sample is a point in the infinite-dimensional unit hypercube whose
+ * components are handed out by \ref next1D() and \ref next2D(), so that any
+ * integrator can evaluate a path from it. Every iteration of the chain
+ * mutates the point ("Simple and robust mutation strategy for Metropolis
+ * light transport algorithm", Kelemen et al. 2002): a large step draws all
+ * components anew, a small step perturbs them with a normal distribution
+ * of standard deviation \c sigma (wrapping around at the borders).
+ *
+ * Components are only mutated when the integrator asks for them, with the
+ * perturbations of all iterations in which they were not used at once (as
+ * in PBRT-v3). The mutation is undone with \ref reject() when the Metropolis
+ * step rejects the proposal.
+ *
+ * The sampler is driven by its owner with \ref startIteration() instead of
+ * \ref generate() and \ref advance(), and all random numbers derive from
+ * the \c index given to the constructor, so a chain can be restarted from
+ * an earlier sample by creating a sampler with the same index.
+ */
+class MetropolisSampler final : public Sampler {
+public:
+    MetropolisSampler(uint32_t index, float sigma, float largeStepProbability)
+        : m_sigma(sigma), m_largeStepProbability(largeStepProbability) {
+        m_sampleCount = 1;
+        uint32_t seed = LowDiscrepancy::hashPixel(Point2i((int) index, 0), 0x3171u);
+        m_random.seed(seed, LowDiscrepancy::mix(seed));
+    }
+
+    std::unique_ptr<Sampler> clone() const {
+        return std::unique_ptr<Sampler>(new MetropolisSampler(*this));
+    }
+
+    void prepare(const ImageBlock &) { }
+
+    void generate(const Point2i &) { }
+
+    void advance() { }
+
+    /// Propose the next sample of the chain (a large step or a small step)
+    void startIteration() {
+        ++m_iteration;
+        m_largeStep = m_random.nextFloat() < m_largeStepProbability;
+        m_dimension = 0;
+    }
+
+    /// Keep the proposed sample
+    void accept() {
+        if (m_largeStep)
+            m_lastLargeStep = m_iteration;
+    }
+
+    /// Restore the sample from before \ref startIteration()
+    void reject() {
+        for (PrimarySample &sample : m_samples) {
+            if (sample.modified == m_iteration) {
+                sample.value = sample.valueBackup;
+                sample.modified = sample.modifiedBackup;
+            }
+        }
+        --m_iteration;
+    }
+
+    /// Return whether the current proposal is a large step
+    bool isLargeStep() const { return m_largeStep; }
+
+    /// Return a uniformly distributed number that is not part of the sample
+    float nextRandom() { return m_random.nextFloat(); }
+
+    float next1D() {
+        return mutate(m_dimension++);
+    }
+
+    Point2f next2D() {
+        float x = mutate(m_dimension++);
+        return Point2f(x, mutate(m_dimension++));
+    }
+
+    virtual std::string toString() const override {
+        return tfm::format("MetropolisSampler[sigma=%f, largeStepProbability=%f]",
+                           m_sigma, m_largeStepProbability);
+    }
+
+protected:
+    /// Component of the sample
+    struct PrimarySample {
+        float value = 0.0f;
+        uint64_t modified = 0;          ///< Iteration in which the value was last mutated
+        float valueBackup = 0.0f;
+        uint64_t modifiedBackup = 0;
+    };
+
+    /// Bring a component up to date with the current iteration and return it
+    float mutate(size_t dimension) {
+        if (dimension >= m_samples.size())
+            m_samples.resize(dimension + 1);
+        PrimarySample &sample = m_samples[dimension];
+
+        /* Components that were not used since the last large step were
+           drawn anew by it */
+        if (sample.modified < m_lastLargeStep) {
+            sample.value = m_random.nextFloat();
+            sample.modified = m_lastLargeStep;
+        }
+
+        sample.valueBackup = sample.value;
+        sample.modifiedBackup = sample.modified;
+
+        if (m_largeStep) {
+            sample.value = m_random.nextFloat();
+        } else {
+            /* The sum of n normally distributed perturbations is normally
+               distributed with sqrt(n) times the standard deviation */
+            float sigma = m_sigma * std::sqrt((float) (m_iteration - sample.modified));
+            float radius = std::sqrt(-2.0f * std::log(1.0f - m_random.nextFloat()));
+            float offset = sigma * radius * std::cos(2.0f * M_PI * m_random.nextFloat());
+            sample.value += offset - std::floor(sample.value + offset);
+            sample.value = std::min(std::max(sample.value, 0.0f), 0.99999994f);
+        }
+        sample.modified = m_iteration;
+        return sample.value;
+    }
+
+private:
+    float m_sigma;
+    float m_largeStepProbability;
+    pcg32 m_random;
+    std::vector<PrimarySample> m_samples;
+    uint64_t m_iteration = 0;
+    uint64_t m_lastLargeStep = 0;
+    bool m_largeStep = true;
+    size_t m_dimension = 0;
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_MLTSAMPLER_H */
@@ -0,0 +1,61 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_MMAP_H)
+#define __NORI_MMAP_H
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Read-only memory mapping of a file
+ *
+ * The pages are loaded on demand and shared with other processes that map
+ * the same file, e.g. renderers working on frames of the same scene.
+ */
+class MemoryMappedFile {
+public:
+    /// Map the file at \c filename (throws a \ref NoriException on failure)
+    MemoryMappedFile(const std::string &filename);
+
+    /// Unmap the file
+    ~MemoryMappedFile();
+
+    /// Return a pointer to the contents of the file
+    const uint8_t *getData() const { return m_data; }
+
+    /// Return the size of the file in bytes
+    size_t getSize() const { return m_size; }
+
+private:
+    MemoryMappedFile(const MemoryMappedFile &) = delete;
+    MemoryMappedFile &operator=(const MemoryMappedFile &) = delete;
+
+private:
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+#if defined(PLATFORM_WINDOWS)
+    void *m_file = nullptr;
+    void *m_mapping = nullptr;
+#endif
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_MMAP_H */
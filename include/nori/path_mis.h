@@ -0,0 +1,239 @@
+#if !defined(__NORI_PATH_MIS_H)
+#define __NORI_PATH_MIS_H
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/warp.h>
+#include <nori/bsdf.h>
+#include <nori/ris.h>
+#include <nori/roulette.h>
+#include <nori/timer.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+class PathMisIntegrator final : public Integrator
+{
+public:
+    PathMisIntegrator(const PropertyList &props) : m_roulette(props, 0.99f, true)
+    {
+        // Number of light samples that are resampled for next event estimation
+        m_lightCandidates = props.getInteger("lightCandidates", 1);
+        if (m_lightCandidates < 1)
+            throw NoriException("PathMisIntegrator: lightCandidates must be at least 1");
+
+        // Samples per pixel and resolution of the radiance estimate of the "adrrs" roulette
+        m_adrrsTrainingSpp = props.getInteger("adrrsTrainingSpp", 16);
+        m_adrrsResolution = props.getInteger("adrrsResolution", 16);
+        if (m_adrrsTrainingSpp < 1 || m_adrrsResolution < 1)
+            throw NoriException("PathMisIntegrator: invalid adrrsTrainingSpp or adrrsResolution");
+    }
+
+    /// Learn the radiance estimate of the adjoint-driven roulette
+    void preprocess(const Scene *scene)
+    {
+        m_radianceCache.reset();
+        if (!m_roulette.isAdjoint())
+            return;
+
+        cout << "Learning the radiance estimate for ADRRS .. ";
+        cout.flush();
+        Timer timer;
+
+        std::unique_ptr<RadianceCache> cache(new RadianceCache(scene->getBoundingBox(), m_adrrsResolution));
+        cache->train(scene, m_adrrsTrainingSpp, [&](RadianceCache::PathSampler &sampler, const Ray3f &ray) {
+            LiKernel(scene, &sampler, ray, cache.get());
+        });
+        m_radianceCache = std::move(cache);
+
+        cout << "done. (took " << timer.elapsedString() << ", "
+             << m_radianceCache->getOccupiedCells() << " cells)" << endl;
+    }
+
+    /// Compute the radiance value for a given ray. Just return green here
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+    {
+        return LiKernel(scene, sampler, ray);
+    }
+
+    /**
+     * \brief Version of \ref Li() that calls the sampler through its concrete type
+     *
+     * \param record
+     *    When given, the reflected radiance estimates of the path vertices
+     *    are recorded in this cache (and paths are not split)
+     */
+    template <typename SamplerType>
+    Color3f LiKernel(const Scene *scene, SamplerType *sampler, const Ray3f &ray,
+                     RadianceCache *record = nullptr) const
+    {
+        Color3f color = BLACK;
+
+        Intersection its;
+        // If the ray has no intersection we can return the black color;
+        if (!scene->rayIntersect(ray, its))
+            return color;
+
+        // We add the Le part to the record if the mesh is an emitter
+        if (its.mesh->isEmitter())
+        {
+            EmitterQueryRecord eRec(ray.o, its.p(), its.shFrame().n);
+            color += its.mesh->getEmitter()->eval(eRec);
+        }
+
+        // Estimate of the pixel value that the roulette compares the paths against
+        float pixelEstimate = -1.0f;
+        if (m_radianceCache && !record)
+        {
+            float reflected = m_radianceCache->lookup(its.p());
+            if (reflected >= 0.0f)
+                pixelEstimate = color.getLuminance() + reflected;
+        }
+
+        return color + tracePath(scene, sampler, ray, its, WHITE, 0, pixelEstimate,
+                                 m_roulette.getMaxSplit(), record);
+    }
+
+    /// Return a human-readable description for debugging purposes
+    std::string toString() const
+    {
+        return tfm::format("[Path Mis integrator lightCandidates = %i, roulette = %s]",
+                           m_lightCandidates, m_roulette.toString());
+    }
+
+protected:
+    /// Largest number of vertices of a path whose estimates are recorded
+    static const int MAX_RECORDED_VERTICES = 32;
+
+    /**
+     * \brief Estimate the radiance reflected at \c its towards the origin of
+     * \c currentRay, times the throughput \c attenuation
+     *
+     * \param splitBudget
+     *    Number of paths into which this path may still be split
+     */
+    template <typename SamplerType>
+    Color3f tracePath(const Scene *scene, SamplerType *sampler, Ray3f currentRay, Intersection its,
+                      Color3f attenuation, int depth, float pixelEstimate, int splitBudget,
+                      RadianceCache *record) const
+    {
+        Color3f color = BLACK;
+
+        // Radiance estimates of the vertices that are recorded
+        Point3f positions[MAX_RECORDED_VERTICES];
+        Color3f throughputs[MAX_RECORDED_VERTICES];
+        Color3f colors[MAX_RECORDED_VERTICES];
+        int vertexCount = 0;
+
+        // Continue until the Russian Roulette says stop
+        while (true)
+        {
+            if (record && vertexCount < MAX_RECORDED_VERTICES)
+            {
+                positions[vertexCount] = its.p();
+                throughputs[vertexCount] = attenuation;
+                colors[vertexCount++] = color;
+            }
+
+            // Sample EMS, resampling the light candidates by their contribution
+            color += attenuation * sampleDirectLight(scene, its, its.toLocal(-currentRay.d), sampler, m_lightCandidates);
+
+            // Update the russian roulette, or split the path
+            float expected = -1.0f;
+            if (pixelEstimate > 0.0f)
+            {
+                float reflected = m_radianceCache->lookup(its.p());
+                if (reflected > 0.0f)
+                    expected = attenuation.getLuminance() * reflected / pixelEstimate;
+            }
+            int paths = m_roulette.evaluate(attenuation, depth, sampler->next1D(), expected, splitBudget);
+            if (paths == 0)
+                break;
+            splitBudget /= paths;
+
+            // The additional paths of a split continue independently
+            for (int i = 1; i < paths; ++i)
+            {
+                Ray3f splitRay = currentRay;
+                Intersection splitIts = its;
+                Color3f splitAttenuation = attenuation;
+                if (scatter(scene, sampler, splitRay, splitIts, splitAttenuation, color))
+                    color += tracePath(scene, sampler, splitRay, splitIts, splitAttenuation,
+                                       depth + 1, pixelEstimate, splitBudget, nullptr);
+            }
+
+            if (!scatter(scene, sampler, currentRay, its, attenuation, color))
+                break;
+            ++depth;
+        }
+
+        // The reflected radiance at a vertex is what the path gathered after it
+        for (int i = 0; i < vertexCount; ++i)
+        {
+            float throughput = throughputs[i].getLuminance();
+            if (throughput > 0.0f)
+                record->record(positions[i], Color3f(color - colors[i]).getLuminance() / throughput);
+        }
+
+        return color;
+    }
+
+    /**
+     * \brief Sample the BSDF at \c its, find the next vertex and add its
+     * emission (weighted against light sampling) to \c color
+     *
+     * \return
+     *    \c false if the path does not continue
+     */
+    template <typename SamplerType>
+    bool scatter(const Scene *scene, SamplerType *sampler, Ray3f &currentRay, Intersection &its,
+                 Color3f &attenuation, Color3f &color) const
+    {
+        // Sample the BRDF
+        BSDFQueryRecord bRec(its.shFrame().toLocal(-currentRay.d));
+        bRec.uv = its.uv();
+        Color3f brdf = its.mesh->getBSDF()->sample(bRec, sampler->next2D());
+        attenuation *= brdf;
+        if (attenuation.isZero())
+            return false;
+
+        // Continue the recursion
+        currentRay = Ray3f(its.p(), its.toWorld(bRec.wo));
+
+        // Sample MATS
+        float pdf_mat = its.mesh->getBSDF()->pdf(bRec);
+
+        Point3f origin = its.p();
+        if (!scene->rayIntersect(currentRay, its))
+            return false;
+
+        if (its.mesh->isEmitter())
+        {
+            EmitterQueryRecord eRec = EmitterQueryRecord(origin, its.p(), its.shFrame().n);
+            const Emitter *emitter = its.mesh->getEmitter();
+            float w_mats = 1.0f;
+            if (bRec.measure != EDiscrete)
+            {
+                float pdf_em = emitter->pdf(eRec) * scene->pdfEmitter(origin, emitter);
+                w_mats = pdf_mat + pdf_em > 0.f ? pdf_mat / (pdf_mat + pdf_em) : pdf_mat;
+            }
+            color += attenuation * w_mats * emitter->eval(eRec);
+        }
+
+        return true;
+    }
+
+    float ray_length;
+    int m_lightCandidates;
+    RussianRoulette m_roulette;
+    int m_adrrsTrainingSpp;
+    int m_adrrsResolution;
+    std::unique_ptr<RadianceCache> m_radianceCache;
+
+    const Color3f BLACK = Color3f(0.0f);
+    const Color3f WHITE = Color3f(1.0f);
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_PATH_MIS_H */
@@ -0,0 +1,154 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_RENDERKERNEL_H)
+#define __NORI_RENDERKERNEL_H
+
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <nori/block.h>
+#include <typeindex>
+#include <tuple>
+#include <map>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Render one sample per pixel of an image block
+ *
+ * The loop is templated on the concrete camera, sampler and integrator
+ * classes. When these are \c final classes whose methods are visible in
+ * headers, the compiler resolves and inlines calls such as
+ * \ref Camera::sampleRay(), \ref Sampler::next2D() and
+ * \ref Integrator::LiKernel() instead of dispatching them virtually.
+ * Instantiated with the abstract base classes, this is the generic
+ * renderer that works with any plugin.
+ */
+template <typename CameraType, typename SamplerType, typename IntegratorType>
+void renderBlockKernel(const Scene *scene, Sampler *sampler_, ImageBlock &block) {
+    const CameraType *camera = static_cast<const CameraType *>(scene->getCamera());
+    const IntegratorType *integrator = static_cast<const IntegratorType *>(scene->getIntegrator());
+    SamplerType *sampler = static_cast<SamplerType *>(sampler_);
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+
+    // Color Channels
+    const int RED = 0, GREEN = 1, BLUE = 2;
+
+    /* Clear the block contents */
+    block.clear();
+
+    /* Integrators that render whole tiles at once */
+    if (integrator->renderBlock(scene, sampler, block))
+        return;
+
+    /* For each pixel and pixel sample sample */
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            Point2i pixel(x + offset.x(), y + offset.y());
+            sampler->generate(pixel);
+
+            Point2f pixelSample = pixel.cast<float>() + sampler->next2D();
+            Point2f apertureSample = sampler->next2D();
+
+            /* Sample a ray from the camera */
+            Ray3f ray;
+            Color3f value;
+
+            // Check for chromatic aberrations
+            if(camera->hasChromaticAberrations() && !camera->tracesAllChannels()) {
+                // Trace a single randomly chosen color channel, weighted
+                // by the inverse probability of choosing it
+                int channel = std::min((int) (sampler->next1D() * 3), BLUE);
+                value = camera->sampleRay(ray, pixelSample, apertureSample, channel) * 3.0f;
+                value *= integrator->LiKernel(scene, sampler, ray);
+            } else if(camera->hasChromaticAberrations()) {
+                Ray3f ray0, ray1, ray2;
+                Color3f value0, value1, value2;
+
+                // Sample each color channel separately
+                value0 = camera->sampleRay(ray0, pixelSample, apertureSample, RED);
+                value1 = camera->sampleRay(ray1, pixelSample, apertureSample, GREEN);
+                value2 = camera->sampleRay(ray2, pixelSample, apertureSample, BLUE);
+
+                // Compute incident radience for each channel
+                value0 *= integrator->LiKernel(scene, sampler, ray0);
+                value1 *= integrator->LiKernel(scene, sampler, ray1);
+                value2 *= integrator->LiKernel(scene, sampler, ray2);
+
+                // Sum all of the color channels
+                value = value0 + value1 + value2;
+            } else {
+                // Sample all color channels together
+                value = camera->sampleRay(ray, pixelSample, apertureSample);
+                /* Compute the incident radiance */
+                value *= integrator->LiKernel(scene, sampler, ray);
+            }
+
+            /* Store in the image block */
+            block.put(pixelSample, value);
+
+            sampler->advance();
+        }
+    }
+}
+
+/**
+ * \brief Registry of render kernels that were specialized for specific
+ * combinations of camera, sampler and integrator classes
+ *
+ * Kernels are registered with the \ref NORI_REGISTER_RENDER_KERNEL macro.
+ * Scenes using any other combination are rendered by the generic kernel.
+ */
+class RenderKernel {
+public:
+    typedef void (*Function)(const Scene *scene, Sampler *sampler, ImageBlock &block);
+
+    /// Register a specialized kernel for a combination of classes
+    static void registerKernel(const std::type_info &camera, const std::type_info &sampler,
+                               const std::type_info &integrator, Function kernel);
+
+    /**
+     * \brief Return the kernel for the camera, sampler and integrator of a
+     * scene, or the generic kernel if no specialized kernel was registered
+     *
+     * \param specialized
+     *    Set to \c true when a specialized kernel was found
+     */
+    static Function get(const Scene *scene, bool *specialized = nullptr);
+
+private:
+    typedef std::tuple<std::type_index, std::type_index, std::type_index> Key;
+    static std::map<Key, Function> *m_kernels;
+};
+
+/// Macro for registering a specialized render kernel with the \ref RenderKernel registry
+#define NORI_REGISTER_RENDER_KERNEL(camera, sampler, integrator) \
+    static struct camera ##_## sampler ##_## integrator ##_kernel_ { \
+        camera ##_## sampler ##_## integrator ##_kernel_() { \
+            RenderKernel::registerKernel(typeid(camera), typeid(sampler), typeid(integrator), \
+                renderBlockKernel<camera, sampler, integrator>); \
+        } \
+    } camera ##_## sampler ##_## integrator ##__NORI_KERNEL_;
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_RENDERKERNEL_H */
@@ -0,0 +1,194 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_RIS_H)
+#define __NORI_RIS_H
+
+#include <nori/scene.h>
+#include <nori/bsdf.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Weighted reservoir that keeps one candidate out of a stream
+ *
+ * Each candidate replaces the current one with a probability proportional
+ * to its resampling weight, so that the reservoir ends up holding a sample
+ * of the stream distributed according to the weights. This is the building
+ * block of resampled importance sampling (RIS); see "Spatiotemporal
+ * reservoir resampling for real-time ray tracing with dynamic direct
+ * lighting" by Bitterli et al. (2020).
+ */
+template <typename T> struct Reservoir {
+    /// The selected candidate
+    T sample;
+    /// Target density of the selected candidate
+    float targetPdf = 0.0f;
+    /// Sum of the resampling weights
+    float wSum = 0.0f;
+    /// Number of candidates that were seen
+    uint32_t M = 0;
+
+    /**
+     * \brief Add a candidate to the reservoir
+     *
+     * \param weight
+     *    Resampling weight of the candidate
+     * \param targetPdf
+     *    Target density of the candidate
+     * \param u
+     *    A uniformly distributed sample on \f$[0,1)\f$
+     * \param count
+     *    Number of candidates that the weight stands for (larger than one
+     *    when merging another reservoir)
+     * \return
+     *    \c true when the candidate was selected
+     */
+    bool update(const T &candidate, float weight, float targetPdf, float u, uint32_t count = 1) {
+        wSum += weight;
+        M += count;
+        if (weight > 0.0f && u * wSum < weight) {
+            sample = candidate;
+            this->targetPdf = targetPdf;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * \brief Return the contribution weight of the selected sample
+     *
+     * Dividing by the number \c Z of candidates whose source could have
+     * produced the selected sample keeps the estimate unbiased when
+     * reservoirs with different target densities are merged.
+     */
+    float getWeight(uint32_t Z) const {
+        return targetPdf > 0.0f && Z > 0 ? wSum / (Z * targetPdf) : 0.0f;
+    }
+
+    /// Return the contribution weight for a reservoir over a single distribution
+    float getWeight() const { return getWeight(M); }
+};
+
+/**
+ * \brief A light sample in primary sample space
+ *
+ * Storing the random numbers instead of the point on the emitter allows
+ * re-evaluating the sample at another shading point with any emitter type.
+ * The evaluated record and value refer to the point that owns the sample.
+ */
+struct LightSample {
+    /// Random number that selects the emitter
+    float uLight = 0.0f;
+    /// Random numbers that select the point on the emitter
+    Point2f uPoint = Point2f(0.0f);
+    /// The sampled emitter query (for the shadow ray)
+    EmitterQueryRecord eRec;
+    /// The unshadowed contribution divided by the sampling density
+    Color3f value = Color3f(0.0f);
+};
+
+/**
+ * \brief Evaluate next event estimation for a light sample
+ *
+ * Selects an emitter with \ref Scene::sampleEmitter() and a point on it
+ * from the random numbers of \c s, and stores the emitter query and the
+ * unshadowed contribution divided by the density of the sample in \c s.
+ * The contribution includes the MIS weight against BSDF sampling, so the
+ * result can be combined with BSDF-sampled emitter hits as usual.
+ *
+ * \param wi
+ *    Direction towards the previous path vertex in the local shading frame
+ * \return
+ *    The luminance of the contribution, which is used as the target
+ *    density for resampling
+ */
+inline float evalLightSample(const Scene *scene, const Intersection &its, const Vector3f &wi, LightSample &s) {
+    s.value = Color3f(0.0f);
+
+    float lightPdf = 0.0f;
+    const Emitter *light = scene->sampleEmitter(its.p(), s.uLight, lightPdf);
+    if (!light)
+        return 0.0f;
+
+    s.eRec = EmitterQueryRecord(its.p());
+    Color3f Li = light->sample(s.eRec, s.uPoint) / lightPdf;
+    float pdf_em = light->pdf(s.eRec) * lightPdf;
+
+    float theta = std::max(0.0f, Frame::cosTheta(its.toLocal(s.eRec.wi)));
+
+    BSDFQueryRecord bRec(wi, its.toLocal(s.eRec.wi), ESolidAngle);
+    bRec.uv = its.uv();
+
+    const BSDF *bsdf = its.mesh->getBSDF();
+    Color3f brdf = bsdf->eval(bRec);
+    float pdf_mat = bsdf->pdf(bRec);
+
+    /* BSDF sampling cannot hit lights that are located at a single point */
+    float w_ems = light->isDeltaPosition() ? 1.0f :
+        (pdf_mat + pdf_em) > 0.0f ? pdf_em / (pdf_mat + pdf_em) : pdf_em;
+
+    s.value = w_ems * brdf * theta * Li;
+    if (!s.value.isValid())
+        s.value = Color3f(0.0f);
+    return std::max(0.0f, s.value.getLuminance());
+}
+
+/**
+ * \brief Draw \c count light samples for a shading point and resample
+ * one of them proportionally to its unshadowed contribution
+ *
+ * The candidates are uniform in primary sample space, so the resampling
+ * weight of a candidate equals its target density. With a single
+ * candidate this is ordinary next event estimation.
+ */
+template <typename SamplerType>
+inline Reservoir<LightSample> sampleLightCandidates(const Scene *scene, const Intersection &its,
+        const Vector3f &wi, SamplerType *sampler, int count) {
+    Reservoir<LightSample> reservoir;
+    for (int i = 0; i < count; ++i) {
+        LightSample s;
+        s.uLight = sampler->next1D();
+        s.uPoint = sampler->next2D();
+        float target = evalLightSample(scene, its, wi, s);
+        reservoir.update(s, target, target, i == 0 ? 0.0f : sampler->next1D());
+    }
+    return reservoir;
+}
+
+/**
+ * \brief Resampled next event estimation with a single shadow ray
+ *
+ * \param count
+ *    Number of light samples that are resampled
+ * \return
+ *    The direct illumination estimate, MIS-weighted against BSDF sampling
+ */
+template <typename SamplerType>
+inline Color3f sampleDirectLight(const Scene *scene, const Intersection &its,
+        const Vector3f &wi, SamplerType *sampler, int count) {
+    Reservoir<LightSample> reservoir = sampleLightCandidates(scene, its, wi, sampler, count);
+    float weight = reservoir.getWeight();
+    if (weight == 0.0f || scene->rayIntersect(reservoir.sample.eRec.shadowRay))
+        return Color3f(0.0f);
+    return reservoir.sample.value * weight;
+}
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_RIS_H */
@@ -0,0 +1,223 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_ROULETTE_H)
+#define __NORI_ROULETTE_H
+
+#include <nori/atomic.h>
+#include <nori/bbox.h>
+#include <nori/color.h>
+#include <nori/proplist.h>
+#include <nori/ray.h>
+#include <pcg32.h>
+#include <functional>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Path termination policy of the path tracing integrators
+ *
+ * Decides after every path vertex whether a path is terminated (Russian
+ * roulette), continued, or split into several paths. It is configured with
+ * the following properties of the integrator:
+ *
+ * - \c rrStrategy: \c "luminance" or \c "max" (survival probability from
+ *   the luminance or the largest component of the path throughput),
+ *   \c "red" (from the first component; the former behavior, which never
+ *   continues paths without red throughput) or \c "adrrs" (adjoint-driven
+ *   Russian roulette and splitting, see below)
+ * - \c rrDepth: number of path vertices before roulette starts
+ * - \c rrMaxProbability: upper bound of the survival probability (also
+ *   with \c "adrrs", so that paths that are trapped between specular
+ *   surfaces terminate)
+ *
+ * With \c "adrrs" the integrator passes the expected contribution of the
+ * path relative to the pixel, as predicted by a \ref RadianceCache, and the
+ * path is kept within a weight window around it: paths below the window are
+ * terminated with a probability that brings the survivors into it, paths
+ * above it are split ("Adjoint-driven Russian roulette and splitting in
+ * light transport simulation" by Vorba and Křivánek, 2016). \c adrrsWindow
+ * is the ratio of the bounds of the window, and a camera sample is split
+ * into at most \c adrrsMaxSplit paths. Without a prediction, the \c "max"
+ * rule is used.
+ */
+class RussianRoulette {
+public:
+    enum EStrategy {
+        ERed = 0,
+        ELuminance,
+        EMaxComponent,
+        EAdjoint
+    };
+
+    /**
+     * \brief Read the policy from the properties of an integrator
+     *
+     * \param defaultMaxProbability
+     *    Default of \c rrMaxProbability
+     * \param supportsAdjoint
+     *    Whether the integrator provides the predictions of \c "adrrs"
+     */
+    RussianRoulette(const PropertyList &props, float defaultMaxProbability = 0.99f,
+                    bool supportsAdjoint = false);
+
+    /// Return the strategy
+    EStrategy getStrategy() const { return m_strategy; }
+
+    /// Return whether paths are terminated and split with predictions of a \ref RadianceCache
+    bool isAdjoint() const { return m_strategy == EAdjoint; }
+
+    /// Return the largest number of paths that a camera sample is split into
+    int getMaxSplit() const { return m_maxSplit; }
+
+    /**
+     * \brief Decide how a path continues after a vertex
+     *
+     * \param throughput
+     *    Throughput of the path, which is divided by the survival probability
+     *    or the number of paths when the path continues
+     * \param depth
+     *    Index of the vertex along the path (0 for the first vertex)
+     * \param sample
+     *    A uniformly distributed sample on \f$[0,1)\f$
+     * \param expected
+     *    Expected contribution of the path relative to the pixel value
+     *    (\c "adrrs" only; zero or negative if unknown, since a path that
+     *    is predicted to contribute nothing may not be terminated for sure)
+     * \param maxPaths
+     *    Upper bound of the number of paths into which the path is split
+     * \return
+     *    The number of paths that continue with the updated throughput:
+     *    0 when the path is terminated and more than 1 when it is split
+     */
+    int evaluate(Color3f &throughput, int depth, float sample, float expected = -1.0f,
+                 int maxPaths = 1) const {
+        if (depth < m_minDepth)
+            return 1;
+
+        float probability;
+        if (m_strategy == EAdjoint && expected > 0.0f) {
+            float upper = m_windowLower * m_windowRatio;
+            int paths = std::min(maxPaths, (int) std::ceil(expected / upper));
+            if (paths > 1) {
+                throughput /= (float) paths;
+                return paths;
+            }
+            probability = std::min(m_maxProbability, expected / m_windowLower);
+        } else {
+            probability = getSurvivalProbability(throughput, depth);
+        }
+
+        if (!(probability > 0.0f) || sample >= probability)
+            return 0;
+        throughput /= probability;
+        return 1;
+    }
+
+    /**
+     * \brief Return the survival probability of a path without splitting
+     * (e.g. for particles traced from the lights)
+     */
+    float getSurvivalProbability(const Color3f &throughput, int depth) const {
+        if (depth < m_minDepth)
+            return 1.0f;
+        float probability;
+        switch (m_strategy) {
+            case ERed: probability = throughput.x(); break;
+            case ELuminance: probability = throughput.getLuminance(); break;
+            default: probability = throughput.maxCoeff(); break;
+        }
+        return std::min(probability, m_maxProbability);
+    }
+
+    /// Return a human-readable description of the policy
+    std::string toString() const;
+
+private:
+    EStrategy m_strategy;
+    int m_minDepth;
+    float m_maxProbability;
+    float m_windowRatio;
+    float m_windowLower;
+    int m_maxSplit;
+};
+
+/**
+ * \brief Coarse estimate of the radiance reflected at surfaces, which
+ * predicts the contribution of a path for adjoint-driven Russian roulette
+ *
+ * The luminance is averaged over the cells of a regular grid over the scene
+ * (ignoring the direction). It is learned in a pre-pass from the radiance
+ * estimates of paths traced from the camera; see \ref train().
+ */
+class RadianceCache {
+public:
+    /// Adapter that lets the training paths draw from a random number generator
+    struct PathSampler {
+        pcg32 &rng;
+        float next1D() { return rng.nextFloat(); }
+        Point2f next2D() { float x = rng.nextFloat(); return Point2f(x, rng.nextFloat()); }
+    };
+
+    /// Create an empty cache with \c resolution cells along the longest axis of \c bbox
+    RadianceCache(const BoundingBox3f &bbox, int resolution);
+
+    /// Add a radiance estimate (thread-safe)
+    void record(const Point3f &p, float luminance) {
+        size_t index = getCell(p);
+        m_sum[index].add(luminance);
+        m_count[index].add(1.0f);
+    }
+
+    /// Return the average radiance in the cell of \c p, or a negative value if nothing was recorded
+    float lookup(const Point3f &p) const {
+        size_t index = getCell(p);
+        float count = m_count[index].get();
+        return count > 0.0f ? m_sum[index].get() / count : -1.0f;
+    }
+
+    /**
+     * \brief Trace \c spp paths per pixel in parallel to learn the cache
+     *
+     * \c trace is called with the primary ray and a sampler of the pixel and
+     * should record the estimates at the vertices of its path.
+     */
+    void train(const Scene *scene, int spp,
+               const std::function<void(PathSampler &, const Ray3f &)> &trace);
+
+    /// Return the number of cells in which radiance was recorded
+    size_t getOccupiedCells() const;
+
+private:
+    size_t getCell(const Point3f &p) const {
+        Vector3i cell = ((p - m_bbox.min).cwiseProduct(m_scale)).cast<int>();
+        cell = cell.cwiseMax(Vector3i::Zero()).cwiseMin(m_resolution - Vector3i::Ones());
+        return (size_t) ((cell.z() * m_resolution.y() + cell.y()) * m_resolution.x() + cell.x());
+    }
+
+    BoundingBox3f m_bbox;
+    Vector3f m_scale;
+    Vector3i m_resolution;
+    std::vector<AtomicFloat> m_sum;
+    std::vector<AtomicFloat> m_count;
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_ROULETTE_H */
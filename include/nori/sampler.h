@@ -44,12 +44,13 @@ class ImageBlock;
  * random numbers, e.g. as part of a Metropolis-Hastings integration scheme.
  *
  * The general interface between a sampler and a rendering algorithm is as 
- * follows: Before beginning to render a pixel, the rendering algorithm calls 
- * \ref generate(). The first pixel sample can now be computed, after which
- * \ref advance() needs to be invoked. This repeats until all pixel samples have
- * been exhausted.  While computing a pixel sample, the rendering 
- * algorithm requests (pseudo-) random numbers using the \ref next1D() and
- * \ref next2D() functions.
+ * follows: Before beginning to render a pixel sample, the rendering algorithm
+ * calls \ref generate() with the pixel position. The pixel sample can now be
+ * computed, after which \ref advance() needs to be invoked. This repeats until
+ * all pixel samples have been exhausted. Samples of different pixels may be
+ * interleaved (e.g. one sample per pixel and pass over the image). While
+ * computing a pixel sample, the rendering algorithm requests (pseudo-)
+ * random numbers using the \ref next1D() and \ref next2D() functions.
  *
  * Conceptually, the right way of thinking of this goes as follows:
  * For each sample in a pixel, a sample generator produces a (hypothetical)
@@ -81,12 +82,12 @@ public:
     /**
      * \brief Prepare to generate new samples
      * 
-     * This function is called initially and every time the 
-     * integrator starts rendering a new pixel.
+     * This function is called every time the integrator starts
+     * rendering a sample of the given pixel.
      */
-    virtual void generate() = 0;
+    virtual void generate(const Point2i &pixel) = 0;
 
-    /// Advance to the next sample
+    /// Advance to the next sample of the current pixel
     virtual void advance() = 0;
 
     /// Retrieve the next component value from the current sample
@@ -107,6 +108,38 @@ protected:
     size_t m_sampleCount;
 };
 
+/**
+ * \brief Superclass of samplers whose sample values are a function of the
+ * pixel, the sample index within the pixel and the dimension
+ *
+ * This class keeps track of the number of samples that were taken so far
+ * in every pixel of the current image block, so that the sample index is
+ * independent of the order in which pixels are visited.
+ */
+class PixelSampler : public Sampler {
+public:
+    virtual void prepare(const ImageBlock &block) override;
+
+    virtual void generate(const Point2i &pixel) override;
+
+    virtual void advance() override;
+
+protected:
+    uint32_t m_sampleOffset = 0;           ///< Index of the first sample of every pixel (e.g. for sharded renders)
+    Point2i m_pixel = Point2i(0, 0);       ///< Current pixel
+    uint32_t m_sampleIndex = 0;            ///< Index of the current sample within the pixel
+    uint32_t m_dimension = 0;              ///< Next dimension of the current sample
+
+private:
+    /// Return the sample counter of the current pixel
+    uint32_t &sampleCounter();
+
+    Point2i m_blockOffset = Point2i(0, 0);
+    Vector2i m_blockSize = Vector2i(0, 0);
+    std::vector<uint32_t> m_sampleCounts;  ///< Samples taken so far in every pixel of the block
+    uint32_t m_outsideCount = 0;           ///< Counter for pixels outside of the block
+};
+
 NORI_NAMESPACE_END
 
 #endif /* __NORI_SAMPLER_H */
@@ -20,6 +20,7 @@
 #define __NORI_SCENE_H
 
 #include <nori/bvh.h>
+#include <nori/lightbvh.h>
 #include <nori/emitter.h>
 #include <nori/medium.h>
 
@@ -73,6 +74,26 @@ public:
         return m_emitters[index];
     }
 
+    /**
+     * \brief Choose an emitter for next event estimation at \c ref
+     *
+     * Emitters are chosen from a light hierarchy (\ref LightBVH) with a
+     * probability that roughly follows their contribution at \c ref.
+     *
+     * \param pdf
+     *    Receives the probability of choosing the returned emitter
+     * \return
+     *    The chosen emitter, or \c nullptr if no emitter contributes
+     */
+    const Emitter *sampleEmitter(const Point3f &ref, float sample, float &pdf) const {
+        return m_lightBVH->sample(ref, sample, pdf);
+    }
+
+    /// Return the probability that \ref sampleEmitter() chooses \c emitter at \c ref
+    float pdfEmitter(const Point3f &ref, const Emitter *emitter) const {
+        return m_lightBVH->pdf(ref, emitter);
+    }
+
     /// Return the medium in the scene
     Medium* getMedium() const {return m_medium;}
 
@@ -114,6 +135,26 @@ public:
         return m_bvh->rayIntersect(ray, its, true);
     }
 
+    /**
+     * \brief Intersect a packet of up to \ref BVH::PacketSize coherent rays
+     * (e.g. camera rays of neighboring pixels) against the scene
+     *
+     * \return A bit mask of the rays that found an intersection
+     */
+    uint32_t rayIntersectPacket(const Ray3f *rays, Intersection *its, uint32_t count) const {
+        return m_bvh->rayIntersectPacket(rays, its, count, false);
+    }
+
+    /**
+     * \brief Determine which rays of a packet of up to \ref BVH::PacketSize
+     * shadow rays are occluded
+     *
+     * \return A bit mask of the occluded rays
+     */
+    uint32_t rayIntersectPacket(const Ray3f *rays, uint32_t count) const {
+        return m_bvh->rayIntersectPacket(rays, nullptr, count, true);
+    }
+
     /**
      * \brief Return an axis-aligned box that bounds the scene
      */
@@ -143,6 +184,7 @@ private:
     Sampler *m_sampler = nullptr;
     Camera *m_camera = nullptr;
     BVH *m_bvh = nullptr;
+    LightBVH *m_lightBVH = nullptr;
 
     std::vector<Emitter *> m_emitters;
 };
@@ -0,0 +1,146 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_SDTREE_H)
+#define __NORI_SDTREE_H
+
+#include <nori/bbox.h>
+#include <nori/atomic.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Quadtree over the sphere of directions that learns a distribution
+ * proportional to incident radiance
+ *
+ * Directions are mapped to the unit square with the area-preserving
+ * cylindrical mapping <tt>(cos(theta), phi)</tt>. Every node stores the
+ * energy that was recorded in its four quadrants; recording is thread-safe.
+ */
+class DTree {
+public:
+    DTree();
+
+    /// Map a direction to the unit square
+    static Point2f dirToCanonical(const Vector3f &d);
+
+    /// Map a point of the unit square to a direction
+    static Vector3f canonicalToDir(const Point2f &p);
+
+    /// Record the (radiance / pdf) estimate of a sample in direction \c d
+    void record(const Vector3f &d, float value);
+
+    /// Return the density of \ref sample() with respect to solid angles
+    float pdf(const Vector3f &d) const;
+
+    /// Sample a direction proportionally to the learned distribution
+    Vector3f sample(Point2f sample) const;
+
+    /// Return the number of recorded samples
+    float getWeight() const { return m_weight.get(); }
+
+    /// Scale the number of recorded samples (e.g. when a spatial leaf is split)
+    void scaleWeight(float factor) { m_weight = AtomicFloat(m_weight.get() * factor); }
+
+    /// Return the number of quadtree nodes
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Return the memory usage of the nodes in bytes
+    size_t getMemory() const { return m_nodes.size() * sizeof(Node); }
+
+    /**
+     * \brief Return an empty tree whose nodes are subdivided where this
+     * tree's quadrants hold more than \c threshold of the total energy
+     *
+     * \param maxNodes
+     *    Upper bound on the number of nodes of the new tree
+     */
+    DTree refine(float threshold, size_t maxNodes) const;
+
+private:
+    struct Node {
+        AtomicFloat sum[4];
+        uint32_t child[4];   ///< Child node of each quadrant, 0 if it is a leaf
+
+        Node() { child[0] = child[1] = child[2] = child[3] = 0; }
+
+        float total() const { return sum[0].get() + sum[1].get() + sum[2].get() + sum[3].get(); }
+    };
+
+    std::vector<Node> m_nodes;
+    AtomicFloat m_weight;
+};
+
+/**
+ * \brief Spatio-directional tree for path guiding
+ *
+ * A binary tree subdivides the (cubified) scene bounds by alternating
+ * axes. Each leaf holds two \ref DTree instances: one that is sampled
+ * (learned in the previous iteration) and one that records the current
+ * iteration. See "Practical Path Guiding for Efficient Light-Transport
+ * Simulation" by Thomas Müller, Markus Gross and Jan Novák (2017).
+ */
+class SDTree {
+public:
+    /// Directional distributions of one spatial leaf
+    struct Leaf {
+        DTree sampling;
+        DTree building;
+    };
+
+    SDTree(const BoundingBox3f &bounds);
+
+    /// Return the leaf that contains \c p
+    Leaf &getLeaf(const Point3f &p);
+
+    /// Return the leaf that contains \c p
+    const Leaf &getLeaf(const Point3f &p) const {
+        return const_cast<SDTree *>(this)->getLeaf(p);
+    }
+
+    /**
+     * \brief Finish a training iteration
+     *
+     * Leaves that recorded more than \c spatialThreshold samples are split
+     * in half, the recorded trees become the sampling trees and refined
+     * empty trees are prepared for the next iteration (in parallel). The
+     * tree does not grow beyond \c maxMemory bytes.
+     */
+    void refine(float spatialThreshold, float directionalThreshold, size_t maxMemory);
+
+    /// Return the number of spatial leaves
+    size_t getLeafCount() const { return m_leaves.size(); }
+
+    /// Return the approximate memory usage in bytes
+    size_t getMemory() const;
+
+private:
+    struct Node {
+        uint32_t child;  ///< Index of the first child, 0 if this is a leaf
+        uint32_t leaf;   ///< Index of the leaf data
+        uint8_t axis;    ///< Split axis
+    };
+
+    BoundingBox3f m_bounds;
+    std::vector<Node> m_nodes;
+    std::vector<Leaf> m_leaves;
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_SDTREE_H */
@@ -31,39 +31,91 @@ NORI_NAMESPACE_BEGIN
  * \brief Intersection data structure
  *
  * This data structure records local information about a ray-triangle intersection.
- * This includes the position, traveled ray distance, uv coordinates, as well
- * as well as two local coordinate frames (one that corresponds to the true
- * geometry, and one that is used for shading computations).
+ * Ray traversal only stores the traveled ray distance, the hit primitive and
+ * its parameterization. The position, uv coordinates, as well as two local
+ * coordinate frames (one that corresponds to the true geometry, and one that
+ * is used for shading computations) are computed by the shape the first time
+ * they are accessed, and cached afterwards.
  */
 struct Intersection {
-    /// Position of the surface intersection
-    Point3f p;
+    /// Fields that are computed on demand
+    enum EField {
+        EPosition = 0x01,
+        EUV       = 0x02,
+        EGeoFrame = 0x04,
+        EShFrame  = 0x08
+    };
+
     /// Unoccluded distance along the ray
     float t;
-    /// UV coordinates, if any
-    Point2f uv;
-    /// Shading frame (based on the shading normal)
-    Frame shFrame;
-    /// Geometric frame (based on the true geometry)
-    Frame geoFrame;
     /// Pointer to the associated shape
     const Shape *mesh;
+    /// Index of the intersected primitive within \ref mesh
+    uint32_t primIndex;
+    /// Parameterization of the hit as returned by \ref Shape::rayIntersect() (barycentrics for triangles)
+    Point2f bary;
+    /// Origin of the intersected ray
+    Point3f rayOrigin;
+    /// Direction of the intersected ray
+    Vector3f rayDirection;
+
+    /// Create an empty intersection record (no hit at infinite distance, nothing computed yet)
+    Intersection() : t(std::numeric_limits<float>::infinity()), mesh(nullptr), primIndex(0), m_valid(0) { }
+
+    /// Position of the surface intersection
+    const Point3f &p() const { require(EPosition); return m_p; }
+
+    /// UV coordinates, if any
+    const Point2f &uv() const { require(EUV); return m_uv; }
 
-    /// Create an uninitialized intersection record
-    Intersection() : mesh(nullptr) { }
+    /// Geometric frame (based on the true geometry)
+    const Frame &geoFrame() const { require(EGeoFrame); return m_geoFrame; }
+
+    /// Shading frame (based on the shading normal)
+    const Frame &shFrame() const { require(EShFrame); return m_shFrame; }
 
     /// Transform a direction vector into the local shading frame
     Vector3f toLocal(const Vector3f &d) const {
-        return shFrame.toLocal(d);
+        return shFrame().toLocal(d);
     }
 
     /// Transform a direction vector from local to world coordinates
     Vector3f toWorld(const Vector3f &d) const {
-        return shFrame.toWorld(d);
+        return shFrame().toWorld(d);
     }
 
+    /// Start a new record for a hit on primitive \c index of \c shape (invalidates all cached fields)
+    void setHit(const Shape *shape, uint32_t index, const Point2f &param, const Ray3f &ray) {
+        mesh = shape;
+        primIndex = index;
+        bary = param;
+        rayOrigin = ray.o;
+        rayDirection = ray.d;
+        m_valid = 0;
+    }
+
+    /// \name Used by \ref Shape::setHitInformation() to provide the on-demand fields
+    /// @{
+    void setP(const Point3f &p) const { m_p = p; m_valid |= EPosition; }
+    void setUV(const Point2f &uv) const { m_uv = uv; m_valid |= EUV; }
+    void setGeoFrame(const Frame &frame) const { m_geoFrame = frame; m_valid |= EGeoFrame; }
+    void setShFrame(const Frame &frame) const { m_shFrame = frame; m_valid |= EShFrame; }
+    bool hasField(uint32_t field) const { return (m_valid & field) == field; }
+    /// @}
+
     /// Return a human-readable summary of the intersection record
     std::string toString() const;
+
+private:
+    /// Compute a field using the shape unless it is already cached
+    inline void require(uint32_t field) const;
+
+private:
+    mutable uint32_t m_valid;
+    mutable Point3f m_p;
+    mutable Point2f m_uv;
+    mutable Frame m_geoFrame;
+    mutable Frame m_shFrame;
 };
 
 /**
@@ -118,6 +170,23 @@ public:
     const BSDF *getBSDF() const { return m_bsdf; }
 
 
+    /// Return the surface area of the shape (zero if unknown)
+    virtual float getSurfaceArea() const { return 0.0f; }
+
+    /**
+     * \brief Return a cone that contains all surface normals of the shape
+     *
+     * \param axis
+     *    Receives the axis of the cone
+     * \param cosTheta
+     *    Receives the cosine of its half angle. The default implementation
+     *    returns -1, i.e. all directions.
+     */
+    virtual void getNormalCone(Vector3f &axis, float &cosTheta) const {
+        axis = Vector3f(0.0f, 0.0f, 1.0f);
+        cosTheta = -1.0f;
+    }
+
     /// Return the total number of primitives in this shape
     virtual uint32_t getPrimitiveCount() const { return 1; }
 
@@ -127,11 +196,27 @@ public:
     //// Return the centroid of the given triangle
     virtual Point3f getCentroid(uint32_t index) const = 0;
 
-    //// Ray-Shape intersection test
-    virtual bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const = 0;
+    /**
+     * \brief Ray-Shape intersection test
+     *
+     * Shapes that contain nested geometry (e.g. lazily loaded meshes) replace
+     * \c index by the index of the hit within that geometry, which becomes
+     * \ref Intersection::primIndex. All other shapes leave it unchanged.
+     */
+    virtual bool rayIntersect(uint32_t &index, const Ray3f &ray, float &u, float &v, float &t) const = 0;
 
-    /// Set the intersection information: hit point, shading frame, UVs, etc.
-    virtual void setHitInformation(uint32_t index, const Ray3f &ray, Intersection & its) const = 0;
+    /**
+     * \brief Compute on-demand intersection information: hit point,
+     * shading frame, UVs, etc.
+     *
+     * \param its
+     *    Intersection record describing a hit on this shape
+     * \param fields
+     *    Combination of \ref Intersection::EField flags that must be
+     *    provided using the record's setters. Implementations may provide
+     *    additional fields when they come at no extra cost.
+     */
+    virtual void setHitInformation(const Intersection &its, uint32_t fields) const = 0;
 
     /**
      * \brief Sample a point on the surface (potentially using the point sRec.ref to importance sample)
@@ -145,6 +230,16 @@ public:
      * */
     virtual float pdfSurface(const ShapeQueryRecord & sRec) const = 0;
 
+    /**
+     * \brief Identify geometry that is loaded on demand
+     *
+     * Shapes that read their geometry from a file only when it is needed
+     * return the file name, size, modification time and placement, so that
+     * caches derived from the scene notice changes without loading it. The
+     * default implementation returns an empty string.
+     */
+    virtual std::string getDeferredSource() const { return ""; }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
      * provided by this instance
@@ -160,6 +255,11 @@ protected:
 
 };
 
+inline void Intersection::require(uint32_t field) const {
+    if (!(m_valid & field))
+        mesh->setHitInformation(*this, field);
+}
+
 NORI_NAMESPACE_END
 
 #endif /* __NORI_SHAPE_H */
@@ -0,0 +1,80 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__NORI_SOBOL_H)
+#define __NORI_SOBOL_H
+
+#include <nori/sampler.h>
+#include <nori/lowdiscrepancy.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Owen-scrambled Sobol sampler
+ *
+ * Every call to \ref next1D() or \ref next2D() draws from its own padded
+ * 2D Sobol point set, so the pixel position, aperture, light and BSDF
+ * samples each get a well stratified pair of dimensions in the order in
+ * which they are requested. The point sets are decorrelated by shuffling
+ * the sample index and scrambling the coordinates with hash-based Owen
+ * scrambling seeded from (pixel, dimension, seed).
+ *
+ * Sample values only depend on the pixel, the sample index within the
+ * pixel, the dimension and the \c seed parameter, not on the order in
+ * which image blocks are rendered. Sample counts that are powers of two
+ * give the best stratification.
+ */
+class SobolSampler final : public PixelSampler {
+public:
+    SobolSampler(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_sampleOffset = (uint32_t) propList.getInteger("sampleOffset", 0);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+    }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<SobolSampler> cloned(new SobolSampler(*this));
+        return cloned;
+    }
+
+    void generate(const Point2i &pixel) {
+        PixelSampler::generate(pixel);
+        m_pixelSeed = LowDiscrepancy::hashPixel(pixel, m_seed);
+    }
+
+    float next1D() {
+        return next2D().x();
+    }
+
+    Point2f next2D() {
+        uint32_t seed = LowDiscrepancy::hashCombine(m_pixelSeed, m_dimension++);
+        return LowDiscrepancy::sobolOwen2D(m_sampleIndex, seed);
+    }
+
+    virtual std::string toString() const override {
+        return tfm::format("SobolSampler[sampleCount=%i, seed=%i]", m_sampleCount, m_seed);
+    }
+
+private:
+    uint32_t m_seed;
+    uint32_t m_pixelSeed = 0;
+};
+
+NORI_NAMESPACE_END
+
+#endif /* __NORI_SOBOL_H */
@@ -20,9 +20,40 @@
 #define __NORI_TEXTURE_H
 
 #include <nori/object.h>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Immutable 8 bit texel data loaded from an image file
+ *
+ * Buffers are obtained through \ref load(), which shares them between all
+ * textures referencing the same file (see \ref AssetCache).
+ */
+struct TexelBuffer {
+    int width = 0;                ///< Width in texels
+    int height = 0;               ///< Height in texels
+    int channels = 0;             ///< Number of channels per texel
+    std::vector<uint8_t> data;    ///< Texel data in scanline order
+    std::string source;           ///< Resolved file name, size and modification time
+
+    /// Return channel \c c of the texel at (x, y) as a value in [0, 1]
+    float get(int x, int y, int c) const {
+        return data[(x + width * y) * channels + c] * (1.0f / 255.0f);
+    }
+
+    /// Return the amount of memory used by the texel data
+    size_t getMemoryUsage() const { return data.size(); }
+
+    /**
+     * \brief Load an image with the requested number of channels
+     *
+     * The file name is resolved using the global file resolver. Throws
+     * a \ref NoriException when the image cannot be read.
+     */
+    static std::shared_ptr<const TexelBuffer> load(const std::string &filename, int channels);
+};
+
 /**
  * \brief Superclass of all texture
  */
@@ -55,6 +55,9 @@ public:
         m_distortion = propList.getVector2("distortion", Vector2f::Zero());
         m_chromaticStrength = propList.getVector3("chromaticAberation", Vector3f::Zero());
 
+        /* Trace all color channels for every sample (false: a single random one) */
+        m_allChannels = propList.getBoolean("allChannels", true);
+
         m_rfilter = NULL;
     }
     /**
@@ -231,6 +234,10 @@ public:
         return !m_chromaticStrength.isZero();
     }
 
+    bool tracesAllChannels() const override {
+        return m_allChannels;
+    }
+
     virtual void addChild(NoriObject *obj) override {
         switch (obj->getClassType()) {
             case EReconstructionFilter:
@@ -253,6 +260,7 @@ public:
             "  outputSize = %s,\n"
             "  fov = %f,\n"
             "  clip = [%f, %f],\n"
+            "  allChannels = %s,\n"
             "  rfilter = %s\n"
             "]",
             indent(m_cameraToWorld.toString(), 18),
@@ -260,6 +268,7 @@ public:
             m_fov,
             m_nearClip,
             m_farClip,
+            m_allChannels ? "true" : "false",
             indent(m_rfilter->toString())
         );
     }
@@ -276,6 +285,7 @@ protected:
     float m_focalDistance;
     Vector2f m_distortion;        //Parameters for barrel distortion (as in mitsuba)
     Vector3f m_chromaticStrength; //Strength of chromatic aberration along each color component
+    bool m_allChannels;           //Trace every color channel for every sample
 
 };
 
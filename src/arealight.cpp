@@ -19,6 +19,7 @@
 #include <nori/emitter.h>
 #include <nori/warp.h>
 #include <nori/shape.h>
+#include <nori/lightbvh.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -75,7 +76,10 @@ public:
         return 0.0f;
     }
 
-    virtual Color3f samplePhoton(Ray3f &ray, const Point2f &sample1, const Point2f &sample2) const override {
+    using Emitter::samplePhoton;
+
+    virtual Color3f samplePhoton(Ray3f &ray, Normal3f &n, float &pdfPos, float &pdfDir,
+                                 const Point2f &sample1, const Point2f &sample2) const override {
         
         // Sample the surface
         ShapeQueryRecord sRec(Point3f(0.0f));
@@ -85,14 +89,40 @@ public:
             return BLACK;
 
         // Throw a ray from the sampled point
-        Vector3f cosine_sample = Frame(sRec.n).toWorld(Warp::squareToCosineHemisphere(sample2));
+        Vector3f local = Warp::squareToCosineHemisphere(sample2);
+        Vector3f cosine_sample = Frame(sRec.n).toWorld(local);
         ray = Ray3f(sRec.p,cosine_sample); 
 
+        n = sRec.n;
+        pdfPos = sRec.pdf;
+        pdfDir = Warp::squareToCosineHemispherePdf(local);
+
         // Return the evaluated point
         EmitterQueryRecord eRec(sRec.p + cosine_sample, sRec.p, sRec.n);
         return eval(eRec) * M_PI / sRec.pdf;
     }
 
+    virtual void pdfPhoton(const Point3f &p, const Normal3f &n, const Vector3f &d,
+                           float &pdfPos, float &pdfDir) const override {
+        ShapeQueryRecord sRec(p, p);
+        pdfPos = m_shape->pdfSurface(sRec);
+        pdfDir = std::max(0.0f, n.dot(d)) * INV_PI;
+    }
+
+    virtual bool getLightBounds(LightBounds &bounds) const override {
+        float area = m_shape ? m_shape->getSurfaceArea() : 0.0f;
+        if (area <= 0.0f)
+            return false;
+
+        /* One-sided emission over the hemisphere around the surface normals */
+        Vector3f axis;
+        float cosTheta_o;
+        m_shape->getNormalCone(axis, cosTheta_o);
+        bounds = LightBounds(m_shape->getBoundingBox(), axis,
+                             M_PI * area * m_radiance.getLuminance(),
+                             cosTheta_o, 0.0f, false);
+        return true;
+    }
 
 protected:
     Color3f m_radiance;
@@ -0,0 +1,39 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/assetcache.h>
+
+NORI_NAMESPACE_BEGIN
+
+AssetCache &AssetCache::getInstance() {
+    static AssetCache instance;
+    return instance;
+}
+
+std::string AssetCache::toString() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return tfm::format(
+        "AssetCache[loaded = %i (%s), hits = %i, saved = %s]",
+        m_misses,
+        memString(m_totalMemory),
+        m_hits,
+        memString(m_savedMemory)
+    );
+}
+
+NORI_NAMESPACE_END
@@ -19,7 +19,7 @@ public:
         if (!scene->rayIntersect(ray, its))
             return WHITE;
 
-        Ray3f newRay = Ray3f(its.p, Warp::sampleUniformHemisphere(sampler, its.shFrame.n), Epsilon, ray_length);
+        Ray3f newRay = Ray3f(its.p(), Warp::sampleUniformHemisphere(sampler, its.shFrame().n), Epsilon, ray_length);
 
         return scene->rayIntersect(newRay) ? BLACK : WHITE;
     }
@@ -0,0 +1,462 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/block.h>
+#include <nori/bitmap.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Bidirectional path tracer
+ *
+ * For every camera sample, a camera subpath and a light subpath (started
+ * with \ref Emitter::samplePhoton()) are traced, and every prefix of the
+ * one is connected to every prefix of the other. The strategies are
+ * combined with the balance heuristic, computed incrementally from the
+ * forward and reverse area densities of the vertices as in "Robust Monte
+ * Carlo Methods for Light Transport Simulation" (Veach 1997) and PBRT-v3.
+ *
+ * Connections of light subpath vertices to the camera (light tracing)
+ * land on arbitrary pixels and are accumulated in a lock-free
+ * \ref SplatBuffer, which is added to the image when rendering finishes.
+ * This requires a camera that supports light tracing (the perspective
+ * camera). Light subpaths start at an emitter chosen uniformly, and the
+ * same choice is used for the emitter sampling strategy so that all
+ * densities are consistent.
+ */
+class BDPTIntegrator : public Integrator {
+public:
+    BDPTIntegrator(const PropertyList &props) {
+        /* Maximum number of bounces of a light path */
+        m_maxDepth = props.getInteger("maxDepth", 8);
+        if (m_maxDepth < 1 || m_maxDepth > MAX_DEPTH)
+            throw NoriException("BDPTIntegrator: maxDepth must be between 1 and %i", MAX_DEPTH);
+    }
+
+    void preprocess(const Scene *scene) override {
+        const Camera *camera = scene->getCamera();
+        if (!camera->supportsLightTracing())
+            throw NoriException("BDPTIntegrator: the camera does not support light tracing!");
+
+        /* Fail early if an emitter cannot emit photons */
+        for (const Emitter *light : scene->getLights()) {
+            Ray3f ray;
+            Normal3f n;
+            float pdfPos, pdfDir;
+            light->samplePhoton(ray, n, pdfPos, pdfDir, Point2f(0.5f), Point2f(0.5f));
+        }
+
+        m_splats.init(camera->getOutputSize());
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const override {
+        PathVertex cameraPath[MAX_DEPTH + 2], lightPath[MAX_DEPTH + 1];
+        int nCamera = generateCameraSubpath(scene, sampler, ray, cameraPath);
+        int nLight = generateLightSubpath(scene, sampler, lightPath);
+
+        Color3f L(0.0f);
+        for (int t = 1; t <= nCamera; ++t) {
+            for (int s = 0; s <= nLight; ++s) {
+                int depth = s + t - 2;
+                if ((s == 1 && t == 1) || depth < 0 || depth > m_maxDepth)
+                    continue;
+
+                Point2f pixel;
+                Color3f value = connect(scene, sampler, lightPath, cameraPath, s, t, pixel);
+                if (t == 1)
+                    m_splats.splat(pixel, value);
+                else
+                    L += value;
+            }
+        }
+        return L;
+    }
+
+    void addSplats(Bitmap &bitmap, uint32_t sampleCount) const override {
+        if (sampleCount > 0)
+            m_splats.addTo(bitmap, 1.0f / sampleCount);
+    }
+
+    std::string toString() const override {
+        return tfm::format("BDPTIntegrator[maxDepth = %i]", m_maxDepth);
+    }
+
+protected:
+    /// Upper bound of \c maxDepth, which sizes the subpath buffers on the stack
+    static const int MAX_DEPTH = 32;
+
+    enum EVertexType {
+        ECameraVertex,
+        ELightVertex,
+        ESurfaceVertex
+    };
+
+    /// Vertex of a camera or light subpath
+    struct PathVertex {
+        EVertexType type = ESurfaceVertex;
+        Point3f p;
+        Normal3f n = Normal3f(0.0f);        ///< Shading normal, zero for points (camera, point lights)
+        Intersection its;                   ///< Surface vertices only
+        Vector3f wi;                        ///< Direction towards the previous vertex
+        const Emitter *emitter = nullptr;   ///< Emitter at the vertex (if any)
+        Color3f beta = Color3f(0.0f);       ///< Throughput of the subpath up to the vertex
+        bool delta = false;                 ///< Was the next direction sampled from a delta BSDF?
+        float pdfFwd = 0.0f;                ///< Area density of the vertex along the subpath
+        float pdfRev = 0.0f;                ///< Area density when sampled from the other side
+
+        bool onSurface() const { return !n.isZero(); }
+
+        bool isDeltaLight() const {
+            return type == ELightVertex && emitter->isDeltaPosition();
+        }
+
+        /// Can the vertex be connected to another vertex?
+        bool isConnectible() const {
+            return type != ESurfaceVertex || !delta;
+        }
+    };
+
+    /// Trace a random walk from \c ray and append its vertices after \c path[0]
+    int randomWalk(const Scene *scene, Sampler *sampler, Ray3f ray, Color3f beta,
+                   float pdfFwd, int maxVertices, PathVertex *path) const {
+        int bounces = 0;
+        while (bounces < maxVertices) {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its))
+                break;
+
+            PathVertex &vertex = path[bounces + 1], &prev = path[bounces];
+            vertex = PathVertex();
+            vertex.type = ESurfaceVertex;
+            vertex.its = its;
+            vertex.p = its.p();
+            vertex.n = its.shFrame().n;
+            vertex.wi = -ray.d;
+            vertex.beta = beta;
+            vertex.emitter = its.mesh->isEmitter() ? its.mesh->getEmitter() : nullptr;
+            vertex.pdfFwd = convertDensity(prev, pdfFwd, vertex);
+            if (++bounces >= maxVertices)
+                break;
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            BSDFQueryRecord bRec(its.toLocal(-ray.d));
+            bRec.uv = its.uv();
+            Color3f weight = bsdf->sample(bRec, sampler->next2D());
+            if (weight.isZero())
+                break;
+
+            BSDFQueryRecord rev(bRec.wo, bRec.wi, bRec.measure);
+            rev.uv = bRec.uv;
+            pdfFwd = bsdf->pdf(bRec);
+            float pdfRev = bsdf->pdf(rev);
+            if (bRec.measure == EDiscrete) {
+                vertex.delta = true;
+                pdfFwd = pdfRev = 0.0f;
+            }
+
+            beta *= weight;
+            prev.pdfRev = convertDensity(vertex, pdfRev, prev);
+            ray = Ray3f(vertex.p, its.toWorld(bRec.wo));
+        }
+        return bounces;
+    }
+
+    int generateCameraSubpath(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                              PathVertex *path) const {
+        PathVertex &vertex = path[0];
+        vertex = PathVertex();
+        vertex.type = ECameraVertex;
+        vertex.p = ray.o;
+        vertex.beta = Color3f(1.0f);
+        vertex.pdfFwd = 1.0f;
+
+        float pdfDir = scene->getCamera()->pdfDirection(ray.d);
+        return randomWalk(scene, sampler, ray, Color3f(1.0f), pdfDir, m_maxDepth + 1, path) + 1;
+    }
+
+    int generateLightSubpath(const Scene *scene, Sampler *sampler, PathVertex *path) const {
+        const std::vector<Emitter *> &lights = scene->getLights();
+        if (lights.empty())
+            return 0;
+
+        float lightPdf;
+        const Emitter *light = chooseLight(scene, sampler->next1D(), lightPdf);
+        Point2f sample1 = sampler->next2D(), sample2 = sampler->next2D();
+
+        Ray3f ray;
+        Normal3f n;
+        float pdfPos, pdfDir;
+        Color3f power = light->samplePhoton(ray, n, pdfPos, pdfDir, sample1, sample2);
+        if (power.isZero() || pdfPos == 0.0f || pdfDir == 0.0f)
+            return 0;
+
+        PathVertex &vertex = path[0];
+        vertex = PathVertex();
+        vertex.type = ELightVertex;
+        vertex.p = ray.o;
+        vertex.n = light->isDeltaPosition() ? Normal3f(0.0f) : n;
+        vertex.emitter = light;
+        vertex.pdfFwd = lightPdf * pdfPos;
+
+        return randomWalk(scene, sampler, ray, power / lightPdf, pdfDir, m_maxDepth, path) + 1;
+    }
+
+    /// Choose an emitter uniformly
+    static const Emitter *chooseLight(const Scene *scene, float sample, float &pdf) {
+        const std::vector<Emitter *> &lights = scene->getLights();
+        size_t index = std::min((size_t) (sample * lights.size()), lights.size() - 1);
+        pdf = 1.0f / lights.size();
+        return lights[index];
+    }
+
+    /// Convert a solid angle density at \c from into an area density at \c to
+    static float convertDensity(const PathVertex &from, float pdf, const PathVertex &to) {
+        Vector3f w = to.p - from.p;
+        float dist2 = w.squaredNorm();
+        if (dist2 == 0.0f)
+            return 0.0f;
+        if (to.onSurface())
+            pdf *= std::abs(to.n.dot(w)) / std::sqrt(dist2);
+        return pdf / dist2;
+    }
+
+    /// Evaluate the BSDF at a surface vertex towards another vertex
+    static Color3f f(const PathVertex &v, const PathVertex &next) {
+        Vector3f wo = (next.p - v.p).normalized();
+        BSDFQueryRecord bRec(v.its.toLocal(v.wi), v.its.toLocal(wo), ESolidAngle);
+        bRec.uv = v.its.uv();
+        return v.its.mesh->getBSDF()->eval(bRec);
+    }
+
+    /// Radiance emitted by a vertex on an emitter towards another vertex
+    static Color3f Le(const PathVertex &v, const PathVertex &to) {
+        if (!v.emitter)
+            return Color3f(0.0f);
+        return v.emitter->eval(EmitterQueryRecord(to.p, v.p, v.n));
+    }
+
+    /// Area density of sampling \c to from an emitter vertex
+    static float pdfLight(const PathVertex &v, const PathVertex &to) {
+        Vector3f w = to.p - v.p;
+        float dist2 = w.squaredNorm();
+        if (dist2 == 0.0f)
+            return 0.0f;
+        w /= std::sqrt(dist2);
+
+        float pdfPos, pdfDir;
+        v.emitter->pdfPhoton(v.p, v.n, w, pdfPos, pdfDir);
+        float pdf = pdfDir / dist2;
+        if (to.onSurface())
+            pdf *= std::abs(to.n.dot(w));
+        return pdf;
+    }
+
+    /// Area density of starting a light subpath at an emitter vertex
+    static float pdfLightOrigin(const Scene *scene, const PathVertex &v, const PathVertex &to) {
+        Vector3f w = (to.p - v.p).normalized();
+        float pdfPos, pdfDir;
+        v.emitter->pdfPhoton(v.p, v.n, w, pdfPos, pdfDir);
+        return pdfPos / scene->getLights().size();
+    }
+
+    /// Area density of sampling \c next from \c v, which was reached from \c prev
+    static float pdf(const Scene *scene, const PathVertex &v, const PathVertex *prev,
+                     const PathVertex &next) {
+        if (v.type == ELightVertex)
+            return pdfLight(v, next);
+
+        Vector3f wn = next.p - v.p;
+        if (wn.squaredNorm() == 0.0f)
+            return 0.0f;
+        wn.normalize();
+
+        float pdf;
+        if (v.type == ECameraVertex) {
+            pdf = scene->getCamera()->pdfDirection(wn);
+        } else {
+            Vector3f wp = (prev->p - v.p).normalized();
+            BSDFQueryRecord bRec(v.its.toLocal(wp), v.its.toLocal(wn), ESolidAngle);
+            bRec.uv = v.its.uv();
+            pdf = v.its.mesh->getBSDF()->pdf(bRec);
+        }
+        return convertDensity(v, pdf, next);
+    }
+
+    /// Is the segment between two vertices unoccluded?
+    static bool visible(const Scene *scene, const Point3f &a, const Point3f &b) {
+        Vector3f d = b - a;
+        float dist = d.norm();
+        return !scene->rayIntersect(Ray3f(a, d / dist, Epsilon, dist - Epsilon));
+    }
+
+    /**
+     * \brief Connect the first \c s vertices of the light subpath to the
+     * first \c t vertices of the camera subpath
+     *
+     * \return The MIS-weighted contribution of the path
+     */
+    Color3f connect(const Scene *scene, Sampler *sampler, PathVertex *lightPath,
+                    PathVertex *cameraPath, int s, int t, Point2f &pixel) const {
+        Color3f L(0.0f);
+        PathVertex sampled;
+
+        if (s == 0) {
+            /* The camera subpath hit an emitter */
+            const PathVertex &pt = cameraPath[t - 1];
+            L = pt.beta * Le(pt, cameraPath[t - 2]);
+        } else if (t == 1) {
+            /* Connect a light subpath vertex to the camera */
+            const PathVertex &qs = lightPath[s - 1];
+            if (qs.type != ESurfaceVertex || !qs.isConnectible())
+                return L;
+
+            Point3f position;
+            float importance = scene->getCamera()->sampleImportance(qs.p, position, pixel);
+            if (importance <= 0.0f)
+                return L;
+
+            sampled.type = ECameraVertex;
+            sampled.p = position;
+            sampled.beta = Color3f(importance);
+
+            Vector3f w = position - qs.p;
+            float dist2 = w.squaredNorm();
+            float cosTheta = std::abs(qs.n.dot(w)) / std::sqrt(dist2);
+            L = qs.beta * f(qs, sampled) * importance * cosTheta / dist2;
+            if (!L.isZero() && !visible(scene, qs.p, position))
+                L = Color3f(0.0f);
+        } else if (s == 1) {
+            /* Sample a point on an emitter for the camera subpath vertex */
+            const PathVertex &pt = cameraPath[t - 1];
+            if (!pt.isConnectible())
+                return L;
+
+            float lightPdf;
+            const Emitter *light = chooseLight(scene, sampler->next1D(), lightPdf);
+            EmitterQueryRecord eRec(pt.p);
+            Color3f value = light->sample(eRec, sampler->next2D());
+            if (value.isZero())
+                return L;
+
+            sampled.type = ELightVertex;
+            sampled.p = eRec.p;
+            sampled.n = light->isDeltaPosition() ? Normal3f(0.0f) : eRec.n;
+            sampled.emitter = light;
+            sampled.pdfFwd = pdfLightOrigin(scene, sampled, pt);
+
+            /* The emitter returns Le * cos / (dist^2 * pdf) */
+            float cosTheta = std::abs(pt.n.dot(eRec.wi));
+            L = pt.beta * f(pt, sampled) * value * cosTheta / lightPdf;
+            if (!L.isZero() && scene->rayIntersect(eRec.shadowRay))
+                L = Color3f(0.0f);
+        } else {
+            /* Connect two subpath vertices */
+            const PathVertex &qs = lightPath[s - 1], &pt = cameraPath[t - 1];
+            if (!qs.isConnectible() || !pt.isConnectible())
+                return L;
+
+            Vector3f w = pt.p - qs.p;
+            float dist2 = w.squaredNorm();
+            if (dist2 == 0.0f)
+                return L;
+            w /= std::sqrt(dist2);
+            float G = std::abs(qs.n.dot(w)) * std::abs(pt.n.dot(w)) / dist2;
+            L = qs.beta * f(qs, pt) * f(pt, qs) * pt.beta * G;
+            if (!L.isZero() && !visible(scene, qs.p, pt.p))
+                L = Color3f(0.0f);
+        }
+
+        if (L.isZero() || !L.isValid())
+            return Color3f(0.0f);
+        return L * misWeight(scene, lightPath, cameraPath, sampled, s, t);
+    }
+
+    /// Balance heuristic weight of the strategy with \c s light and \c t camera vertices
+    static float misWeight(const Scene *scene, PathVertex *lightPath,
+                           PathVertex *cameraPath, const PathVertex &sampled,
+                           int s, int t) {
+        if (s + t == 2)
+            return 1.0f;
+
+        auto remap0 = [](float f) { return f != 0.0f ? f : 1.0f; };
+
+        /* Temporarily update the vertices for this strategy */
+        std::pair<PathVertex *, PathVertex> saved[4];
+        int savedCount = 0;
+        auto save = [&](PathVertex *v) { if (v) saved[savedCount++] = std::make_pair(v, *v); };
+
+        PathVertex *qs = s > 0 ? &lightPath[s - 1] : nullptr;
+        PathVertex *pt = t > 0 ? &cameraPath[t - 1] : nullptr;
+        PathVertex *qsMinus = s > 1 ? &lightPath[s - 2] : nullptr;
+        PathVertex *ptMinus = t > 1 ? &cameraPath[t - 2] : nullptr;
+        save(qs); save(pt); save(qsMinus); save(ptMinus);
+
+        if (s == 1)
+            *qs = sampled;
+        else if (t == 1)
+            *pt = sampled;
+
+        pt->delta = false;
+        if (qs)
+            qs->delta = false;
+
+        pt->pdfRev = s > 0 ? pdf(scene, *qs, qsMinus, *pt) : pdfLightOrigin(scene, *pt, *ptMinus);
+        if (ptMinus)
+            ptMinus->pdfRev = s > 0 ? pdf(scene, *pt, qs, *ptMinus) : pdfLight(*pt, *ptMinus);
+        if (qs)
+            qs->pdfRev = pdf(scene, *pt, ptMinus, *qs);
+        if (qsMinus)
+            qsMinus->pdfRev = pdf(scene, *qs, pt, *qsMinus);
+
+        /* Ratios of the densities of the other strategies to this one */
+        float sumRi = 0.0f, ri = 1.0f;
+        for (int i = t - 1; i > 0; --i) {
+            ri *= remap0(cameraPath[i].pdfRev) / remap0(cameraPath[i].pdfFwd);
+            if (!cameraPath[i].delta && !cameraPath[i - 1].delta)
+                sumRi += ri;
+        }
+
+        ri = 1.0f;
+        for (int i = s - 1; i >= 0; --i) {
+            ri *= remap0(lightPath[i].pdfRev) / remap0(lightPath[i].pdfFwd);
+            bool deltaLight = i > 0 ? lightPath[i - 1].delta : lightPath[0].isDeltaLight();
+            if (!lightPath[i].delta && !deltaLight)
+                sumRi += ri;
+        }
+
+        for (int i = savedCount - 1; i >= 0; --i)
+            *saved[i].first = saved[i].second;
+
+        return 1.0f / (1.0f + sumRi);
+    }
+
+private:
+    int m_maxDepth;
+    mutable SplatBuffer m_splats;
+};
+
+const int BDPTIntegrator::MAX_DEPTH;
+
+NORI_REGISTER_CLASS(BDPTIntegrator, "bdpt");
+NORI_NAMESPACE_END
@@ -137,6 +137,37 @@ std::string ImageBlock::toString() const {
         m_offset.toString(), m_size.toString());
 }
 
+void SplatBuffer::init(const Vector2i &size) {
+    m_size = size;
+    m_data.assign((size_t) size.x() * size.y() * 3, AtomicFloat());
+}
+
+void SplatBuffer::clear() {
+    std::fill(m_data.begin(), m_data.end(), AtomicFloat());
+}
+
+void SplatBuffer::splat(const Point2f &pos, const Color3f &value) {
+    int x = (int) std::floor(pos.x()), y = (int) std::floor(pos.y());
+    if (x < 0 || y < 0 || x >= m_size.x() || y >= m_size.y() || !value.isValid())
+        return;
+    size_t index = ((size_t) y * m_size.x() + x) * 3;
+    for (int c = 0; c < 3; ++c) {
+        if (value[c] != 0.0f)
+            m_data[index + c].add(value[c]);
+    }
+}
+
+Color3f SplatBuffer::get(int x, int y) const {
+    size_t index = ((size_t) y * m_size.x() + x) * 3;
+    return Color3f(m_data[index].get(), m_data[index + 1].get(), m_data[index + 2].get());
+}
+
+void SplatBuffer::addTo(Bitmap &bitmap, float scale) const {
+    for (int y = 0; y < m_size.y(); ++y)
+        for (int x = 0; x < m_size.x(); ++x)
+            bitmap.coeffRef(y, x) += get(x, y) * scale;
+}
+
 BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
         : m_size(size), m_blockSize(blockSize) {
     m_numBlocks = Vector2i(
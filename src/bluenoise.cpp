@@ -0,0 +1,107 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <nori/lowdiscrepancy.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Sampler that distributes the per-pixel error as blue noise
+ *
+ * Implements the z-order ranking approach of "Screen-Space Blue-Noise
+ * Diffusion of Monte Carlo Sampling Error via Hierarchical Ordering of
+ * Pixels" by Ahmed and Wonka (SIGGRAPH Asia 2020). Instead of giving each
+ * pixel an independently scrambled sequence, all pixels share a single
+ * Owen-scrambled Sobol sequence per dimension: pixel \c i along a randomly
+ * permuted Morton curve receives the consecutive chunk of sample indices
+ * <tt>[i * sampleCount, (i+1) * sampleCount)</tt>. Pixels that are close on
+ * the screen thus receive jointly stratified samples, which turns the error
+ * into high-frequency noise that is easier on the eye and on denoisers.
+ *
+ * Works best with power-of-two sample counts. The sampler only changes the
+ * sample values, so the variance output used by the NL-means denoiser in
+ * <tt>denoiser/</tt> remains a per-pixel estimate as before.
+ */
+class BlueNoiseSampler : public PixelSampler {
+public:
+    BlueNoiseSampler(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_sampleOffset = (uint32_t) propList.getInteger("sampleOffset", 0);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+    }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<BlueNoiseSampler> cloned(new BlueNoiseSampler(*this));
+        return cloned;
+    }
+
+    void generate(const Point2i &pixel) {
+        PixelSampler::generate(pixel);
+        m_pixelRank = rank(pixel);
+    }
+
+    float next1D() {
+        return next2D().x();
+    }
+
+    Point2f next2D() {
+        uint32_t seed = LowDiscrepancy::hashCombine(m_seed, m_dimension++);
+        uint32_t index = m_pixelRank * (uint32_t) m_sampleCount + m_sampleIndex;
+        return LowDiscrepancy::sobolOwen2D(index, seed);
+    }
+
+    virtual std::string toString() const override {
+        return tfm::format("BlueNoiseSampler[sampleCount=%i, seed=%i]", m_sampleCount, m_seed);
+    }
+
+private:
+    /**
+     * \brief Compute the position of a pixel along a randomized Morton curve
+     *
+     * The base-4 digits of the Morton code are permuted level by level,
+     * where the permutation at each level is selected by hashing the
+     * digits above it. This keeps every quad-tree cell contiguous while
+     * avoiding the structured artifacts of a fixed Z-order.
+     */
+    uint32_t rank(const Point2i &pixel) const {
+        static const uint8_t permutations[24][4] = {
+            {0,1,2,3}, {0,1,3,2}, {0,2,1,3}, {0,2,3,1}, {0,3,1,2}, {0,3,2,1},
+            {1,0,2,3}, {1,0,3,2}, {1,2,0,3}, {1,2,3,0}, {1,3,0,2}, {1,3,2,0},
+            {2,0,1,3}, {2,0,3,1}, {2,1,0,3}, {2,1,3,0}, {2,3,0,1}, {2,3,1,0},
+            {3,0,1,2}, {3,0,2,1}, {3,1,0,2}, {3,1,2,0}, {3,2,0,1}, {3,2,1,0}
+        };
+
+        uint32_t code = LowDiscrepancy::morton2D((uint32_t) pixel.x(), (uint32_t) pixel.y());
+        uint32_t result = 0, prefix = LowDiscrepancy::mix(m_seed);
+        for (int level = 15; level >= 0; --level) {
+            uint32_t digit = (code >> (2 * level)) & 3;
+            uint32_t perm = LowDiscrepancy::mix(prefix) % 24;
+            result |= (uint32_t) permutations[perm][digit] << (2 * level);
+            prefix = LowDiscrepancy::hashCombine(prefix, digit);
+        }
+        return result;
+    }
+
+private:
+    uint32_t m_seed;
+    uint32_t m_pixelRank = 0;
+};
+
+NORI_REGISTER_CLASS(BlueNoiseSampler, "bluenoise");
+NORI_NAMESPACE_END
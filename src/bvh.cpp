@@ -326,7 +326,7 @@ void BVH::clear() {
     m_indices.shrink_to_fit();
 }
 
-void BVH::build() {
+void BVH::build(bool parallel) {
     uint32_t size  = getPrimitiveCount();
     if (size == 0)
         return;
@@ -349,9 +349,13 @@ void BVH::build() {
         m_indices[i] = i;
 
     uint32_t *indices = m_indices.data(), *temp = new uint32_t[size];
-    BVHBuildTask& task = *new(tbb::task::allocate_root())
-        BVHBuildTask(*this, 0u, indices, indices + size , temp);
-    tbb::task::spawn_root_and_wait(task);
+    if (parallel) {
+        BVHBuildTask& task = *new(tbb::task::allocate_root())
+            BVHBuildTask(*this, 0u, indices, indices + size , temp);
+        tbb::task::spawn_root_and_wait(task);
+    } else {
+        BVHBuildTask::execute_serially(*this, 0u, indices, indices + size, temp);
+    }
     delete[] temp;
     std::pair<float, uint32_t> stats = statistics();
 
@@ -416,6 +420,8 @@ bool BVH::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) con
 
     bool foundIntersection = false;
     uint32_t f = 0;
+    Point2f uv;
+    const Shape *hitShape = nullptr;
 
     while (true) {
         const BVHNode &node = m_nodes[node_idx];
@@ -442,8 +448,8 @@ bool BVH::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) con
                         return true;
                     foundIntersection = true;
                     ray.maxt = its.t = t;
-                    its.uv = Point2f(u, v);
-                    its.mesh = shape;
+                    uv = Point2f(u, v);
+                    hitShape = shape;
                     f = idx;
                 }
             }
@@ -454,11 +460,194 @@ bool BVH::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) con
         }
     }
 
-    if (foundIntersection) {
-        its.mesh->setHitInformation(f,ray,its);
-    }
+    /* Detailed hit information is computed lazily by the shape */
+    if (foundIntersection)
+        its.setHit(hitShape, f, uv, ray);
 
     return foundIntersection;
 }
 
+uint32_t BVH::rayIntersectPacket(const Ray3f *rays, Intersection *its,
+        uint32_t count, bool shadowRay) const {
+    assert(count <= PacketSize);
+    if (m_nodes.empty() || count == 0)
+        return 0;
+
+    /* Interval culling requires that all directions lie in the same octant */
+    bool coherent = true;
+    for (uint32_t i = 0; i < count && coherent; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            if (rays[i].d[k] == 0 || std::signbit(rays[i].d[k]) != std::signbit(rays[0].d[k])) {
+                coherent = false;
+                break;
+            }
+        }
+    }
+
+    if (!coherent) {
+        /* Scalar fallback for divergent packets */
+        uint32_t hitMask = 0;
+        Intersection unused;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (rayIntersect(rays[i], its ? its[i] : unused, shadowRay))
+                hitMask |= 1u << i;
+        }
+        return hitMask;
+    }
+
+    Ray3f ray[PacketSize];
+    float t[PacketSize];
+    Point2f uv[PacketSize];
+    uint32_t f[PacketSize];
+    const Shape *hitShape[PacketSize];
+
+    /* Bounds of the origins and reciprocal directions of the packet */
+    Point3f oMin(std::numeric_limits<float>::infinity());
+    Point3f oMax(-std::numeric_limits<float>::infinity());
+    Vector3f rcpMin(std::numeric_limits<float>::infinity());
+    Vector3f rcpMax(-std::numeric_limits<float>::infinity());
+    float minT = std::numeric_limits<float>::infinity();
+
+    uint32_t active = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        /* Use an adaptive ray epsilon */
+        ray[i] = rays[i];
+        if (ray[i].mint == Epsilon)
+            ray[i].mint = std::max(ray[i].mint, ray[i].mint * ray[i].o.array().abs().maxCoeff());
+        t[i] = std::numeric_limits<float>::infinity();
+        hitShape[i] = nullptr;
+        if (its)
+            its[i].t = t[i];
+        if (ray[i].maxt < ray[i].mint)
+            continue;
+
+        active |= 1u << i;
+        oMin = oMin.cwiseMin(ray[i].o);
+        oMax = oMax.cwiseMax(ray[i].o);
+        rcpMin = rcpMin.cwiseMin(ray[i].dRcp);
+        rcpMax = rcpMax.cwiseMax(ray[i].dRcp);
+        minT = std::min(minT, ray[i].mint);
+    }
+
+    auto maxT = [&](uint32_t mask) {
+        float result = -std::numeric_limits<float>::infinity();
+        for (uint32_t i = 0; i < count; ++i) {
+            if (mask & (1u << i))
+                result = std::max(result, ray[i].maxt);
+        }
+        return result;
+    };
+
+    /* Conservative slab test for all rays of the packet at once */
+    auto intervalCull = [&](const BoundingBox3f &bbox, float packetMaxT) {
+        float nearT = minT, farT = packetMaxT;
+        for (int k = 0; k < 3; ++k) {
+            /* Interval product [a, b] * [c, d] */
+            auto lower = [&](float a, float b) {
+                return std::min(std::min(a * rcpMin[k], a * rcpMax[k]),
+                                std::min(b * rcpMin[k], b * rcpMax[k]));
+            };
+            auto upper = [&](float a, float b) {
+                return std::max(std::max(a * rcpMin[k], a * rcpMax[k]),
+                                std::max(b * rcpMin[k], b * rcpMax[k]));
+            };
+            float nearA = bbox.min[k] - oMax[k], nearB = bbox.min[k] - oMin[k];
+            float farA = bbox.max[k] - oMax[k], farB = bbox.max[k] - oMin[k];
+            if (rcpMin[k] < 0) {
+                std::swap(nearA, farA);
+                std::swap(nearB, farB);
+            }
+            nearT = std::max(nearT, lower(nearA, nearB));
+            farT = std::min(farT, upper(farA, farB));
+        }
+        return nearT > farT;
+    };
+
+    uint32_t hitMask = 0;
+    uint32_t node_idx = 0, stack_idx = 0;
+    uint32_t stack[64], stackMask[64];
+    uint32_t mask = active;
+    float packetMaxT = maxT(active);
+
+    while (true) {
+        const BVHNode &node = m_nodes[node_idx];
+
+        /* Cull the node for the entire packet, then for the individual rays */
+        mask &= active;
+        if (mask && !intervalCull(node.bbox, packetMaxT)) {
+            uint32_t nodeMask = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                if ((mask & (1u << i)) && node.bbox.rayIntersect(ray[i]))
+                    nodeMask |= 1u << i;
+            }
+            mask = nodeMask;
+        } else {
+            mask = 0;
+        }
+
+        if (mask && node.isInner()) {
+            /* Visit the near child first. All rays point into the same
+               octant, and the left child holds the primitives with the
+               smaller centroids along the split axis. */
+            uint32_t nearChild = node_idx + 1, farChild = node.inner.rightChild;
+            if (rcpMin[node.inner.axis] < 0)
+                std::swap(nearChild, farChild);
+            stackMask[stack_idx] = mask;
+            stack[stack_idx++] = farChild;
+            node_idx = nearChild;
+            assert(stack_idx<64);
+            continue;
+        }
+
+        if (mask) {
+            for (uint32_t j = node.start(), end = node.end(); j < end && mask; ++j) {
+                uint32_t idx = m_indices[j];
+                const Shape *shape = m_shapes[findShape(idx)];
+
+                for (uint32_t i = 0; i < count; ++i) {
+                    if (!(mask & (1u << i)))
+                        continue;
+
+                    float u, v, tHit;
+                    uint32_t hitIdx = idx;
+                    if (shape->rayIntersect(hitIdx, ray[i], u, v, tHit)) {
+                        hitMask |= 1u << i;
+                        if (shadowRay) {
+                            /* Occluded rays are done */
+                            active &= ~(1u << i);
+                            mask &= ~(1u << i);
+                            continue;
+                        }
+                        ray[i].maxt = t[i] = tHit;
+                        uv[i] = Point2f(u, v);
+                        hitShape[i] = shape;
+                        f[i] = hitIdx;
+                    }
+                }
+            }
+            if (!active)
+                break;
+            packetMaxT = maxT(active);
+        }
+
+        if (stack_idx == 0)
+            break;
+        --stack_idx;
+        node_idx = stack[stack_idx];
+        mask = stackMask[stack_idx];
+    }
+
+    /* Detailed hit information is computed lazily by the shape */
+    if (!shadowRay && its) {
+        for (uint32_t i = 0; i < count; ++i) {
+            if (hitMask & (1u << i)) {
+                its[i].t = t[i];
+                its[i].setHit(hitShape[i], f[i], uv[i], ray[i]);
+            }
+        }
+    }
+
+    return hitMask;
+}
+
 NORI_NAMESPACE_END
@@ -28,6 +28,9 @@
 
 #if defined(PLATFORM_WINDOWS)
 #include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
 #endif
 
 #if defined(PLATFORM_MACOS)
@@ -184,6 +187,24 @@ std::string memString(size_t size, bool precise) {
     return os.str();
 }
 
+size_t getPeakMemoryUsage() {
+#if defined(PLATFORM_WINDOWS)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return (size_t) counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(PLATFORM_MACOS)
+    return (size_t) usage.ru_maxrss;          /* bytes */
+#else
+    return (size_t) usage.ru_maxrss * 1024;   /* kilobytes */
+#endif
+#endif
+}
+
 filesystem::resolver *getFileResolver() {
     static filesystem::resolver *resolver = new filesystem::resolver();
     return resolver;
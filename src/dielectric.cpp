@@ -72,6 +72,10 @@ public:
         return 1.0f;
     }
 
+    virtual bool isDelta() const override {
+        return true;
+    }
+
     virtual std::string toString() const override {
         return tfm::format(
             "Dielectric[\n"
@@ -31,17 +31,17 @@ public:
         {
 
             EmitterQueryRecord rec;
-            rec.ref = its.p;
+            rec.ref = its.p();
             Color3f tracedColor = light->sample(rec, sample);
 
             // Intersection ==> Occlusion ==> Light directly not visible
             if (!scene->rayIntersect(rec.shadowRay))
             {
-                Vector3f wi = its.shFrame.toLocal(rec.wi);
-                Vector3f d = its.shFrame.toLocal(-ray.d);
+                Vector3f wi = its.shFrame().toLocal(rec.wi);
+                Vector3f d = its.shFrame().toLocal(-ray.d);
 
                 BSDFQueryRecord bRec(wi, d, ESolidAngle);
-                bRec.uv = its.uv;
+                bRec.uv = its.uv();
                 
                 color += its.mesh->getBSDF()->eval(bRec) * Frame::cosTheta(wi) * tracedColor;
             }
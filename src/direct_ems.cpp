@@ -25,7 +25,7 @@ public:
 
         // If the material is an Emitter ==> Add the emmission part to the result
         if(its.mesh->isEmitter()) {
-            EmitterQueryRecord rec(ray.o, its.p, its.shFrame.n);
+            EmitterQueryRecord rec(ray.o, its.p(), its.shFrame().n);
             color += its.mesh->getEmitter()->eval(rec);
         }
 
@@ -34,17 +34,17 @@ public:
         for (Emitter *light : lights)
         {
             EmitterQueryRecord rec;
-            rec.ref = its.p;
+            rec.ref = its.p();
             Color3f tracedColor = light->sample(rec, sampler->next2D());
 
             // Intersection ==> Occlusion ==> Light directly not visible
             if (!scene->rayIntersect(rec.shadowRay))
             {
-                Vector3f wi = its.shFrame.toLocal(rec.wi);
-                Vector3f d = its.shFrame.toLocal(-ray.d);
+                Vector3f wi = its.shFrame().toLocal(rec.wi);
+                Vector3f d = its.shFrame().toLocal(-ray.d);
 
                 BSDFQueryRecord bRec(d, wi, ESolidAngle);
-                bRec.uv = its.uv;
+                bRec.uv = its.uv();
 
                 color += its.mesh->getBSDF()->eval(bRec) * Frame::cosTheta(wi) * tracedColor;
             }
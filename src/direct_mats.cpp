@@ -25,20 +25,20 @@ public:
 
         // We add the Le part to the record if the mesh is an emitter
         if(its.mesh->isEmitter()) {
-            EmitterQueryRecord rec(ray.o, its.p, its.shFrame.n);
+            EmitterQueryRecord rec(ray.o, its.p(), its.shFrame().n);
             color += its.mesh->getEmitter()->eval(rec);
         }
 
         // Step 1) Sample the BSDF
-        BSDFQueryRecord bRec(its.shFrame.toLocal(-ray.d));
-        bRec.uv = its.uv;
+        BSDFQueryRecord bRec(its.shFrame().toLocal(-ray.d));
+        bRec.uv = its.uv();
         Color3f brdf = its.mesh->getBSDF()->sample(bRec,sampler->next2D());
 
         // Step 2) Check if we hit a Emitter 
-        Ray3f newRay = Ray3f(its.p,its.shFrame.toWorld(bRec.wo));
+        Ray3f newRay = Ray3f(its.p(),its.shFrame().toWorld(bRec.wo));
         Intersection newIntersection;
         if(scene->rayIntersect(newRay,newIntersection) && newIntersection.mesh->isEmitter()) {
-            EmitterQueryRecord eRec(its.p,newIntersection.p,newIntersection.shFrame.n);
+            EmitterQueryRecord eRec(its.p(),newIntersection.p(),newIntersection.shFrame().n);
             color += brdf * newIntersection.mesh->getEmitter()->eval(eRec);
         }
 
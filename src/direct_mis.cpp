@@ -2,6 +2,7 @@
 #include <nori/scene.h>
 #include <nori/warp.h>
 #include <nori/bsdf.h>
+#include <nori/ris.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -10,7 +11,12 @@ class DirectMisIntegrator : public Integrator
 public:
     DirectMisIntegrator(const PropertyList &props)
     {
-        // This integrator contains no properties
+        // Sample every emitter instead of one chosen from the light hierarchy
+        m_allLights = props.getBoolean("allLights", false);
+        // Number of light samples that are resampled for each shadow ray
+        m_lightCandidates = props.getInteger("lightCandidates", 1);
+        if (m_lightCandidates < 1)
+            throw NoriException("DirectMisIntegrator: lightCandidates must be at least 1");
     }
 
     /// Compute the radiance value for a given ray. Just return green here
@@ -26,56 +32,69 @@ public:
         // If the material is an Emitter ==> Add the emmission part to the result
         if (its.mesh->isEmitter())
         {
-            EmitterQueryRecord rec(ray.o, its.p, its.shFrame.n);
+            EmitterQueryRecord rec(ray.o, its.p(), its.shFrame().n);
             color += its.mesh->getEmitter()->eval(rec);
         }
 
         // Add the direct integrator part
-        auto lights = scene->getLights();
-        for (Emitter *light : lights)
+        if (m_allLights)
         {
-            EmitterQueryRecord rec(its.p);
-            Color3f tracedColor = light->sample(rec, sampler->next2D());
-
-            float pdf_em = light->pdf(rec);
-            
-            // Intersection ==> Occlusion ==> Light directly not visible
-            if (!scene->rayIntersect(rec.shadowRay))
+            for (const Emitter *light : scene->getLights())
             {
-                Vector3f wi = its.shFrame.toLocal(rec.wi);
-                Vector3f d = its.shFrame.toLocal(-ray.d);
+                EmitterQueryRecord rec(its.p());
+                Color3f tracedColor = light->sample(rec, sampler->next2D());
+
+                float pdf_em = light->pdf(rec);
+
+                // Intersection ==> Occlusion ==> Light directly not visible
+                if (!scene->rayIntersect(rec.shadowRay))
+                {
+                    Vector3f wi = its.shFrame().toLocal(rec.wi);
+                    Vector3f d = its.shFrame().toLocal(-ray.d);
 
-                float cosTheta = Frame::cosTheta(wi);
+                    float cosTheta = Frame::cosTheta(wi);
 
-                BSDFQueryRecord bRec(d, wi, ESolidAngle);
-                bRec.uv = its.uv;
+                    BSDFQueryRecord bRec(d, wi, ESolidAngle);
+                    bRec.uv = its.uv();
 
-                Color3f new_color = its.mesh->getBSDF()->eval(bRec);
+                    Color3f new_color = its.mesh->getBSDF()->eval(bRec);
 
-                float pdf_mat = its.mesh->getBSDF()->pdf(bRec);
+                    float pdf_mat = its.mesh->getBSDF()->pdf(bRec);
 
-                float w_em = pdf_mat + pdf_em > 0.f ? pdf_em / (pdf_mat + pdf_em) : pdf_em;
+                    // BSDF sampling cannot hit lights located at a single point
+                    float w_em = light->isDeltaPosition() ? 1.0f :
+                        pdf_mat + pdf_em > 0.f ? pdf_em / (pdf_mat + pdf_em) : pdf_em;
 
-                color += w_em * new_color * tracedColor * cosTheta;
+                    color += w_em * new_color * tracedColor * cosTheta;
+                }
             }
         }
+        else
+        {
+            // Resample light candidates chosen from the light hierarchy and
+            // trace a single shadow ray
+            color += sampleDirectLight(scene, its, its.shFrame().toLocal(-ray.d), sampler, m_lightCandidates);
+        }
 
         // Step 1) Sample the BSDF
-        BSDFQueryRecord bRec(its.shFrame.toLocal(-ray.d));
-        bRec.uv = its.uv;
+        BSDFQueryRecord bRec(its.shFrame().toLocal(-ray.d));
+        bRec.uv = its.uv();
         Color3f sensibility = its.mesh->getBSDF()->sample(bRec,sampler->next2D());
         float pdf_mat = its.mesh->getBSDF()->pdf(bRec);
 
         // Step 2) Check if we hit a Emitter
-        Ray3f newRay = Ray3f(its.p,its.shFrame.toWorld(bRec.wo));
+        Ray3f newRay = Ray3f(its.p(),its.shFrame().toWorld(bRec.wo));
         Intersection newIntersection;
         
         if(scene->rayIntersect(newRay,newIntersection)) {
             if(newIntersection.mesh->isEmitter()) {
-                EmitterQueryRecord eRec(its.p,newIntersection.p,newIntersection.shFrame.n);
+                EmitterQueryRecord eRec(its.p(),newIntersection.p(),newIntersection.shFrame().n);
                 Color3f emmitedColor = newIntersection.mesh->getEmitter()->eval(eRec);
 
-                float pdf_em = newIntersection.mesh->getEmitter()->pdf(eRec);
+                const Emitter *emitter = newIntersection.mesh->getEmitter();
+                float pdf_em = emitter->pdf(eRec);
+                if (!m_allLights)
+                    pdf_em *= scene->pdfEmitter(its.p(), emitter);
 
                 float w_mat = pdf_mat + pdf_em > 0.f ? pdf_mat / (pdf_mat + pdf_em) : 0.0f;
 
@@ -89,11 +108,14 @@ public:
     /// Return a human-readable description for debugging purposes
     std::string toString() const
     {
-        return tfm::format("[Direct MIS integrator]");
+        return tfm::format("[Direct MIS integrator allLights = %s, lightCandidates = %i]",
+            m_allLights ? "true" : "false", m_lightCandidates);
     }
 
 protected:
     float ray_length;
+    bool m_allLights;
+    int m_lightCandidates;
 
     const Color3f BLACK = Color3f(0.0);
 };
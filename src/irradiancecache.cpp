@@ -0,0 +1,566 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/ris.h>
+#include <nori/roulette.h>
+#include <nori/lowdiscrepancy.h>
+#include <nori/timer.h>
+#include <pcg32.h>
+#include <tbb/tbb.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Path tracer with an irradiance cache for diffuse interreflection
+ *
+ * At the first diffuse vertex of a camera path (after any chain of specular
+ * bounces), direct illumination is computed by next event estimation and
+ * the indirect irradiance is interpolated from a sparse set of records
+ * instead of continuing the path; see "A ray tracing solution for diffuse
+ * interreflection" by Ward et al. (1988) and "Irradiance gradients" by Ward
+ * and Heckbert (1992). Where no record is valid, the path is continued as
+ * in \c path_mis, so the cache only changes the estimate where it is used.
+ *
+ * A record stores the indirect irradiance at a point, its translational and
+ * rotational gradients, and a validity radius: the harmonic mean distance
+ * of the surfaces seen from the point, limited by the translational
+ * gradient and clamped to a range relative to the scene size. The records
+ * are looked up in a hierarchical hashed grid, where each record lives on
+ * the level whose cells are at least as large as its region of validity.
+ *
+ * The records are created in a parallel pre-pass that visits the pixel
+ * centers on successively finer grids (every 32nd pixel, every 16th, ..,
+ * every pixel). Points that the records of the coarser grids do not cover
+ * get new records, which are computed in parallel and added together, so
+ * the cache does not depend on thread scheduling. The cache is read-only
+ * while rendering.
+ *
+ * \c accuracy trades bias for speed: a record is used up to an error of
+ * \c accuracy, measured as the distance in validity radii plus the
+ * deviation of the normals. Larger values need fewer records.
+ */
+class IrradianceCacheIntegrator : public Integrator {
+public:
+    IrradianceCacheIntegrator(const PropertyList &props) : m_roulette(props) {
+        /* Maximum interpolation error of a record (Ward's 'a'); larger is faster and more biased */
+        m_accuracy = props.getFloat("accuracy", 0.3f);
+
+        /* Number of hemisphere rays that are traced to compute a record */
+        int hemisphereSamples = props.getInteger("hemisphereSamples", 256);
+
+        if (m_accuracy <= 0.0f)
+            throw NoriException("IrradianceCacheIntegrator: accuracy must be positive");
+        if (hemisphereSamples < 8)
+            throw NoriException("IrradianceCacheIntegrator: hemisphereSamples must be at least 8");
+
+        /* Stratify the hemisphere into M x N cells with N ~ pi M */
+        m_thetaStrata = std::max(2, (int) std::round(std::sqrt(hemisphereSamples * INV_PI)));
+        m_phiStrata = std::max(4, (int) std::round(hemisphereSamples / (float) m_thetaStrata));
+    }
+
+    void preprocess(const Scene *scene) override {
+        m_records.clear();
+        float diagonal = scene->getBoundingBox().getExtents().norm();
+        m_minRadius = MIN_RADIUS * diagonal;
+        m_maxRadius = MAX_RADIUS * diagonal;
+        m_gridOrigin = scene->getBoundingBox().min;
+        m_minCellSize = 2.0f * m_accuracy * m_minRadius;
+        buildGrid();
+
+        const Camera *camera = scene->getCamera();
+        Vector2i size = camera->getOutputSize();
+
+        cout << "Building the irradiance cache .. ";
+        cout.flush();
+        Timer timer;
+
+        for (int stride = INITIAL_STRIDE; stride >= 1; stride /= 2) {
+            /* Find the diffuse points seen through the pixel centers of this
+               grid (skipping those of the coarser grid) that no record covers */
+            int rows = (size.y() + stride - 1) / stride;
+            std::vector<std::vector<RecordPoint>> rowPoints(rows);
+            tbb::parallel_for(tbb::blocked_range<int>(0, rows),
+                [&](const tbb::blocked_range<int> &range) {
+                    for (int row = range.begin(); row != range.end(); ++row) {
+                        int y = row * stride;
+                        for (int x = 0; x < size.x(); x += stride) {
+                            if (stride < INITIAL_STRIDE && x % (2 * stride) == 0 && y % (2 * stride) == 0)
+                                continue;
+
+                            uint32_t seed = LowDiscrepancy::hashPixel(Point2i(x, y), (uint32_t) stride);
+                            pcg32 rng(seed, LowDiscrepancy::mix(seed));
+                            PathSampler sampler { rng };
+
+                            Ray3f ray;
+                            Point2f pixelSample((float) x + 0.5f, (float) y + 0.5f);
+                            if (camera->sampleRay(ray, pixelSample, Point2f(0.5f)).isZero())
+                                continue;
+
+                            Intersection its;
+                            if (!findDiffuseVertex(scene, &sampler, ray, its))
+                                continue;
+
+                            Color3f E;
+                            if (!interpolate(its.p(), its.shFrame().n, E))
+                                rowPoints[row].push_back(RecordPoint { its.p(), its.shFrame() });
+                        }
+                    }
+                }
+            );
+
+            std::vector<RecordPoint> points;
+            for (const auto &row : rowPoints)
+                points.insert(points.end(), row.begin(), row.end());
+
+            /* Compute the new records in parallel */
+            size_t first = m_records.size();
+            m_records.resize(first + points.size());
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, points.size(), 1),
+                [&](const tbb::blocked_range<size_t> &range) {
+                    for (size_t i = range.begin(); i != range.end(); ++i) {
+                        uint32_t seed = LowDiscrepancy::hashPixel(Point2i((int) (first + i), 0), 0x1cc4u);
+                        m_records[first + i] = computeRecord(scene, points[i], seed);
+                    }
+                }
+            );
+
+            buildGrid();
+        }
+
+        cout << "done. (took " << timer.elapsedString() << ", " << m_records.size() << " records, "
+             << memString(m_records.size() * sizeof(IrradianceRecord) + m_entries.size() * sizeof(GridEntry))
+             << ")" << endl;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const override {
+        Color3f color(0.0f);
+        Color3f attenuation(1.0f);
+        Ray3f currentRay = ray;
+
+        Intersection its;
+        if (!scene->rayIntersect(currentRay, its))
+            return color;
+
+        for (int depth = 0; ; ++depth) {
+            /* Emission seen by the camera or through specular bounces */
+            if (its.mesh->isEmitter()) {
+                EmitterQueryRecord eRec(currentRay.o, its.p(), its.shFrame().n);
+                color += attenuation * its.mesh->getEmitter()->eval(eRec);
+            }
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            Vector3f wi = its.toLocal(-currentRay.d);
+            if (!bsdf->isDelta()) {
+                /* Direct illumination plus the cached indirect irradiance */
+                Color3f E;
+                if (bsdf->isDiffuse() && interpolate(its.p(), its.shFrame().n, E)) {
+                    BSDFQueryRecord bRec(wi, Vector3f(0.0f, 0.0f, 1.0f), ESolidAngle);
+                    bRec.uv = its.uv();
+                    return color + attenuation * (directLight(scene, sampler, its, wi) + bsdf->eval(bRec) * E);
+                }
+                return color + attenuation * reflectedRadiance(scene, sampler, currentRay, its);
+            }
+
+            /* Russian roulette */
+            if (m_roulette.evaluate(attenuation, depth, sampler->next1D()) == 0)
+                return color;
+
+            /* Follow the specular bounce */
+            BSDFQueryRecord bRec(wi);
+            bRec.uv = its.uv();
+            attenuation *= bsdf->sample(bRec, sampler->next2D());
+            if (attenuation.isZero())
+                return color;
+
+            currentRay = Ray3f(its.p(), its.toWorld(bRec.wo));
+            if (!scene->rayIntersect(currentRay, its))
+                return color;
+        }
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "IrradianceCacheIntegrator[accuracy = %f, hemisphereSamples = %i, roulette = %s]",
+            m_accuracy, m_thetaStrata * m_phiStrata, m_roulette.toString()
+        );
+    }
+
+protected:
+    /// Cached indirect irradiance at a point
+    struct IrradianceRecord {
+        Point3f p;             ///< Position
+        Normal3f n;            ///< Shading normal
+        Color3f E;             ///< Indirect irradiance
+        float R;               ///< Validity radius
+        Vector3f gradT[3];     ///< Translational gradient of each color channel
+        Vector3f gradR[3];     ///< Rotational gradient of each color channel
+    };
+
+    /// Point at which a record is computed
+    struct RecordPoint {
+        Point3f p;
+        Frame frame;
+    };
+
+    /// Record in a cell of the hashed grid
+    struct GridEntry {
+        uint64_t key;          ///< Level and coordinates of the cell
+        uint32_t record;       ///< Index of the record
+    };
+
+    /// Adapter that lets the pre-pass draw from a random number generator
+    struct PathSampler {
+        pcg32 &rng;
+        float next1D() { return rng.nextFloat(); }
+        Point2f next2D() { float x = rng.nextFloat(); return Point2f(x, rng.nextFloat()); }
+    };
+
+    /// Smallest validity radius (relative to the scene diagonal)
+    static constexpr float MIN_RADIUS = 0.002f;
+    /// Largest validity radius (relative to the scene diagonal)
+    static constexpr float MAX_RADIUS = 0.1f;
+    /// Pixel stride of the first pre-pass grid
+    static const int INITIAL_STRIDE = 32;
+    /// Number of levels of the hashed grid
+    static const int GRID_LEVELS = 16;
+    /// Number of bits of each cell coordinate in a grid key
+    static const int GRID_COORDINATE_BITS = 20;
+
+    /**
+     * \brief Follow a path through specular bounces up to the first vertex
+     * with a diffuse BSDF (used to place the records)
+     */
+    template <typename SamplerType>
+    bool findDiffuseVertex(const Scene *scene, SamplerType *sampler, Ray3f ray, Intersection &its) const {
+        for (int depth = 0; depth < 16; ++depth) {
+            if (!scene->rayIntersect(ray, its))
+                return false;
+            const BSDF *bsdf = its.mesh->getBSDF();
+            if (!bsdf->isDelta())
+                return bsdf->isDiffuse();
+
+            BSDFQueryRecord bRec(its.toLocal(-ray.d));
+            bRec.uv = its.uv();
+            if (bsdf->sample(bRec, sampler->next2D()).isZero())
+                return false;
+            ray = Ray3f(its.p(), its.toWorld(bRec.wo));
+        }
+        return false;
+    }
+
+    /**
+     * \brief Estimate the radiance reflected at \c its towards the origin of
+     * \c ray, i.e. without its emission, as in \c path_mis
+     */
+    template <typename SamplerType>
+    Color3f reflectedRadiance(const Scene *scene, SamplerType *sampler, Ray3f ray, Intersection its) const {
+        Color3f color(0.0f);
+        Color3f attenuation(1.0f);
+
+        for (int depth = 0; ; ++depth) {
+            color += attenuation * sampleDirectLight(scene, its, its.toLocal(-ray.d), sampler, 1);
+
+            /* Russian roulette */
+            if (m_roulette.evaluate(attenuation, depth, sampler->next1D()) == 0)
+                break;
+
+            /* Sample the BSDF */
+            const BSDF *bsdf = its.mesh->getBSDF();
+            BSDFQueryRecord bRec(its.toLocal(-ray.d));
+            bRec.uv = its.uv();
+            attenuation *= bsdf->sample(bRec, sampler->next2D());
+            if (attenuation.isZero())
+                break;
+            float pdf_mat = bsdf->pdf(bRec);
+
+            Point3f origin = its.p();
+            ray = Ray3f(origin, its.toWorld(bRec.wo));
+            if (!scene->rayIntersect(ray, its))
+                break;
+
+            /* Emitter found by BSDF sampling, weighted against light sampling */
+            if (its.mesh->isEmitter()) {
+                EmitterQueryRecord eRec(origin, its.p(), its.shFrame().n);
+                const Emitter *emitter = its.mesh->getEmitter();
+                float w_mats = 1.0f;
+                if (bRec.measure != EDiscrete) {
+                    float pdf_em = emitter->pdf(eRec) * scene->pdfEmitter(origin, emitter);
+                    w_mats = pdf_mat + pdf_em > 0.f ? pdf_mat / (pdf_mat + pdf_em) : pdf_mat;
+                }
+                color += attenuation * w_mats * emitter->eval(eRec);
+            }
+        }
+
+        return color;
+    }
+
+    /// Next event estimation without MIS (BSDF sampling does not continue at cached vertices)
+    template <typename SamplerType>
+    Color3f directLight(const Scene *scene, SamplerType *sampler, const Intersection &its, const Vector3f &wi) const {
+        float lightPdf = 0.0f;
+        const Emitter *light = scene->sampleEmitter(its.p(), sampler->next1D(), lightPdf);
+        Point2f lightSample = sampler->next2D();
+        if (!light)
+            return Color3f(0.0f);
+
+        EmitterQueryRecord eRec(its.p());
+        Color3f Li = light->sample(eRec, lightSample) / lightPdf;
+        if (Li.isZero() || scene->rayIntersect(eRec.shadowRay))
+            return Color3f(0.0f);
+
+        BSDFQueryRecord bRec(wi, its.toLocal(eRec.wi), ESolidAngle);
+        bRec.uv = its.uv();
+        return its.mesh->getBSDF()->eval(bRec) * std::max(0.0f, Frame::cosTheta(bRec.wo)) * Li;
+    }
+
+    /**
+     * \brief Compute a record from stratified, cosine-distributed hemisphere
+     * rays, with the gradients of Ward and Heckbert (1992)
+     */
+    IrradianceRecord computeRecord(const Scene *scene, const RecordPoint &point, uint32_t seed) const {
+        pcg32 rng(seed, LowDiscrepancy::mix(seed));
+        PathSampler sampler { rng };
+
+        const int M = m_thetaStrata, N = m_phiStrata;
+        std::vector<Color3f> L(M * N, Color3f(0.0f));
+        std::vector<float> r(M * N, std::numeric_limits<float>::infinity());
+        std::vector<float> tanTheta(M * N);
+        float invDistanceSum = 0.0f;
+
+        IrradianceRecord record;
+        record.p = point.p;
+        record.n = point.frame.n;
+        record.E = Color3f(0.0f);
+        for (int c = 0; c < 3; ++c)
+            record.gradT[c] = record.gradR[c] = Vector3f(0.0f);
+
+        for (int j = 0; j < M; ++j) {
+            for (int k = 0; k < N; ++k) {
+                float sinTheta2 = (j + rng.nextFloat()) / M;
+                float phi = 2.0f * M_PI * (k + rng.nextFloat()) / N;
+                float sinTheta = std::sqrt(sinTheta2), cosTheta = std::sqrt(1.0f - sinTheta2);
+                Vector3f d(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+                tanTheta[j * N + k] = sinTheta / cosTheta;
+
+                Ray3f ray(point.p, point.frame.toWorld(d));
+                Intersection its;
+                if (!scene->rayIntersect(ray, its))
+                    continue;
+                r[j * N + k] = its.t;
+                invDistanceSum += 1.0f / its.t;
+                Color3f value = reflectedRadiance(scene, &sampler, ray, its);
+                if (value.isValid())
+                    L[j * N + k] = value;
+                record.E += L[j * N + k];
+            }
+        }
+        record.E *= M_PI / (M * N);
+
+        for (int k = 0; k < N; ++k) {
+            float phiCenter = 2.0f * M_PI * (k + 0.5f) / N;
+            float phiMin = 2.0f * M_PI * k / N;
+            Vector3f u = point.frame.toWorld(Vector3f(std::cos(phiCenter), std::sin(phiCenter), 0.0f));
+            Vector3f v = point.frame.toWorld(Vector3f(-std::sin(phiCenter), std::cos(phiCenter), 0.0f));
+            Vector3f vMin = point.frame.toWorld(Vector3f(-std::sin(phiMin), std::cos(phiMin), 0.0f));
+            int kPrev = (k + N - 1) % N;
+
+            Color3f rotational(0.0f), radial(0.0f), azimuthal(0.0f);
+            for (int j = 0; j < M; ++j) {
+                const Color3f &Ljk = L[j * N + k];
+                rotational -= tanTheta[j * N + k] * Ljk;
+
+                /* Change across the boundary to the stratum with smaller theta */
+                if (j > 0) {
+                    float sin2 = (float) j / M;
+                    float distance = std::min(r[j * N + k], r[(j - 1) * N + k]);
+                    radial += std::sqrt(sin2) * (1.0f - sin2) / distance * (Ljk - L[(j - 1) * N + k]);
+                }
+
+                /* Change across the boundary to the previous stratum in phi */
+                float cosMin = std::sqrt(1.0f - (float) j / M), cosMax = std::sqrt(1.0f - (j + 1.0f) / M);
+                float sinCenter = std::sqrt((j + 0.5f) / M);
+                float distance = std::min(r[j * N + k], r[j * N + kPrev]);
+                azimuthal += (cosMin - cosMax) / (sinCenter * distance) * (Ljk - L[j * N + kPrev]);
+            }
+
+            for (int c = 0; c < 3; ++c) {
+                record.gradR[c] += v * (rotational[c] * M_PI / (M * N));
+                record.gradT[c] += u * (radial[c] * 2.0f * M_PI / N) + vMin * azimuthal[c];
+            }
+        }
+
+        /* Harmonic mean distance, limited by the translational gradient */
+        float radius = invDistanceSum > 0.0f ? (M * N) / invDistanceSum : m_maxRadius;
+        Vector3f gradient;
+        for (int i = 0; i < 3; ++i)
+            gradient[i] = Color3f(record.gradT[0][i], record.gradT[1][i], record.gradT[2][i]).getLuminance();
+        float gradientNorm = gradient.norm();
+        if (gradientNorm > 0.0f)
+            radius = std::min(radius, record.E.getLuminance() / gradientNorm);
+        record.R = clamp(radius, m_minRadius, m_maxRadius);
+
+        return record;
+    }
+
+    /**
+     * \brief Interpolate the indirect irradiance from the records that are
+     * valid at \c p, returns false if there are none
+     */
+    bool interpolate(const Point3f &p, const Normal3f &n, Color3f &E) const {
+        float weightSum = 0.0f;
+        Color3f sum(0.0f);
+
+        lookup(p, [&](const IrradianceRecord &record) {
+            Vector3f d = p - record.p;
+            float cosNormal = n.dot(record.n);
+            if (cosNormal <= 0.0f)
+                return;
+
+            /* Ward's error estimate, with a weight that falls off smoothly to zero at 'accuracy' */
+            float error = d.norm() / record.R + std::sqrt(std::max(0.0f, 1.0f - cosNormal));
+            if (error >= m_accuracy)
+                return;
+
+            /* Skip records that lie in front of the point */
+            if (d.dot(n + record.n) * 0.5f < -0.05f * record.R)
+                return;
+
+            Vector3f rotation = record.n.cross(n);
+            Color3f value;
+            for (int c = 0; c < 3; ++c)
+                value[c] = std::max(0.0f, record.E[c] + rotation.dot(record.gradR[c]) + d.dot(record.gradT[c]));
+
+            float weight = 1.0f - error / m_accuracy;
+            sum += weight * value;
+            weightSum += weight;
+        });
+
+        if (weightSum == 0.0f)
+            return false;
+        E = sum / weightSum;
+        return true;
+    }
+
+    /// Key of the grid cell on \c level that contains \c p
+    uint64_t cellKey(int level, const Point3f &p) const {
+        float cellSize = std::ldexp(m_minCellSize, level);
+        uint64_t key = (uint64_t) level;
+        for (int i = 0; i < 3; ++i) {
+            float coordinate = std::floor((p[i] - m_gridOrigin[i]) / cellSize);
+            coordinate = clamp(coordinate, 0.0f, (float) ((1 << GRID_COORDINATE_BITS) - 1));
+            key = (key << GRID_COORDINATE_BITS) | (uint64_t) coordinate;
+        }
+        return key;
+    }
+
+    /// Bucket of a grid key in the hash table
+    uint32_t bucket(uint64_t key) const {
+        key *= 0x9e3779b97f4a7c15ull;
+        return (uint32_t) (key >> 32) & m_bucketMask;
+    }
+
+    /// Call \c functor for every record whose region of validity may contain \c p
+    template <typename Functor> void lookup(const Point3f &p, const Functor &functor) const {
+        if (m_entries.empty())
+            return;
+        for (int level = 0; level < GRID_LEVELS; ++level) {
+            if (!(m_levelMask & (1u << level)))
+                continue;
+            uint64_t key = cellKey(level, p);
+            uint32_t b = bucket(key);
+            for (uint32_t i = m_bucketStart[b]; i < m_bucketStart[b + 1]; ++i) {
+                if (m_entries[i].key == key)
+                    functor(m_records[m_entries[i].record]);
+            }
+        }
+    }
+
+    /**
+     * \brief Insert the records into the cells that their regions of
+     * validity overlap, on the level whose cells are at least as large as
+     * these regions (so that there are at most 8 such cells)
+     */
+    void buildGrid() {
+        std::vector<GridEntry> entries;
+        m_levelMask = 0;
+        for (uint32_t index = 0; index < (uint32_t) m_records.size(); ++index) {
+            const IrradianceRecord &record = m_records[index];
+            float extent = m_accuracy * record.R;
+            int level = 0;
+            while (level + 1 < GRID_LEVELS && std::ldexp(m_minCellSize, level) < 2.0f * extent)
+                ++level;
+            m_levelMask |= 1u << level;
+
+            uint64_t lo = cellKey(level, record.p - Vector3f(extent));
+            uint64_t hi = cellKey(level, record.p + Vector3f(extent));
+            const uint64_t mask = (1ull << GRID_COORDINATE_BITS) - 1;
+            for (uint64_t x = (lo >> 2 * GRID_COORDINATE_BITS) & mask; x <= ((hi >> 2 * GRID_COORDINATE_BITS) & mask); ++x)
+                for (uint64_t y = (lo >> GRID_COORDINATE_BITS) & mask; y <= ((hi >> GRID_COORDINATE_BITS) & mask); ++y)
+                    for (uint64_t z = lo & mask; z <= (hi & mask); ++z) {
+                        uint64_t key = ((((((uint64_t) level << GRID_COORDINATE_BITS) | x)
+                                        << GRID_COORDINATE_BITS) | y) << GRID_COORDINATE_BITS) | z;
+                        entries.push_back(GridEntry { key, index });
+                    }
+        }
+
+        /* Sort the entries into the buckets of the hash table */
+        uint32_t bucketCount = 1;
+        while (bucketCount < entries.size())
+            bucketCount *= 2;
+        m_bucketMask = bucketCount - 1;
+        m_bucketStart.assign(bucketCount + 1, 0);
+        for (const GridEntry &entry : entries)
+            ++m_bucketStart[bucket(entry.key) + 1];
+        for (uint32_t b = 0; b < bucketCount; ++b)
+            m_bucketStart[b + 1] += m_bucketStart[b];
+        m_entries.resize(entries.size());
+        std::vector<uint32_t> position(m_bucketStart.begin(), m_bucketStart.end() - 1);
+        for (const GridEntry &entry : entries)
+            m_entries[position[bucket(entry.key)]++] = entry;
+    }
+
+private:
+    float m_accuracy;
+    int m_thetaStrata;
+    int m_phiStrata;
+    RussianRoulette m_roulette;
+    float m_minRadius = 0.0f;
+    float m_maxRadius = 0.0f;
+    std::vector<IrradianceRecord> m_records;
+
+    /* Hierarchical hashed grid */
+    Point3f m_gridOrigin = Point3f(0.0f);
+    float m_minCellSize = 0.0f;
+    uint32_t m_levelMask = 0;
+    uint32_t m_bucketMask = 0;
+    std::vector<uint32_t> m_bucketStart;
+    std::vector<GridEntry> m_entries;
+};
+
+constexpr float IrradianceCacheIntegrator::MIN_RADIUS;
+constexpr float IrradianceCacheIntegrator::MAX_RADIUS;
+
+NORI_REGISTER_CLASS(IrradianceCacheIntegrator, "irradiance_cache");
+NORI_NAMESPACE_END
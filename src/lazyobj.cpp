@@ -0,0 +1,373 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/mesh.h>
+#include <nori/bvh.h>
+#include <filesystem/resolver.h>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+
+NORI_NAMESPACE_BEGIN
+
+class LazyWavefrontOBJ;
+
+/**
+ * \brief Memory budget and LRU eviction shared by all lazily loaded shapes
+ *
+ * Recency is tracked with a global epoch that advances whenever geometry
+ * is loaded. Shapes stamp themselves with the current epoch when they are
+ * hit by a ray, which is sufficient to order them for eviction (which
+ * only ever happens during a load) without contended writes on every ray.
+ */
+class LazyGeometryManager {
+public:
+    static LazyGeometryManager &getInstance() {
+        static LazyGeometryManager instance;
+        return instance;
+    }
+
+    /// Return the current epoch used for LRU stamps
+    uint64_t getEpoch() const { return m_epoch.load(std::memory_order_relaxed); }
+
+    /**
+     * \brief Register the memory budget requested by a shape (0 = unlimited)
+     *
+     * The smallest budget of all live shapes applies, so budgets end with
+     * the scene that declared them.
+     */
+    void addBudget(size_t budget) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (budget > 0)
+            m_budgets.insert(budget);
+    }
+
+    /// Withdraw a budget registered with \ref addBudget()
+    void removeBudget(size_t budget) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_budgets.find(budget);
+        if (it != m_budgets.end())
+            m_budgets.erase(it);
+    }
+
+    /// Register freshly loaded geometry and evict others to stay within the budget
+    void addResident(LazyWavefrontOBJ *shape, size_t size);
+
+    /// Forget about a shape (called when it is destroyed)
+    void removeResident(LazyWavefrontOBJ *shape);
+
+private:
+    LazyGeometryManager() { }
+
+    /// Return the budget in effect (0 = unlimited)
+    size_t getBudget() const { return m_budgets.empty() ? 0 : *m_budgets.begin(); }
+
+private:
+    std::mutex m_mutex;
+    std::vector<LazyWavefrontOBJ *> m_resident;
+    size_t m_usage = 0;
+    size_t m_peakUsage = 0;
+    std::multiset<size_t> m_budgets;
+    std::atomic<uint64_t> m_epoch { 0 };
+};
+
+/**
+ * \brief Wavefront OBJ mesh that is only loaded when a ray first enters
+ * its bounding box
+ *
+ * The top-level BVH only sees a single primitive covering the bounds of
+ * the mesh. These are either declared in the scene (\c bboxMin and
+ * \c bboxMax), or obtained by a streaming scan over the vertex positions.
+ * With \c cacheBounds, the scan result is stored next to the OBJ file
+ * (<tt>.bounds</tt>) and reused by later runs. The triangles
+ * and a private BVH over them are loaded on demand, and are released
+ * again when the \c memoryBudget (in MiB) of all lazy shapes is exceeded.
+ *
+ * All other parameters are forwarded to the \c obj loader, which does not
+ * print loading statistics unless \c verbose is set, since loads happen
+ * during rendering. Lazy shapes cannot be area emitters: light sampling
+ * needs the triangles of every emitter to be resident.
+ */
+class LazyWavefrontOBJ : public Shape {
+public:
+    LazyWavefrontOBJ(const PropertyList &propList) : m_props(propList) {
+        if (!m_props.has("verbose"))
+            m_props.setBoolean("verbose", false);
+        m_filename = getFileResolver()->resolve(propList.getString("filename"));
+        Transform trafo = propList.getTransform("toWorld", Transform());
+
+        if (propList.has("bboxMin") || propList.has("bboxMax")) {
+            m_bbox = BoundingBox3f(propList.getPoint3("bboxMin"),
+                                   propList.getPoint3("bboxMax"));
+        } else {
+            /* Store the scanned bounds next to the OBJ file for later runs */
+            m_bbox = computeBounds(m_filename, trafo,
+                                   propList.getBoolean("cacheBounds", false));
+        }
+
+        if (!m_bbox.isValid())
+            throw NoriException("lazyobj: \"%s\" has invalid bounds %s",
+                                m_filename, m_bbox.toString());
+
+        /* Limit for the geometry of all lazy shapes in MiB (0: unlimited) */
+        m_budget = (size_t) std::max(propList.getInteger("memoryBudget", 0), 0) * 1024 * 1024;
+        LazyGeometryManager::getInstance().addBudget(m_budget);
+    }
+
+    virtual ~LazyWavefrontOBJ() {
+        LazyGeometryManager::getInstance().removeResident(this);
+        LazyGeometryManager::getInstance().removeBudget(m_budget);
+    }
+
+    virtual void activate() override {
+        Shape::activate();
+
+        if (m_emitter)
+            throw NoriException("lazyobj: area emitters require resident "
+                                "geometry, use an \"obj\" shape instead!");
+    }
+
+    virtual BoundingBox3f getBoundingBox(uint32_t index) const override { return m_bbox; }
+
+    virtual Point3f getCentroid(uint32_t index) const override { return m_bbox.getCenter(); }
+
+    virtual bool rayIntersect(uint32_t &index, const Ray3f &ray, float &u, float &v, float &t) const override {
+        std::shared_ptr<const Resident> resident = acquire();
+
+        Intersection its;
+        if (!resident->bvh->rayIntersect(ray, its))
+            return false;
+
+        /* Report the triangle, which setHitInformation() looks up directly */
+        index = its.primIndex;
+        u = its.bary.x();
+        v = its.bary.y();
+        t = its.t;
+        return true;
+    }
+
+    virtual void setHitInformation(const Intersection &its, uint32_t fields) const override {
+        /* The primitive index is the triangle within the mesh. The geometry
+           may have been evicted and reloaded in between, which yields
+           identical data. */
+        acquire()->mesh->setHitInformation(its, fields);
+    }
+
+    virtual void sampleSurface(ShapeQueryRecord &sRec, const Point2f &sample) const override {
+        acquire()->mesh->sampleSurface(sRec, sample);
+    }
+
+    virtual float pdfSurface(const ShapeQueryRecord &sRec) const override {
+        return acquire()->mesh->pdfSurface(sRec);
+    }
+
+    virtual std::string getDeferredSource() const override {
+        struct stat st;
+        uint64_t size = 0, modified = 0;
+        if (stat(m_filename.str().c_str(), &st) == 0) {
+            size = (uint64_t) st.st_size;
+            modified = (uint64_t) st.st_mtime;
+        }
+        return tfm::format("%s|size=%i|mtime=%i|toWorld=%s|compact=%i|quantizePositions=%i",
+            m_filename, size, modified,
+            m_props.getTransform("toWorld", Transform()).toString(),
+            m_props.getBoolean("compact", false) ? 1 : 0,
+            m_props.getBoolean("quantizePositions", false) ? 1 : 0);
+    }
+
+    /**
+     * \brief Release the loaded geometry
+     *
+     * Rays that are still being traced against it keep it alive until
+     * they finish. Returns the amount of memory that was accounted for.
+     */
+    size_t evict() {
+        std::atomic_store(&m_resident, std::shared_ptr<const Resident>());
+        return m_residentSize.load(std::memory_order_relaxed);
+    }
+
+    /// Return the epoch at which the shape was last hit by a ray
+    uint64_t getLastUse() const { return m_lastUse.load(std::memory_order_relaxed); }
+
+    virtual std::string toString() const override {
+        return tfm::format(
+            "LazyWavefrontOBJ[\n"
+            "  filename = \"%s\",\n"
+            "  bbox = %s,\n"
+            "  resident = %s\n"
+            "]",
+            m_filename,
+            m_bbox.toString(),
+            std::atomic_load(&m_resident) ? "yes" : "no"
+        );
+    }
+
+protected:
+    /// Geometry that is present in memory
+    struct Resident {
+        std::unique_ptr<BVH> bvh;   ///< BVH over the triangles (owns \ref mesh)
+        const Mesh *mesh;           ///< The loaded mesh
+    };
+
+    /// Return the resident geometry, loading it if necessary
+    std::shared_ptr<const Resident> acquire() const {
+        uint64_t epoch = LazyGeometryManager::getInstance().getEpoch();
+        if (m_lastUse.load(std::memory_order_relaxed) != epoch)
+            m_lastUse.store(epoch, std::memory_order_relaxed);
+
+        std::shared_ptr<const Resident> resident = std::atomic_load(&m_resident);
+        if (resident)
+            return resident;
+
+        std::lock_guard<std::mutex> lock(m_loadMutex);
+        resident = std::atomic_load(&m_resident);
+        if (resident)
+            return resident;
+
+        resident = load();
+        std::atomic_store(&m_resident, resident);
+        LazyGeometryManager::getInstance().addResident(
+            const_cast<LazyWavefrontOBJ *>(this), m_residentSize.load(std::memory_order_relaxed));
+        return resident;
+    }
+
+    /// Load the mesh and build its BVH
+    std::shared_ptr<const Resident> load() const {
+        std::unique_ptr<Mesh> mesh(static_cast<Mesh *>(
+            NoriObjectFactory::createInstance("obj", m_props)));
+        if (m_normalMap)
+            mesh->addChild(m_normalMap);
+        mesh->activate();
+
+        std::shared_ptr<Resident> resident = std::make_shared<Resident>();
+        resident->mesh = mesh.get();
+        resident->bvh.reset(new BVH());
+        resident->bvh->addShape(mesh.release());
+
+        /* This runs inside a rendering task: build serially, since waiting
+           on nested TBB tasks could steal work that blocks on m_loadMutex */
+        resident->bvh->build(false);
+
+        m_residentSize.store(resident->mesh->getMemoryUsage() +
+                             resident->bvh->getMemoryUsage(), std::memory_order_relaxed);
+        return resident;
+    }
+
+    /**
+     * \brief Compute the world space bounds of an OBJ file by scanning its
+     * vertex positions, using a cached result when available
+     */
+    static BoundingBox3f computeBounds(const filesystem::path &filename,
+            const Transform &trafo, bool useCache) {
+        std::ifstream is(filename.str(), std::ios::binary | std::ios::ate);
+        if (is.fail())
+            throw NoriException("Unable to open OBJ file \"%s\"!", filename);
+
+        /* The cache entry is only valid for the same transformation and file size */
+        size_t key = std::hash<std::string>()(
+            tfm::format("%s|%i", trafo.toString(), (uint64_t) is.tellg()));
+        std::string cacheFile = filename.str() + ".bounds";
+        BoundingBox3f bbox;
+
+        if (useCache) {
+            std::ifstream cache(cacheFile);
+            size_t cachedKey;
+            if (cache >> cachedKey && cachedKey == key &&
+                cache >> bbox.min.x() >> bbox.min.y() >> bbox.min.z()
+                      >> bbox.max.x() >> bbox.max.y() >> bbox.max.z())
+                return bbox;
+            bbox.reset();
+        }
+
+        is.seekg(0);
+        std::string line_str;
+        while (std::getline(is, line_str)) {
+            if (line_str.size() < 2 || line_str[0] != 'v' || line_str[1] != ' ')
+                continue;
+            std::istringstream line(line_str.substr(2));
+            Point3f p;
+            line >> p.x() >> p.y() >> p.z();
+            bbox.expandBy(trafo * p);
+        }
+
+        if (useCache) {
+            /* Failure to write the cache (e.g. read-only scene directory) is not an error */
+            std::ofstream cache(cacheFile);
+            cache.precision(9);
+            cache << key << " "
+                  << bbox.min.x() << " " << bbox.min.y() << " " << bbox.min.z() << " "
+                  << bbox.max.x() << " " << bbox.max.y() << " " << bbox.max.z() << endl;
+        }
+
+        return bbox;
+    }
+
+protected:
+    PropertyList m_props;                                   ///< Parameters forwarded to the OBJ loader
+    filesystem::path m_filename;                            ///< Resolved file name
+    mutable std::shared_ptr<const Resident> m_resident;     ///< Loaded geometry (accessed atomically)
+    mutable std::mutex m_loadMutex;                         ///< Serializes loading
+    size_t m_budget;                                        ///< Requested memory budget (0 = unlimited)
+    mutable std::atomic<size_t> m_residentSize { 0 };       ///< Memory used by the loaded geometry
+    mutable std::atomic<uint64_t> m_lastUse { 0 };          ///< LRU stamp
+};
+
+void LazyGeometryManager::addResident(LazyWavefrontOBJ *shape, size_t size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_epoch.fetch_add(1, std::memory_order_relaxed);
+    m_resident.push_back(shape);
+    m_usage += size;
+
+    size_t budget = getBudget();
+    while (budget > 0 && m_usage > budget && m_resident.size() > 1) {
+        /* Evict the least recently used shape other than the one just loaded */
+        auto lru = m_resident.end();
+        for (auto it = m_resident.begin(); it != m_resident.end(); ++it) {
+            if (*it != shape && (lru == m_resident.end() ||
+                                 (*it)->getLastUse() < (*lru)->getLastUse()))
+                lru = it;
+        }
+        m_usage -= (*lru)->evict();
+        m_resident.erase(lru);
+    }
+
+    if (m_usage > m_peakUsage) {
+        m_peakUsage = m_usage;
+        cout << "Lazy geometry: " << m_resident.size() << " resident shapes, "
+             << memString(m_usage)
+             << (budget > 0 ? " of " + memString(budget) : std::string())
+             << endl;
+    }
+}
+
+void LazyGeometryManager::removeResident(LazyWavefrontOBJ *shape) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = std::find(m_resident.begin(), m_resident.end(), shape);
+    if (it != m_resident.end()) {
+        m_usage -= (*it)->evict();
+        m_resident.erase(it);
+    }
+    if (m_resident.empty())
+        m_peakUsage = 0;
+}
+
+NORI_REGISTER_CLASS(LazyWavefrontOBJ, "lazyobj");
+NORI_NAMESPACE_END
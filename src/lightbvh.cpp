@@ -0,0 +1,308 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/lightbvh.h>
+#include <nori/emitter.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    inline float safeSqrt(float x) { return std::sqrt(std::max(x, 0.0f)); }
+
+    inline float safeAcos(float x) { return std::acos(clamp(x, -1.0f, 1.0f)); }
+
+    /// cos(max(0, a - b)) from the sines and cosines of both angles
+    inline float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+        if (cosA > cosB)
+            return 1.0f;
+        return cosA * cosB + sinA * sinB;
+    }
+
+    /// sin(max(0, a - b)) from the sines and cosines of both angles
+    inline float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+        if (cosA > cosB)
+            return 0.0f;
+        return sinA * cosB - cosA * sinB;
+    }
+
+    /// Smallest cone (axis w, cosine of the half angle) containing two cones
+    void mergeCones(const Vector3f &wa, float cosA, const Vector3f &wb, float cosB,
+                    Vector3f &w, float &cosTheta) {
+        float thetaA = safeAcos(cosA), thetaB = safeAcos(cosB);
+        float thetaD = safeAcos(wa.dot(wb));
+
+        if (std::min(thetaD + thetaB, (float) M_PI) <= thetaA) {
+            w = wa; cosTheta = cosA;
+            return;
+        }
+        if (std::min(thetaD + thetaA, (float) M_PI) <= thetaB) {
+            w = wb; cosTheta = cosB;
+            return;
+        }
+
+        float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+        Vector3f axis = wa.cross(wb);
+        if (thetaO >= M_PI || axis.squaredNorm() == 0) {
+            /* The merged cone covers all directions */
+            w = wa; cosTheta = -1.0f;
+            return;
+        }
+
+        /* Rotate the axis of the first cone towards the second one */
+        float thetaR = thetaO - thetaA;
+        w = Eigen::AngleAxisf(thetaR, axis.normalized()) * wa;
+        cosTheta = std::cos(thetaO);
+    }
+
+    /// Surface area orientation heuristic cost of a cluster
+    float evaluateCost(const LightBounds &b, const BoundingBox3f &bounds, int dim) {
+        float thetaO = safeAcos(b.cosTheta_o), thetaE = safeAcos(b.cosTheta_e);
+        float thetaW = std::min(thetaO + thetaE, (float) M_PI);
+        float sinThetaO = safeSqrt(1 - b.cosTheta_o * b.cosTheta_o);
+        float M_omega = 2 * M_PI * (1 - b.cosTheta_o) +
+            M_PI / 2 * (2 * thetaW * sinThetaO - std::cos(thetaO - 2 * thetaW) -
+                        2 * thetaO * sinThetaO + b.cosTheta_o);
+
+        Vector3f extents = bounds.getExtents();
+        float Kr = extents.maxCoeff() / extents[dim];
+        return b.phi * M_omega * Kr * b.bounds.getSurfaceArea();
+    }
+}
+
+float LightBounds::importance(const Point3f &p) const {
+    Point3f pc = bounds.getCenter();
+    float d2 = (p - pc).squaredNorm();
+    d2 = std::max(d2, bounds.getExtents().norm() / 2);
+
+    /* Angle between the cone axis and the direction towards p */
+    Vector3f wi = (p - pc).normalized();
+    float cosTheta_w = wi.allFinite() ? w.dot(wi) : 1.0f;
+    if (twoSided)
+        cosTheta_w = std::abs(cosTheta_w);
+    float sinTheta_w = safeSqrt(1 - cosTheta_w * cosTheta_w);
+
+    /* Angle subtended by the bounding sphere of the box */
+    float radius = bounds.getExtents().norm() / 2;
+    float dist2 = (p - pc).squaredNorm();
+    float cosTheta_b = -1.0f;
+    if (dist2 > radius * radius)
+        cosTheta_b = safeSqrt(1 - radius * radius / dist2);
+    float sinTheta_b = safeSqrt(1 - cosTheta_b * cosTheta_b);
+
+    /* Minimum angle between an emission direction and the direction to p */
+    float sinTheta_o = safeSqrt(1 - cosTheta_o * cosTheta_o);
+    float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    float cosThetap = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+    if (cosThetap <= cosTheta_e)
+        return 0.0f;
+
+    return std::max(phi * cosThetap / d2, 0.0f);
+}
+
+LightBounds LightBounds::merge(const LightBounds &a, const LightBounds &b) {
+    if (a.phi == 0)
+        return b;
+    if (b.phi == 0)
+        return a;
+
+    LightBounds result;
+    mergeCones(a.w, a.cosTheta_o, b.w, b.cosTheta_o, result.w, result.cosTheta_o);
+    result.bounds = BoundingBox3f::merge(a.bounds, b.bounds);
+    result.phi = a.phi + b.phi;
+    result.cosTheta_e = std::min(a.cosTheta_e, b.cosTheta_e);
+    result.twoSided = a.twoSided || b.twoSided;
+    return result;
+}
+
+void LightBVH::build(const std::vector<Emitter *> &emitters) {
+    m_emitters.clear();
+    m_infinite.clear();
+    m_nodes.clear();
+    m_bitTrails.clear();
+
+    std::vector<std::pair<uint32_t, LightBounds>> bounded;
+    for (const Emitter *emitter : emitters) {
+        LightBounds bounds;
+        if (!emitter->getLightBounds(bounds)) {
+            m_infinite.push_back(emitter);
+        } else if (bounds.phi > 0) {
+            bounded.push_back(std::make_pair((uint32_t) m_emitters.size(), bounds));
+            m_emitters.push_back(emitter);
+        }
+    }
+
+    if (!bounded.empty())
+        build(bounded, 0, bounded.size(), 0, 0);
+}
+
+uint32_t LightBVH::build(std::vector<std::pair<uint32_t, LightBounds>> &emitters,
+                         size_t start, size_t end, uint64_t bitTrail, int depth) {
+    if (end - start == 1) {
+        uint32_t nodeIndex = (uint32_t) m_nodes.size();
+        Node node;
+        node.bounds = emitters[start].second;
+        node.childOrEmitter = emitters[start].first;
+        node.leaf = true;
+        m_nodes.push_back(node);
+        m_bitTrails[m_emitters[emitters[start].first]] = bitTrail;
+        return nodeIndex;
+    }
+
+    BoundingBox3f bounds, centroidBounds;
+    for (size_t i = start; i < end; ++i) {
+        bounds.expandBy(emitters[i].second.bounds);
+        centroidBounds.expandBy(emitters[i].second.getCentroid());
+    }
+
+    /* Find the bucket split with the lowest cost along all axes */
+    const int nBuckets = 12;
+    float minCost = std::numeric_limits<float>::infinity();
+    int minBucket = -1, minDim = -1;
+    for (int dim = 0; dim < 3 && depth < 48; ++dim) {
+        float cmin = centroidBounds.min[dim], cmax = centroidBounds.max[dim];
+        if (cmax == cmin)
+            continue;
+
+        auto bucketOf = [&](const LightBounds &b) {
+            int index = (int) (nBuckets * (b.getCentroid()[dim] - cmin) / (cmax - cmin));
+            return clamp(index, 0, nBuckets - 1);
+        };
+
+        LightBounds buckets[nBuckets];
+        for (size_t i = start; i < end; ++i) {
+            LightBounds &bucket = buckets[bucketOf(emitters[i].second)];
+            bucket = LightBounds::merge(bucket, emitters[i].second);
+        }
+
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            LightBounds b0, b1;
+            for (int j = 0; j <= i; ++j)
+                b0 = LightBounds::merge(b0, buckets[j]);
+            for (int j = i + 1; j < nBuckets; ++j)
+                b1 = LightBounds::merge(b1, buckets[j]);
+
+            float cost = evaluateCost(b0, bounds, dim) + evaluateCost(b1, bounds, dim);
+            if (cost < minCost && b0.phi > 0 && b1.phi > 0) {
+                minCost = cost;
+                minBucket = i;
+                minDim = dim;
+            }
+        }
+    }
+
+    size_t mid;
+    if (minBucket == -1) {
+        mid = (start + end) / 2;
+    } else {
+        float cmin = centroidBounds.min[minDim], cmax = centroidBounds.max[minDim];
+        auto it = std::partition(emitters.begin() + start, emitters.begin() + end,
+            [&](const std::pair<uint32_t, LightBounds> &e) {
+                int index = (int) (nBuckets * (e.second.getCentroid()[minDim] - cmin) / (cmax - cmin));
+                return clamp(index, 0, nBuckets - 1) <= minBucket;
+            });
+        mid = it - emitters.begin();
+        if (mid == start || mid == end)
+            mid = (start + end) / 2;
+    }
+
+    uint32_t nodeIndex = (uint32_t) m_nodes.size();
+    m_nodes.push_back(Node());
+    build(emitters, start, mid, bitTrail, depth + 1);
+    uint32_t secondChild = build(emitters, mid, end, bitTrail | (1ull << depth), depth + 1);
+
+    Node &node = m_nodes[nodeIndex];
+    node.bounds = LightBounds::merge(m_nodes[nodeIndex + 1].bounds, m_nodes[secondChild].bounds);
+    node.childOrEmitter = secondChild;
+    node.leaf = false;
+    return nodeIndex;
+}
+
+const Emitter *LightBVH::sample(const Point3f &ref, float sample, float &pdf) const {
+    float pTree = treeProbability();
+
+    /* Choose an unbounded emitter */
+    if (sample >= pTree) {
+        if (m_infinite.empty())
+            return nullptr;
+        float u = (sample - pTree) / (1 - pTree);
+        size_t index = std::min((size_t) (u * m_infinite.size()), m_infinite.size() - 1);
+        pdf = (1 - pTree) / m_infinite.size();
+        return m_infinite[index];
+    }
+
+    /* Traverse the tree, choosing children according to their importance */
+    float u = std::min(sample / pTree, 0.99999994f);
+    pdf = pTree;
+    uint32_t nodeIndex = 0;
+    while (true) {
+        const Node &node = m_nodes[nodeIndex];
+        if (node.leaf)
+            return m_emitters[node.childOrEmitter];
+
+        float ci0 = m_nodes[nodeIndex + 1].bounds.importance(ref);
+        float ci1 = m_nodes[node.childOrEmitter].bounds.importance(ref);
+        if (ci0 == 0 && ci1 == 0)
+            return nullptr;
+
+        float p0 = ci0 / (ci0 + ci1);
+        if (u < p0) {
+            nodeIndex = nodeIndex + 1;
+            u = std::min(u / p0, 0.99999994f);
+            pdf *= p0;
+        } else {
+            nodeIndex = node.childOrEmitter;
+            u = std::min((u - p0) / (1 - p0), 0.99999994f);
+            pdf *= 1 - p0;
+        }
+    }
+}
+
+float LightBVH::pdf(const Point3f &ref, const Emitter *emitter) const {
+    auto it = m_bitTrails.find(emitter);
+    if (it == m_bitTrails.end()) {
+        /* Unbounded emitter, or one that does not emit any light */
+        if (std::find(m_infinite.begin(), m_infinite.end(), emitter) != m_infinite.end())
+            return (1 - treeProbability()) / m_infinite.size();
+        return 0.0f;
+    }
+
+    uint64_t bitTrail = it->second;
+    float pdf = treeProbability();
+    uint32_t nodeIndex = 0;
+    while (!m_nodes[nodeIndex].leaf) {
+        const Node &node = m_nodes[nodeIndex];
+        float ci0 = m_nodes[nodeIndex + 1].bounds.importance(ref);
+        float ci1 = m_nodes[node.childOrEmitter].bounds.importance(ref);
+        if (ci0 == 0 && ci1 == 0)
+            return 0.0f;
+
+        if (bitTrail & 1) {
+            pdf *= ci1 / (ci0 + ci1);
+            nodeIndex = node.childOrEmitter;
+        } else {
+            pdf *= ci0 / (ci0 + ci1);
+            nodeIndex = nodeIndex + 1;
+        }
+        bitTrail >>= 1;
+    }
+    return pdf;
+}
+
+NORI_NAMESPACE_END
@@ -25,7 +25,50 @@
 
 NORI_NAMESPACE_BEGIN
 
-Mesh::Mesh() { }
+Mesh::Mesh() : m_data(std::make_shared<MeshData>()) { }
+
+void Mesh::setTransform(const Transform &toWorld) {
+    m_toWorld = toWorld;
+    m_hasTransform = !toWorld.getMatrix().isIdentity();
+    m_positions.resize(0, 0);
+    m_normals.resize(0, 0);
+
+    const MatrixXf &V = m_data->V;
+    if (m_hasTransform && V.size() > 0) {
+        m_positions.resize(3, V.cols());
+        for (uint32_t i = 0; i < (uint32_t) V.cols(); ++i)
+            m_positions.col(i) = toWorld * Point3f(V.col(i));
+    }
+    m_vertexPositions = m_positions.size() > 0 ? m_positions.data() :
+                        (V.size() > 0 ? V.data() : nullptr);
+
+    const MatrixXf &N = m_data->N;
+    if (m_hasTransform && N.size() > 0) {
+        m_normals.resize(3, N.cols());
+        for (uint32_t i = 0; i < (uint32_t) N.cols(); ++i)
+            m_normals.col(i) = (toWorld * Normal3f(N.col(i))).normalized();
+    }
+    m_vertexNormals = m_normals.size() > 0 ? m_normals.data() :
+                      (N.size() > 0 ? N.data() : nullptr);
+
+    if (m_hasTransform) {
+        m_bbox.reset();
+        for (uint32_t i = 0; i < getVertexCount(); ++i)
+            m_bbox.expandBy(getVertex(i));
+    } else {
+        m_bbox = m_data->bbox;
+    }
+}
+
+Point3f Mesh::decodeVertex(uint32_t index) const {
+    Point3f p = m_data->getVertex(index);
+    return m_hasTransform ? m_toWorld * p : p;
+}
+
+Normal3f Mesh::decodeNormal(uint32_t index) const {
+    Normal3f n = m_data->getVertexNormal(index);
+    return m_hasTransform ? Normal3f((m_toWorld * n).normalized()) : n;
+}
 
 void Mesh::activate() {
     Shape::activate();
@@ -35,22 +78,23 @@ void Mesh::activate() {
         m_pdf.append(surfaceArea(i));
     }
     m_pdf.normalize();
+    m_pdf.buildAliasTable();
 }
 
 void Mesh::sampleSurface(ShapeQueryRecord & sRec, const Point2f & sample) const {
     Point2f s = sample;
-    size_t idT = m_pdf.sampleReuse(s.x());
+    size_t idT = m_pdf.sampleAliasReuse(s.x());
 
     Vector3f bc = Warp::squareToUniformTriangle(s);
 
     sRec.p = getInterpolatedVertex(idT,bc);
-    if (m_N.size() > 0) {
+    if (hasVertexNormals()) {
         sRec.n = getInterpolatedNormal(idT, bc);
     }
     else {
-        Point3f p0 = m_V.col(m_F(0, idT));
-        Point3f p1 = m_V.col(m_F(1, idT));
-        Point3f p2 = m_V.col(m_F(2, idT));
+        Point3f p0 = getVertex(m_data->F(0, idT));
+        Point3f p1 = getVertex(m_data->F(1, idT));
+        Point3f p2 = getVertex(m_data->F(2, idT));
         Normal3f n = (p1-p0).cross(p2-p0).normalized();
         sRec.n = n;
     }
@@ -60,29 +104,61 @@ float Mesh::pdfSurface(const ShapeQueryRecord & sRec) const {
     return m_pdf.getNormalization();
 }
 
+void Mesh::getNormalCone(Vector3f &axis, float &cosTheta) const {
+    /* Face normals, weighted by twice the triangle area */
+    std::vector<Vector3f> normals;
+    normals.reserve(getPrimitiveCount() + (hasVertexNormals() ? getVertexCount() : 0));
+    Vector3f sum = Vector3f::Zero();
+    for (uint32_t i = 0; i < getPrimitiveCount(); ++i) {
+        Point3f p0 = getVertex(m_data->F(0, i)), p1 = getVertex(m_data->F(1, i)),
+                p2 = getVertex(m_data->F(2, i));
+        Vector3f n = (p1 - p0).cross(p2 - p0);
+        sum += n;
+        if (n.squaredNorm() > 0)
+            normals.push_back(n.normalized());
+    }
+
+    /* Shading normals may deviate from the face normals */
+    if (hasVertexNormals()) {
+        for (uint32_t i = 0; i < getVertexCount(); ++i)
+            normals.push_back(getVertexNormal(i).normalized());
+    }
+
+    axis = Vector3f(0.0f, 0.0f, 1.0f);
+    cosTheta = -1.0f;
+    if (sum.squaredNorm() == 0 || normals.empty())
+        return;
+
+    axis = sum.normalized();
+    cosTheta = 1.0f;
+    for (const Vector3f &n : normals)
+        cosTheta = std::min(cosTheta, axis.dot(n));
+    cosTheta = std::max(cosTheta, -1.0f);
+}
+
 Point3f Mesh::getInterpolatedVertex(uint32_t index, const Vector3f &bc) const {
-    return (bc.x() * m_V.col(m_F(0, index)) +
-            bc.y() * m_V.col(m_F(1, index)) +
-            bc.z() * m_V.col(m_F(2, index)));
+    return (bc.x() * getVertex(m_data->F(0, index)) +
+            bc.y() * getVertex(m_data->F(1, index)) +
+            bc.z() * getVertex(m_data->F(2, index)));
 }
 
 Normal3f Mesh::getInterpolatedNormal(uint32_t index, const Vector3f &bc) const {
-    return (bc.x() * m_N.col(m_F(0, index)) +
-            bc.y() * m_N.col(m_F(1, index)) +
-            bc.z() * m_N.col(m_F(2, index))).normalized();
+    return (bc.x() * getVertexNormal(m_data->F(0, index)) +
+            bc.y() * getVertexNormal(m_data->F(1, index)) +
+            bc.z() * getVertexNormal(m_data->F(2, index))).normalized();
 }
 
 float Mesh::surfaceArea(uint32_t index) const {
-    uint32_t i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
+    uint32_t i0 = m_data->F(0, index), i1 = m_data->F(1, index), i2 = m_data->F(2, index);
 
-    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
+    const Point3f p0 = getVertex(i0), p1 = getVertex(i1), p2 = getVertex(i2);
 
     return 0.5f * Vector3f((p1 - p0).cross(p2 - p0)).norm();
 }
 
-bool Mesh::rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const {
-    uint32_t i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
-    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
+bool Mesh::rayIntersect(uint32_t &index, const Ray3f &ray, float &u, float &v, float &t) const {
+    uint32_t i0 = m_data->F(0, index), i1 = m_data->F(1, index), i2 = m_data->F(2, index);
+    const Point3f p0 = getVertex(i0), p1 = getVertex(i1), p2 = getVertex(i2);
 
     /* Find vectors for two edges sharing v[0] */
     Vector3f edge1 = p1 - p0, edge2 = p2 - p0;
@@ -119,68 +195,117 @@ bool Mesh::rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, fl
     return t >= ray.mint && t <= ray.maxt;
 }
 
-void Mesh::setHitInformation(uint32_t index, const Ray3f &ray, Intersection & its) const {
+void Mesh::setHitInformation(const Intersection &its, uint32_t fields) const {
     /* Find the barycentric coordinates */
     Vector3f bary;
-    bary << 1-its.uv.sum(), its.uv;
+    bary << 1-its.bary.sum(), its.bary;
 
     /* Vertex indices of the triangle */
-    uint32_t idx0 = m_F(0, index), idx1 = m_F(1, index), idx2 = m_F(2, index);
+    uint32_t index = its.primIndex;
+    uint32_t idx0 = m_data->F(0, index), idx1 = m_data->F(1, index), idx2 = m_data->F(2, index);
 
-    Point3f p0 = m_V.col(idx0), p1 = m_V.col(idx1), p2 = m_V.col(idx2);
+    if (fields & (Intersection::EPosition | Intersection::EGeoFrame)) {
+        Point3f p0 = getVertex(idx0), p1 = getVertex(idx1), p2 = getVertex(idx2);
 
-    /* Compute the intersection positon accurately
-       using barycentric coordinates */
-    its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
+        /* Compute the intersection positon accurately
+           using barycentric coordinates */
+        its.setP(bary.x() * p0 + bary.y() * p1 + bary.z() * p2);
 
-    /* Compute proper texture coordinates if provided by the mesh */
-    if (m_UV.size() > 0) {
-        its.uv = bary.x() * m_UV.col(idx0) +
-                 bary.y() * m_UV.col(idx1) +
-                 bary.z() * m_UV.col(idx2);
-       
+        /* Compute the geometry frame */
+        if (fields & Intersection::EGeoFrame)
+            its.setGeoFrame(Frame((p1-p0).cross(p2-p0).normalized()));
     }
-    /* Compute the geometry frame */
-    its.geoFrame = Frame((p1-p0).cross(p2-p0).normalized());
-    
-
-    if (m_N.size() > 0) {
-        // Check for normal maps
-        if(m_normalMap) {
-            its.shFrame = Frame(
-                    (bary.x() * m_N.col(idx0) +
-                    bary.y() * m_N.col(idx1) +
-                    bary.z() * m_N.col(idx2)).normalized());
-            its.shFrame = Frame(its.shFrame.toWorld(m_normalMap->eval(its.uv).normalized()));
+
+    if (fields & Intersection::EUV) {
+        /* Compute proper texture coordinates if provided by the mesh */
+        if (hasVertexTexCoords()) {
+            its.setUV(bary.x() * getVertexTexCoord(idx0) +
+                      bary.y() * getVertexTexCoord(idx1) +
+                      bary.z() * getVertexTexCoord(idx2));
         } else {
+            its.setUV(its.bary);
+        }
+    }
+
+    if (fields & Intersection::EShFrame) {
+        if (hasVertexNormals()) {
             /* Compute the shading frame. Note that for simplicity,
             the current implementation doesn't attempt to provide
             tangents that are continuous across the surface. That
             means that this code will need to be modified to be able
             use anisotropic BRDFs, which need tangent continuity */
-            its.shFrame = Frame(
-                    (bary.x() * m_N.col(idx0) +
-                    bary.y() * m_N.col(idx1) +
-                    bary.z() * m_N.col(idx2)).normalized());
+            Frame shFrame(
+                    (bary.x() * getVertexNormal(idx0) +
+                    bary.y() * getVertexNormal(idx1) +
+                    bary.z() * getVertexNormal(idx2)).normalized());
+
+            // Check for normal maps
+            if (m_normalMap)
+                shFrame = Frame(shFrame.toWorld(m_normalMap->eval(its.uv()).normalized()));
+            its.setShFrame(shFrame);
+        } else {
+            its.setShFrame(its.geoFrame());
         }
-
-    } else {
-        its.shFrame = its.geoFrame;
     }
 }
 
 BoundingBox3f Mesh::getBoundingBox(uint32_t index) const {
-    BoundingBox3f result(m_V.col(m_F(0, index)));
-    result.expandBy(m_V.col(m_F(1, index)));
-    result.expandBy(m_V.col(m_F(2, index)));
+    BoundingBox3f result(getVertex(m_data->F(0, index)));
+    result.expandBy(getVertex(m_data->F(1, index)));
+    result.expandBy(getVertex(m_data->F(2, index)));
     return result;
 }
 
 Point3f Mesh::getCentroid(uint32_t index) const {
     return (1.0f / 3.0f) *
-        (m_V.col(m_F(0, index)) +
-         m_V.col(m_F(1, index)) +
-         m_V.col(m_F(2, index)));
+        (getVertex(m_data->F(0, index)) +
+         getVertex(m_data->F(1, index)) +
+         getVertex(m_data->F(2, index)));
+}
+
+/// Quantize a value within [min, min+extent] to a 16 bit UNORM value
+static uint16_t quantizeUNorm16(float value, float min, float extent) {
+    if (extent <= 0.0f)
+        return 0;
+    return (uint16_t) std::round(clamp((value - min) / extent, 0.0f, 1.0f) * 65535.0f);
+}
+
+void MeshData::compress(bool quantizePositions) {
+    if (N.size() > 0) {
+        Nc.resize(1, N.cols());
+        for (uint32_t i=0; i<N.cols(); ++i)
+            Nc(0, i) = encodeOctahedral(N.col(i));
+        N.resize(0, 0);
+    }
+
+    if (UV.size() > 0) {
+        uvBounds.reset();
+        for (uint32_t i=0; i<UV.cols(); ++i)
+            uvBounds.expandBy(UV.col(i));
+
+        Vector2f extents = uvBounds.getExtents();
+        UVc.resize(2, UV.cols());
+        for (uint32_t i=0; i<UV.cols(); ++i)
+            for (int j=0; j<2; ++j)
+                UVc(j, i) = quantizeUNorm16(UV(j, i), uvBounds.min[j], extents[j]);
+        UV.resize(0, 0);
+    }
+
+    if (quantizePositions && V.size() > 0) {
+        Vector3f extents = bbox.getExtents();
+        Vc.resize(3, V.cols());
+        for (uint32_t i=0; i<V.cols(); ++i)
+            for (int j=0; j<3; ++j)
+                Vc(j, i) = quantizeUNorm16(V(j, i), bbox.min[j], extents[j]);
+        V.resize(0, 0);
+    }
+}
+
+size_t MeshData::getMemoryUsage() const {
+    return F.size() * sizeof(uint32_t) +
+           sizeof(float) * (V.size() + N.size() + UV.size()) +
+           sizeof(uint16_t) * (Vc.size() + UVc.size()) +
+           sizeof(uint32_t) * Nc.size();
 }
 
 
@@ -191,12 +316,14 @@ std::string Mesh::toString() const {
         "  vertexCount = %i,\n"
         "  triangleCount = %i,\n"
         "  bsdf = %s,\n"
+        "  normalMap = %s,\n"
         "  emitter = %s\n"
         "]",
         m_name,
-        m_V.cols(),
-        m_F.cols(),
+        getVertexCount(),
+        getPrimitiveCount(),
         m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
+        m_normalMap ? indent(m_normalMap->toString()) : std::string("null"),
         m_emitter ? indent(m_emitter->toString()) : std::string("null")
     );
 }
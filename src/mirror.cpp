@@ -54,6 +54,10 @@ public:
         return Color3f(1.0f);
     }
 
+    virtual bool isDelta() const override {
+        return true;
+    }
+
     virtual std::string toString() const override {
         return "Mirror[]";
     }
@@ -18,7 +18,6 @@
 #include <nori/texture.h>
 #include <nori/common.h>
 #include <stb_image.h>
-#include <filesystem/resolver.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -58,10 +57,9 @@ public:
 private:
     std::string m_filename;
     ImageWrap m_wrap; // How is the texture treated at image edge
-    uint8_t* m_data;
+    std::shared_ptr<const TexelBuffer> m_texels; // Shared RGB texel data
     int m_width;
     int m_height;
-    int m_channels; // RGB or RGBA
 
     Normal3f getData(const Point2f & uv) const;
 };
@@ -72,21 +70,13 @@ NormalMap::NormalMap(const PropertyList &props) {
     m_filename = props.getString("fileName", "textures/default.png");
     m_wrap = wrapTypeFromString(props.getString("wrap", "repeat"));
 
-    if(!m_filename.empty()) {
-        filesystem::path file_path = getFileResolver()->resolve(m_filename);
-         // Load in image: For some reason this doesn't load in anything...
-        m_data = stbi_load(
-            file_path.str().c_str(), 
-            &m_width, 
-            &m_height, 
-            &m_channels, 
-            STBI_rgb
-        );
-    }
-
-    if(!m_data) {
+    if(m_filename.empty()) {
         throw NoriException("No image data was loaded!");
     }
+
+    m_texels = TexelBuffer::load(m_filename, STBI_rgb);
+    m_width = m_texels->width;
+    m_height = m_texels->height;
 }
 
 #define RED_CHANNEL 0
@@ -107,9 +97,9 @@ Normal3f NormalMap::getData(const Point2f & xy) const  {
     }
 
     // Retrieve the data for the individual color channels
-    float redData = static_cast<float>(m_data[((x + m_width * y) * STBI_rgb + RED_CHANNEL)]) / UCHAR_MAX;
-    float greenData = static_cast<float>(m_data[((x + m_width * y) * STBI_rgb + GREEN_CHANNEL)]) / UCHAR_MAX;
-    float blueData = static_cast<float>(m_data[((x + m_width * y) * STBI_rgb + BLUE_CHANNEL)]) / UCHAR_MAX;
+    float redData = m_texels->get(x, y, RED_CHANNEL);
+    float greenData = m_texels->get(x, y, GREEN_CHANNEL);
+    float blueData = m_texels->get(x, y, BLUE_CHANNEL);
 
     return Normal3f(
         2.0f * redData - 1.0f,
@@ -142,9 +132,11 @@ std::string NormalMap::toString() const {
     return tfm::format(
         "NormalMap[\n"
                 "  filename = %s,\n"
+                "  source = %s,\n"
                 "  wrap = %s\n"
                 "]",
         m_filename, 
+        m_texels->source,
         wrapToString(m_wrap)
     );
 }
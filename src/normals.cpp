@@ -18,7 +18,7 @@ class NormalIntegrator : public Integrator
             if(!scene->rayIntersect(ray,its))
                 return Color3f(0.0f);
 
-            Normal3f n = its.shFrame.n.cwiseAbs();
+            Normal3f n = its.shFrame().n.cwiseAbs();
             return Color3f(n.x(), n.y(), n.z());
         }
 
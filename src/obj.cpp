@@ -18,6 +18,7 @@
 
 #include <nori/mesh.h>
 #include <nori/timer.h>
+#include <nori/assetcache.h>
 #include <filesystem/resolver.h>
 #include <unordered_map>
 #include <fstream>
@@ -30,20 +31,60 @@ NORI_NAMESPACE_BEGIN
 class WavefrontOBJ : public Mesh {
 public:
     WavefrontOBJ(const PropertyList &propList) {
-        typedef std::unordered_map<OBJVertex, uint32_t, OBJVertexHash> VertexMap;
-
         filesystem::path filename =
             getFileResolver()->resolve(propList.getString("filename"));
+        Transform trafo = propList.getTransform("toWorld", Transform());
+        bool compact = propList.getBoolean("compact", false);
+        bool quantizePositions = propList.getBoolean("quantizePositions", false);
+        /* Print loading statistics (lazily loaded shapes turn this off) */
+        bool verbose = propList.getBoolean("verbose", true);
+
+        /* Meshes are kept in object space and shared between all instances
+           that load the same file with the same storage parameters */
+        std::string key = tfm::format("%s|compact=%i|quantizePositions=%i",
+            filename.str(), compact ? 1 : 0, quantizePositions ? 1 : 0);
+
+        bool loaded = false;
+        m_data = AssetCache::getInstance().acquire<MeshData>(key, [&]() {
+            loaded = true;
+            return load(filename, compact, quantizePositions, verbose);
+        });
+
+        /* Each instance applies its own transformation to the shared data */
+        setTransform(trafo);
+
+        /* World space copies of transformed instances are not shared */
+        size_t privateSize = getPrivateMemoryUsage();
+        if (!loaded)
+            AssetCache::getInstance().addPrivateCopy(privateSize);
+        if (!loaded && verbose) {
+            cout << "Reusing \"" << filename << "\" ("
+                 << memString(m_data->getMemoryUsage() - std::min(privateSize, m_data->getMemoryUsage()))
+                 << " shared";
+            if (privateSize > 0)
+                cout << ", " << memString(privateSize) << " transformed copy";
+            cout << ")" << endl;
+        }
+        m_name = filename.str();
+    }
+
+protected:
+    /// Parse an OBJ file into a new set of object space vertex and index buffers
+    static std::shared_ptr<MeshData> load(const filesystem::path &filename,
+            bool compact, bool quantizePositions, bool verbose) {
+        typedef std::unordered_map<OBJVertex, uint32_t, OBJVertexHash> VertexMap;
 
         std::ifstream is(filename.str());
         if (is.fail())
             throw NoriException("Unable to open OBJ file \"%s\"!", filename);
-        Transform trafo = propList.getTransform("toWorld", Transform());
 
-        cout << "Loading \"" << filename << "\" .. ";
-        cout.flush();
+        if (verbose) {
+            cout << "Loading \"" << filename << "\" .. ";
+            cout.flush();
+        }
         Timer timer;
 
+        std::shared_ptr<MeshData> data = std::make_shared<MeshData>();
         std::vector<Vector3f>   positions;
         std::vector<Vector2f>   texcoords;
         std::vector<Vector3f>   normals;
@@ -61,8 +102,7 @@ public:
             if (prefix == "v") {
                 Point3f p;
                 line >> p.x() >> p.y() >> p.z();
-                p = trafo * p;
-                m_bbox.expandBy(p);
+                data->bbox.expandBy(p);
                 positions.push_back(p);
             } else if (prefix == "vt") {
                 Point2f tc;
@@ -71,7 +111,7 @@ public:
             } else if (prefix == "vn") {
                 Normal3f n;
                 line >> n.x() >> n.y() >> n.z();
-                normals.push_back((trafo * n).normalized());
+                normals.push_back(n.normalized());
             } else if (prefix == "f") {
                 std::string v1, v2, v3, v4;
                 line >> v1 >> v2 >> v3 >> v4;
@@ -104,34 +144,42 @@ public:
             }
         }
 
-        m_F.resize(3, indices.size()/3);
-        memcpy(m_F.data(), indices.data(), sizeof(uint32_t)*indices.size());
+        data->F.resize(3, indices.size()/3);
+        memcpy(data->F.data(), indices.data(), sizeof(uint32_t)*indices.size());
 
-        m_V.resize(3, vertices.size());
+        data->V.resize(3, vertices.size());
         for (uint32_t i=0; i<vertices.size(); ++i)
-            m_V.col(i) = positions.at(vertices[i].p-1);
+            data->V.col(i) = positions.at(vertices[i].p-1);
 
         if (!normals.empty()) {
-            m_N.resize(3, vertices.size());
+            data->N.resize(3, vertices.size());
             for (uint32_t i=0; i<vertices.size(); ++i)
-                m_N.col(i) = normals.at(vertices[i].n-1);
+                data->N.col(i) = normals.at(vertices[i].n-1);
         }
 
         if (!texcoords.empty()) {
-            m_UV.resize(2, vertices.size());
+            data->UV.resize(2, vertices.size());
             for (uint32_t i=0; i<vertices.size(); ++i)
-                m_UV.col(i) = texcoords.at(vertices[i].uv-1);
+                data->UV.col(i) = texcoords.at(vertices[i].uv-1);
         }
 
-        m_name = filename.str();
-        cout << "done. (V=" << m_V.cols() << ", F=" << m_F.cols() << ", took "
-             << timer.elapsedString() << " and "
-             << memString(m_F.size() * sizeof(uint32_t) +
-                          sizeof(float) * (m_V.size() + m_N.size() + m_UV.size()))
-             << ")" << endl;
+        /* Optionally switch to reduced-precision vertex attributes */
+        size_t fullSize = data->getMemoryUsage();
+        if (compact || quantizePositions)
+            data->compress(quantizePositions);
+
+        if (verbose) {
+            cout << "done. (V=" << data->getVertexCount() << ", F=" << data->F.cols() << ", took "
+                 << timer.elapsedString() << " and "
+                 << memString(data->getMemoryUsage());
+            if (data->getMemoryUsage() < fullSize)
+                cout << ", saved " << memString(fullSize - data->getMemoryUsage());
+            cout << ")" << endl;
+        }
+
+        return data;
     }
 
-protected:
     /// Vertex indices used by the OBJ format
     struct OBJVertex {
         uint32_t p = (uint32_t) -1;
@@ -0,0 +1,309 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/sdtree.h>
+#include <nori/roulette.h>
+#include <nori/lowdiscrepancy.h>
+#include <nori/timer.h>
+#include <pcg32.h>
+#include <tbb/tbb.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Path tracer with path guiding
+ *
+ * Extends the \c path_mis estimator: the direction at every non-specular
+ * vertex is drawn either from the BSDF (with probability
+ * \c bsdfSamplingFraction) or from a learned distribution of the incident
+ * radiance, and weighted with the density of the mixture (one-sample MIS).
+ * Light sampling is combined with this mixture under MIS as usual.
+ *
+ * The incident radiance distribution is an \ref SDTree that is trained in
+ * the preprocess step over \c trainingPasses passes with 1, 2, 4, ...
+ * samples per pixel. Each pass records the radiance estimates of its paths
+ * into the tree (in parallel) and the tree is refined afterwards; passes
+ * sample the distribution learned by the previous one. The final tree is
+ * used read-only for rendering. Its size is limited to \c maxMemory MB.
+ */
+class PathGuidedIntegrator : public Integrator {
+public:
+    PathGuidedIntegrator(const PropertyList &props) : m_roulette(props) {
+        /* Number of training passes; 0 disables guiding */
+        m_trainingPasses = props.getInteger("trainingPasses", 6);
+
+        /* Probability of sampling the BSDF instead of the guiding distribution */
+        m_bsdfSamplingFraction = props.getFloat("bsdfSamplingFraction", 0.5f);
+
+        /* Number of samples after which a spatial leaf is split (times sqrt(2^pass)) */
+        m_spatialThreshold = props.getFloat("spatialThreshold", 12000.0f);
+
+        /* Fraction of the energy above which a directional node is subdivided */
+        m_directionalThreshold = props.getFloat("directionalThreshold", 0.01f);
+
+        /* Memory budget of the guiding structure in megabytes */
+        m_maxMemory = props.getInteger("maxMemory", 64);
+
+        if (m_trainingPasses < 0 || m_maxMemory <= 0)
+            throw NoriException("PathGuidedIntegrator: invalid training parameters");
+        /* Without BSDF sampling, directions that the guiding distribution
+           has not learned (pdf 0) would never be sampled, which biases the
+           estimate */
+        if (m_bsdfSamplingFraction <= 0.0f || m_bsdfSamplingFraction > 1.0f)
+            throw NoriException("PathGuidedIntegrator: bsdfSamplingFraction must be in (0, 1]");
+    }
+
+    void preprocess(const Scene *scene) override {
+        m_sdTree.reset();
+        if (m_trainingPasses == 0)
+            return;
+
+        m_sdTree.reset(new SDTree(scene->getBoundingBox()));
+
+        const Camera *camera = scene->getCamera();
+        Vector2i size = camera->getOutputSize();
+
+        cout << "Training the guiding distribution .. ";
+        cout.flush();
+        Timer timer;
+
+        for (int pass = 0; pass < m_trainingPasses; ++pass) {
+            uint32_t spp = 1u << pass;
+            tbb::parallel_for(tbb::blocked_range<int>(0, size.y()),
+                [&](const tbb::blocked_range<int> &range) {
+                    for (int y = range.begin(); y != range.end(); ++y) {
+                        for (int x = 0; x < size.x(); ++x) {
+                            uint32_t seed = LowDiscrepancy::hashPixel(Point2i(x, y), (uint32_t) pass);
+                            pcg32 rng(seed, LowDiscrepancy::mix(seed));
+                            PathSampler sampler { rng };
+                            for (uint32_t s = 0; s < spp; ++s) {
+                                Ray3f ray;
+                                Point2f pixelSample = Point2f((float) x, (float) y) + sampler.next2D();
+                                Color3f value = camera->sampleRay(ray, pixelSample, sampler.next2D());
+                                if (!value.isZero())
+                                    trace(scene, &sampler, ray, true);
+                            }
+                        }
+                    }
+                }
+            );
+
+            m_sdTree->refine(m_spatialThreshold * std::sqrt((float) spp),
+                             m_directionalThreshold, (size_t) m_maxMemory * 1024 * 1024);
+        }
+
+        cout << "done. (took " << timer.elapsedString() << ", "
+             << m_sdTree->getLeafCount() << " spatial leaves, "
+             << memString(m_sdTree->getMemory()) << ")" << endl;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const override {
+        return trace(scene, sampler, ray, false);
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "PathGuidedIntegrator[trainingPasses = %i, bsdfSamplingFraction = %f, "
+            "spatialThreshold = %f, directionalThreshold = %f, maxMemory = %i, roulette = %s]",
+            m_trainingPasses, m_bsdfSamplingFraction, m_spatialThreshold,
+            m_directionalThreshold, m_maxMemory, m_roulette.toString()
+        );
+    }
+
+protected:
+    /// Adapter that lets the training passes draw from a random number generator
+    struct PathSampler {
+        pcg32 &rng;
+        float next1D() { return rng.nextFloat(); }
+        Point2f next2D() { float x = rng.nextFloat(); return Point2f(x, rng.nextFloat()); }
+    };
+
+    /// Path vertex whose incident radiance estimate is recorded in the tree
+    struct Vertex {
+        DTree *tree;          ///< Directional tree that records the estimate
+        Vector3f dir;         ///< Sampled direction (world space)
+        Color3f throughput;   ///< Path throughput including the sampled direction
+        Color3f radiance;     ///< Radiance that reached the camera through this vertex
+        float pdf;            ///< Density of the sampled direction
+    };
+
+    static const int MAX_VERTICES = 32;
+
+    /**
+     * \brief Trace a path and optionally record the incident radiance
+     * estimates of its vertices in the guiding structure
+     */
+    template <typename SamplerType>
+    Color3f trace(const Scene *scene, SamplerType *sampler, const Ray3f &ray, bool record) const {
+        Color3f color(0.0f);
+        Color3f attenuation(1.0f);
+        Ray3f currentRay = ray;
+        float w_mats = 1.0f;
+
+        Vertex vertices[MAX_VERTICES];
+        int vertexCount = 0;
+        auto addRadiance = [&](const Color3f &value) {
+            for (int i = 0; i < vertexCount; ++i)
+                vertices[i].radiance += value;
+        };
+
+        Intersection its;
+        if (!scene->rayIntersect(currentRay, its))
+            return color;
+
+        for (int depth = 0; ; ++depth) {
+            const BSDF *bsdf = its.mesh->getBSDF();
+
+            /* Emission found by the previous sampling step */
+            if (its.mesh->isEmitter()) {
+                EmitterQueryRecord eRec(currentRay.o, its.p(), its.shFrame().n);
+                Color3f Le = its.mesh->getEmitter()->eval(eRec);
+                /* The tree learns the same MIS-weighted estimate as the image,
+                   so that light sampling and emitter hits count the direct
+                   light only once */
+                Color3f emitted = attenuation * w_mats * Le;
+                color += emitted;
+                addRadiance(emitted);
+            }
+
+            const DTree *guide = nullptr;
+            if (m_sdTree && !bsdf->isDelta() && m_bsdfSamplingFraction < 1.0f)
+                guide = &m_sdTree->getLeaf(its.p()).sampling;
+
+            /* Emitter sampling, weighted against the mixture density */
+            float lightPdf = 0.0f;
+            const Emitter *light = scene->sampleEmitter(its.p(), sampler->next1D(), lightPdf);
+            Point2f lightSample = sampler->next2D();
+            if (light) {
+                EmitterQueryRecord eRec(its.p());
+                Color3f Li = light->sample(eRec, lightSample) / lightPdf;
+                float pdf_em = light->pdf(eRec) * lightPdf;
+
+                if (!Li.isZero() && !scene->rayIntersect(eRec.shadowRay)) {
+                    float theta = std::max(0.0f, Frame::cosTheta(its.toLocal(eRec.wi)));
+                    BSDFQueryRecord bRec(its.toLocal(-currentRay.d), its.toLocal(eRec.wi), ESolidAngle);
+                    bRec.uv = its.uv();
+                    Color3f brdf = bsdf->eval(bRec);
+                    float pdf_mat = mixturePdf(bsdf, guide, its, bRec);
+                    float w_ems = light->isDeltaPosition() ? 1.0f :
+                        (pdf_mat + pdf_em) > 0.0f ? pdf_em / (pdf_mat + pdf_em) : pdf_em;
+
+                    Color3f direct = attenuation * w_ems * brdf * theta * Li;
+                    color += direct;
+                    addRadiance(direct);
+                }
+            }
+
+            /* Russian roulette */
+            if (m_roulette.evaluate(attenuation, depth, sampler->next1D()) == 0)
+                break;
+
+            /* Sample the BSDF or the guiding distribution */
+            BSDFQueryRecord bRec(its.toLocal(-currentRay.d));
+            bRec.uv = its.uv();
+            Point2f sample = sampler->next2D();
+            Color3f weight;
+            float pdf_mat;
+            if (!guide) {
+                weight = bsdf->sample(bRec, sample);
+                pdf_mat = bsdf->pdf(bRec);
+            } else {
+                if (sampler->next1D() < m_bsdfSamplingFraction) {
+                    if (bsdf->sample(bRec, sample).isZero())
+                        break;
+                } else {
+                    bRec.wo = its.toLocal(guide->sample(sample));
+                    bRec.measure = ESolidAngle;
+                }
+                pdf_mat = mixturePdf(bsdf, guide, its, bRec);
+                float cosTheta = std::max(0.0f, Frame::cosTheta(bRec.wo));
+                if (pdf_mat <= 0.0f || cosTheta <= 0.0f)
+                    break;
+                weight = bsdf->eval(bRec) * cosTheta / pdf_mat;
+            }
+            if (weight.isZero())
+                break;
+            attenuation *= weight;
+
+            currentRay = Ray3f(its.p(), its.toWorld(bRec.wo));
+
+            if (record && guide && vertexCount < MAX_VERTICES) {
+                Vertex &v = vertices[vertexCount++];
+                v.tree = &m_sdTree->getLeaf(its.p()).building;
+                v.dir = currentRay.d;
+                v.throughput = attenuation;
+                v.radiance = Color3f(0.0f);
+                v.pdf = pdf_mat;
+            }
+
+            Point3f origin = its.p();
+            if (!scene->rayIntersect(currentRay, its))
+                break;
+
+            w_mats = 1.0f;
+            if (bRec.measure != EDiscrete && its.mesh->isEmitter()) {
+                EmitterQueryRecord eRec(origin, its.p(), its.shFrame().n);
+                const Emitter *emitter = its.mesh->getEmitter();
+                float pdf_em = emitter->pdf(eRec) * scene->pdfEmitter(origin, emitter);
+                w_mats = pdf_mat + pdf_em > 0.f ? pdf_mat / (pdf_mat + pdf_em) : pdf_mat;
+            }
+        }
+
+        /* Record the incident radiance estimates (divided by their density) */
+        for (int i = 0; i < vertexCount; ++i) {
+            const Vertex &v = vertices[i];
+            Color3f Li(0.0f);
+            for (int c = 0; c < 3; ++c) {
+                if (v.throughput[c] > 0.0f)
+                    Li[c] = v.radiance[c] / v.throughput[c];
+            }
+            v.tree->record(v.dir, Li.getLuminance() / v.pdf);
+        }
+
+        return color;
+    }
+
+    /// Density of the mixture of BSDF and guided sampling
+    float mixturePdf(const BSDF *bsdf, const DTree *guide, const Intersection &its,
+                     const BSDFQueryRecord &bRec) const {
+        float bsdfPdf = bsdf->pdf(bRec);
+        if (!guide)
+            return bsdfPdf;
+        return m_bsdfSamplingFraction * bsdfPdf +
+            (1.0f - m_bsdfSamplingFraction) * guide->pdf(its.toWorld(bRec.wo));
+    }
+
+private:
+    int m_trainingPasses;
+    float m_bsdfSamplingFraction;
+    float m_spatialThreshold;
+    float m_directionalThreshold;
+    int m_maxMemory;
+    RussianRoulette m_roulette;
+    std::unique_ptr<SDTree> m_sdTree;
+};
+
+NORI_REGISTER_CLASS(PathGuidedIntegrator, "path_guided");
+NORI_NAMESPACE_END
@@ -0,0 +1,492 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/block.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/lowdiscrepancy.h>
+#include <nori/ris.h>
+#include <nori/roulette.h>
+#include <nori/timer.h>
+#include <pcg32.h>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Wavefront variant of the \c path_mis integrator
+ *
+ * Instead of following one path at a time, all camera paths of an image
+ * block advance together in stages: generate camera rays, extend (find the
+ * closest hits), sort the hits by BSDF, shade (emission, light sampling,
+ * Russian roulette and BSDF sampling) and trace the queued shadow rays as
+ * one batch. The path state is kept in structure-of-arrays buffers.
+ *
+ * The estimator (MIS weights, light selection and Russian roulette) is the
+ * same as in \c path_mis, so both integrators converge to the same image.
+ * After the camera ray, each path draws its random numbers from its own
+ * generator that is seeded by the block sampler.
+ *
+ * Extension and shadow rays are traced in packets of \ref BVH::PacketSize
+ * rays (see \ref BVH::rayIntersectPacket()). The camera paths of a block
+ * are ordered by 4x4 pixel tiles, so the first extension packets are
+ * coherent; later bounces are packed in the order of the surviving paths.
+ * This integrator is currently the only user of packet traversal. Setting
+ * \c packetReport measures the primary ray throughput of packet and
+ * single-ray traversal before rendering.
+ *
+ * Direct illumination resamples \c lightCandidates light samples per
+ * vertex (see \ref sampleLightCandidates()). When \c spatialReuse is
+ * positive, the reservoirs of the camera hits are additionally merged with
+ * those of as many random neighboring pixels within \c reuseRadius pixels
+ * of the block before their shadow rays are traced. Neighbor samples are
+ * re-evaluated at the receiving hit point in primary sample space, and the
+ * merged weight only counts neighbors that could have produced the chosen
+ * sample, so the reuse does not bias the estimate.
+ */
+class PathWavefrontIntegrator : public Integrator {
+public:
+    PathWavefrontIntegrator(const PropertyList &props) : m_roulette(props) {
+        /* Sort the hit points by BSDF before shading */
+        m_sortByBSDF = props.getBoolean("sortByBSDF", true);
+
+        /* Trace rays in coherent packets instead of one at a time */
+        m_packets = props.getBoolean("packets", true);
+
+        /* Compare the packet and single-ray throughput in the preprocess step */
+        m_packetReport = props.getBoolean("packetReport", false);
+
+        /* Number of light samples that are resampled for each shadow ray */
+        m_lightCandidates = props.getInteger("lightCandidates", 1);
+        if (m_lightCandidates < 1)
+            throw NoriException("PathWavefrontIntegrator: lightCandidates must be at least 1");
+
+        /* Number of neighboring pixels whose light samples are reused at camera hits */
+        m_spatialReuse = props.getInteger("spatialReuse", 0);
+
+        /* Radius (in pixels) of the neighborhood used for spatial reuse */
+        m_reuseRadius = props.getInteger("reuseRadius", 8);
+        if (m_spatialReuse < 0 || m_reuseRadius < 1)
+            throw NoriException("PathWavefrontIntegrator: invalid spatial reuse parameters");
+    }
+
+    void preprocess(const Scene *scene) override {
+        if (!m_packetReport)
+            return;
+
+        /* One ray through the center of every pixel, in packets of 4x4 pixels */
+        const Camera *camera = scene->getCamera();
+        Vector2i size = camera->getOutputSize();
+        std::vector<Ray3f> rays;
+        rays.reserve((size_t) size.x() * size.y());
+        for (int by = 0; by < size.y(); by += 4) {
+            for (int bx = 0; bx < size.x(); bx += 4) {
+                for (int y = by; y < std::min(by + 4, size.y()); ++y) {
+                    for (int x = bx; x < std::min(bx + 4, size.x()); ++x) {
+                        Ray3f ray;
+                        camera->sampleRay(ray, Point2f(x + 0.5f, y + 0.5f), Point2f(0.5f));
+                        rays.push_back(ray);
+                    }
+                }
+            }
+        }
+
+        const int repetitions = 8;
+        std::vector<Intersection> its(rays.size());
+        size_t scalarHits = 0, packetHits = 0;
+
+        Timer timer;
+        for (int r = 0; r < repetitions; ++r) {
+            scalarHits = 0;
+            for (size_t i = 0; i < rays.size(); ++i)
+                scalarHits += scene->rayIntersect(rays[i], its[i]) ? 1 : 0;
+        }
+        double scalarTime = std::max(timer.lap(), 1.0);
+
+        for (int r = 0; r < repetitions; ++r) {
+            packetHits = 0;
+            for (size_t i = 0; i < rays.size(); i += BVH::PacketSize) {
+                uint32_t count = (uint32_t) std::min(rays.size() - i, (size_t) BVH::PacketSize);
+                uint32_t mask = scene->rayIntersectPacket(&rays[i], &its[i], count);
+                for (uint32_t j = 0; j < count; ++j)
+                    packetHits += (mask >> j) & 1;
+            }
+        }
+        double packetTime = std::max(timer.lap(), 1.0);
+
+        double numRays = (double) rays.size() * repetitions;
+        cout << tfm::format("Primary rays: single-ray %.2f Mrays/s, packets %.2f Mrays/s "
+            "(speedup %.2fx, %d/%d hits)",
+            numRays / (scalarTime * 1000.0), numRays / (packetTime * 1000.0),
+            scalarTime / packetTime, packetHits, scalarHits) << endl;
+    }
+
+    /// Structure-of-arrays state of the paths of one block
+    struct PathQueue {
+        /* Per path state */
+        std::vector<Ray3f> ray;
+        std::vector<Intersection> its;
+        std::vector<Color3f> weight;       // Camera importance weight
+        std::vector<Color3f> throughput;   // Path throughput (attenuation)
+        std::vector<Color3f> radiance;     // Accumulated radiance
+        std::vector<Point2f> pixelSample;  // Image plane position
+        std::vector<float> pdfMat;         // Density of the last BSDF sample
+        std::vector<uint8_t> discrete;     // Was the last BSDF sample discrete?
+        std::vector<pcg32> rng;
+
+        /* Light reservoirs of the camera hits, for spatial reuse */
+        int width = 0, height = 0;         // Pixel grid of the paths (if any)
+        std::vector<uint32_t> gridIndex;   // Pixel of every path within the grid
+        std::vector<uint32_t> pathAt;      // Path of every pixel of the grid
+        std::vector<Reservoir<LightSample>> reservoir;
+        std::vector<uint8_t> hasReservoir;
+        std::vector<LightSample> reusedSample;
+        std::vector<float> reusedWeight;
+
+        /* Indices of the paths that are still alive */
+        std::vector<uint32_t> active;
+
+        /* Shadow ray batch of the current bounce */
+        std::vector<Ray3f> shadowRay;
+        std::vector<Color3f> shadowValue;
+        std::vector<uint32_t> shadowPath;
+
+        void reserve(size_t size) {
+            ray.reserve(size); its.reserve(size); weight.reserve(size);
+            throughput.reserve(size); radiance.reserve(size);
+            pixelSample.reserve(size); pdfMat.reserve(size);
+            discrete.reserve(size); rng.reserve(size); active.reserve(size);
+            shadowRay.reserve(size); shadowValue.reserve(size); shadowPath.reserve(size);
+        }
+
+        /// Append a camera path
+        void push(const Ray3f &r, const Color3f &w, const Point2f &sample, uint64_t seed) {
+            active.push_back((uint32_t) ray.size());
+            ray.push_back(r);
+            its.push_back(Intersection());
+            weight.push_back(w);
+            throughput.push_back(Color3f(1.0f));
+            radiance.push_back(Color3f(0.0f));
+            pixelSample.push_back(sample);
+            pdfMat.push_back(0.0f);
+            discrete.push_back(1);
+            rng.push_back(pcg32(seed, seed >> 32));
+        }
+    };
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const override {
+        /* Single path fallback, e.g. for cameras tracing all color channels */
+        PathQueue queue;
+        queue.push(ray, Color3f(1.0f), Point2f(0.0f), makeSeed(sampler));
+        trace(scene, queue);
+        return queue.radiance[0];
+    }
+
+    bool renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) const override {
+        const Camera *camera = scene->getCamera();
+        if (camera->hasChromaticAberrations() && camera->tracesAllChannels())
+            return false;
+
+        Point2i offset = block.getOffset();
+        Vector2i size = block.getSize();
+
+        /* Stage 1: generate the camera rays. The paths are ordered by 4x4
+           pixel tiles, so that the camera rays of a packet are coherent. */
+        PathQueue queue;
+        size_t pixelCount = (size_t) size.x() * size.y();
+        queue.reserve(pixelCount);
+        queue.width = size.x();
+        queue.height = size.y();
+        queue.gridIndex.reserve(pixelCount);
+        queue.pathAt.resize(pixelCount);
+        for (int ty = 0; ty < size.y(); ty += 4) {
+            for (int tx = 0; tx < size.x(); tx += 4) {
+                for (int y = ty; y < std::min(ty + 4, size.y()); ++y) {
+                    for (int x = tx; x < std::min(tx + 4, size.x()); ++x) {
+                        Point2i pixel(x + offset.x(), y + offset.y());
+                        sampler->generate(pixel);
+
+                        Point2f pixelSample = pixel.cast<float>() + sampler->next2D();
+                        Point2f apertureSample = sampler->next2D();
+
+                        Ray3f ray;
+                        Color3f value;
+                        if (camera->hasChromaticAberrations()) {
+                            /* Trace one randomly chosen color channel */
+                            int channel = std::min((int) (sampler->next1D() * 3), 2);
+                            value = camera->sampleRay(ray, pixelSample, apertureSample,
+                                                      channel) * 3.0f;
+                        } else {
+                            value = camera->sampleRay(ray, pixelSample, apertureSample);
+                        }
+                        queue.pathAt[y * size.x() + x] = (uint32_t) queue.ray.size();
+                        queue.gridIndex.push_back((uint32_t) (y * size.x() + x));
+                        queue.push(ray, value, pixelSample, makeSeed(sampler));
+
+                        sampler->advance();
+                    }
+                }
+            }
+        }
+
+        trace(scene, queue);
+
+        for (size_t i = 0; i < queue.ray.size(); ++i)
+            block.put(queue.pixelSample[i], queue.weight[i] * queue.radiance[i]);
+
+        return true;
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "PathWavefrontIntegrator[sortByBSDF = %s, packets = %s, lightCandidates = %i, "
+            "spatialReuse = %i, reuseRadius = %i, roulette = %s]",
+            m_sortByBSDF ? "true" : "false",
+            m_packets ? "true" : "false",
+            m_lightCandidates, m_spatialReuse, m_reuseRadius,
+            m_roulette.toString()
+        );
+    }
+
+protected:
+    /// Adapter that lets the resampling helpers draw from a path's generator
+    struct PathSampler {
+        pcg32 &rng;
+        float next1D() { return rng.nextFloat(); }
+        Point2f next2D() { float x = rng.nextFloat(); return Point2f(x, rng.nextFloat()); }
+    };
+
+    /**
+     * \brief Resample the light reservoirs of all camera hits with those of
+     * random neighboring pixels
+     *
+     * Stores the chosen sample (evaluated at the receiving hit point) and its
+     * contribution weight in \c reusedSample and \c reusedWeight.
+     */
+    void reuseSpatially(const Scene *scene, PathQueue &q) const {
+        size_t n = q.ray.size();
+        q.reservoir.assign(n, Reservoir<LightSample>());
+        q.hasReservoir.assign(n, 0);
+        q.reusedSample.assign(n, LightSample());
+        q.reusedWeight.assign(n, 0.0f);
+
+        /* Initial candidates of every camera hit */
+        for (uint32_t i : q.active) {
+            PathSampler sampler{q.rng[i]};
+            q.reservoir[i] = sampleLightCandidates(scene, q.its[i],
+                q.its[i].toLocal(-q.ray[i].d), &sampler, m_lightCandidates);
+            q.hasReservoir[i] = 1;
+        }
+
+        std::vector<uint32_t> neighbors;
+        for (uint32_t i : q.active) {
+            const Intersection &its = q.its[i];
+            Vector3f wi = its.toLocal(-q.ray[i].d);
+            pcg32 &rng = q.rng[i];
+            const Reservoir<LightSample> &own = q.reservoir[i];
+
+            Reservoir<LightSample> merged;
+            merged.update(own.sample, own.wSum, own.targetPdf, rng.nextFloat(), own.M);
+
+            /* Merge the reservoirs of random neighbors within the block */
+            neighbors.clear();
+            int x = (int) (q.gridIndex[i] % q.width), y = (int) (q.gridIndex[i] / q.width);
+            for (int k = 0; k < m_spatialReuse; ++k) {
+                int nx = x + (int) (rng.nextUInt(2 * m_reuseRadius + 1)) - m_reuseRadius;
+                int ny = y + (int) (rng.nextUInt(2 * m_reuseRadius + 1)) - m_reuseRadius;
+                if (nx < 0 || ny < 0 || nx >= q.width || ny >= q.height)
+                    continue;
+                uint32_t j = q.pathAt[ny * q.width + nx];
+                if (j == i || !q.hasReservoir[j] ||
+                    std::find(neighbors.begin(), neighbors.end(), j) != neighbors.end())
+                    continue;
+
+                const Reservoir<LightSample> &other = q.reservoir[j];
+                LightSample s = other.sample;
+                float target = evalLightSample(scene, its, wi, s);
+                merged.update(s, target * other.getWeight() * other.M, target,
+                              rng.nextFloat(), other.M);
+                neighbors.push_back(j);
+            }
+
+            /* Count the candidates that could have produced the chosen sample */
+            uint32_t Z = merged.targetPdf > 0.0f ? own.M : 0;
+            for (uint32_t j : neighbors) {
+                LightSample s = merged.sample;
+                if (evalLightSample(scene, q.its[j], q.its[j].toLocal(-q.ray[j].d), s) > 0.0f)
+                    Z += q.reservoir[j].M;
+            }
+
+            q.reusedSample[i] = merged.sample;
+            q.reusedWeight[i] = merged.getWeight(Z);
+        }
+    }
+
+    /// Derive the seed of a per-path random number generator
+    static uint64_t makeSeed(Sampler *sampler) {
+        uint32_t a = (uint32_t) (sampler->next1D() * 4294967296.0);
+        uint32_t b = (uint32_t) (sampler->next1D() * 4294967296.0);
+        return ((uint64_t) LowDiscrepancy::mix(a) << 32) |
+            LowDiscrepancy::hashCombine(a, b);
+    }
+
+    /// Advance all paths of the queue until they are terminated
+    void trace(const Scene *scene, PathQueue &q) const {
+        bool first = true;
+        int depth = 0;
+
+        while (!q.active.empty()) {
+            /* Stage 2: extend, i.e. find the closest hit of every path */
+            size_t alive = 0;
+            if (m_packets) {
+                Ray3f rays[BVH::PacketSize];
+                Intersection its[BVH::PacketSize];
+                for (size_t start = 0; start < q.active.size(); start += BVH::PacketSize) {
+                    uint32_t count = (uint32_t) std::min(q.active.size() - start,
+                                                         (size_t) BVH::PacketSize);
+                    for (uint32_t j = 0; j < count; ++j)
+                        rays[j] = q.ray[q.active[start + j]];
+                    uint32_t mask = scene->rayIntersectPacket(rays, its, count);
+                    for (uint32_t j = 0; j < count; ++j) {
+                        if (!(mask & (1u << j)))
+                            continue;
+                        uint32_t i = q.active[start + j];
+                        q.its[i] = its[j];
+                        q.active[alive++] = i;
+                    }
+                }
+            } else {
+                for (uint32_t i : q.active) {
+                    if (!scene->rayIntersect(q.ray[i], q.its[i]))
+                        continue;
+                    q.active[alive++] = i;
+                }
+            }
+            q.active.resize(alive);
+
+            /* Stage 3: group the hit points by BSDF for coherent shading */
+            if (m_sortByBSDF) {
+                std::stable_sort(q.active.begin(), q.active.end(),
+                    [&](uint32_t a, uint32_t b) {
+                        return q.its[a].mesh->getBSDF() < q.its[b].mesh->getBSDF();
+                    });
+            }
+
+            /* Stage 4: shade the hit points and sample the next directions */
+            q.shadowRay.clear();
+            q.shadowValue.clear();
+            q.shadowPath.clear();
+            bool reuse = first && m_spatialReuse > 0 && q.width > 0;
+            if (reuse)
+                reuseSpatially(scene, q);
+
+            alive = 0;
+            for (uint32_t i : q.active) {
+                const Intersection &its = q.its[i];
+                const BSDF *bsdf = its.mesh->getBSDF();
+                const Ray3f &ray = q.ray[i];
+                pcg32 &rng = q.rng[i];
+
+                /* Emission found by BSDF sampling (or by the camera ray) */
+                if (its.mesh->isEmitter()) {
+                    const Emitter *emitter = its.mesh->getEmitter();
+                    EmitterQueryRecord eRec(ray.o, its.p(), its.shFrame().n);
+                    float w_mats = 1.0f;
+                    if (!first && !q.discrete[i]) {
+                        float pdf_em = emitter->pdf(eRec) * scene->pdfEmitter(ray.o, emitter);
+                        w_mats = q.pdfMat[i] + pdf_em > 0.f ?
+                            q.pdfMat[i] / (q.pdfMat[i] + pdf_em) : q.pdfMat[i];
+                    }
+                    q.radiance[i] += q.throughput[i] * w_mats * emitter->eval(eRec);
+                }
+
+                /* Emitter sampling: queue a shadow ray for the resampled light sample */
+                LightSample lightSample;
+                float lightWeight;
+                if (reuse) {
+                    lightSample = q.reusedSample[i];
+                    lightWeight = q.reusedWeight[i];
+                } else {
+                    PathSampler sampler{rng};
+                    Reservoir<LightSample> reservoir = sampleLightCandidates(scene, its,
+                        its.toLocal(-ray.d), &sampler, m_lightCandidates);
+                    lightSample = reservoir.sample;
+                    lightWeight = reservoir.getWeight();
+                }
+                Color3f value = q.throughput[i] * lightSample.value * lightWeight;
+                if (!value.isZero()) {
+                    q.shadowRay.push_back(lightSample.eRec.shadowRay);
+                    q.shadowValue.push_back(value);
+                    q.shadowPath.push_back(i);
+                }
+
+                /* Russian roulette */
+                if (m_roulette.evaluate(q.throughput[i], depth, rng.nextFloat()) == 0)
+                    continue;
+
+                /* BSDF sampling */
+                BSDFQueryRecord bRec(its.shFrame().toLocal(-ray.d));
+                bRec.uv = its.uv();
+                q.throughput[i] *= bsdf->sample(bRec, Point2f(rng.nextFloat(), rng.nextFloat()));
+                q.pdfMat[i] = bsdf->pdf(bRec);
+                q.discrete[i] = bRec.measure == EDiscrete;
+                q.ray[i] = Ray3f(its.p(), its.toWorld(bRec.wo));
+
+                q.active[alive++] = i;
+            }
+            q.active.resize(alive);
+
+            /* Stage 5: trace the shadow rays as one batch */
+            if (m_packets) {
+                for (size_t start = 0; start < q.shadowRay.size(); start += BVH::PacketSize) {
+                    uint32_t count = (uint32_t) std::min(q.shadowRay.size() - start,
+                                                         (size_t) BVH::PacketSize);
+                    uint32_t occluded = scene->rayIntersectPacket(&q.shadowRay[start], count);
+                    for (uint32_t j = 0; j < count; ++j) {
+                        if (!(occluded & (1u << j)))
+                            q.radiance[q.shadowPath[start + j]] += q.shadowValue[start + j];
+                    }
+                }
+            } else {
+                for (size_t j = 0; j < q.shadowRay.size(); ++j) {
+                    if (!scene->rayIntersect(q.shadowRay[j]))
+                        q.radiance[q.shadowPath[j]] += q.shadowValue[j];
+                }
+            }
+
+            first = false;
+            ++depth;
+        }
+    }
+
+private:
+    bool m_sortByBSDF;
+    bool m_packets;
+    bool m_packetReport;
+    int m_lightCandidates;
+    int m_spatialReuse;
+    int m_reuseRadius;
+    RussianRoulette m_roulette;
+};
+
+NORI_REGISTER_CLASS(PathWavefrontIntegrator, "path_wavefront");
+NORI_NAMESPACE_END
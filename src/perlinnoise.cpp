@@ -23,7 +23,7 @@ public:
 
     virtual Point3f getCentroid(uint32_t index) const override { return m_position; }
 
-    virtual bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const override {
+    virtual bool rayIntersect(uint32_t &index, const Ray3f &ray, float &u, float &v, float &t) const override {
         Vector3f oc = ray.o - m_position;
 
         float a = ray.d.dot(ray.d);
@@ -60,20 +60,25 @@ public:
         return false;
     }
 
-    virtual void setHitInformation(uint32_t index, const Ray3f &ray, Intersection &its) const override {
-        Point3f intersectionPoint = ray(its.t);
-        its.p = intersectionPoint;
+    virtual void setHitInformation(const Intersection &its, uint32_t fields) const override {
+        Point3f intersectionPoint = its.rayOrigin + its.t * its.rayDirection;
+        its.setP(intersectionPoint);
+
+        if (!(fields & (Intersection::EUV | Intersection::EGeoFrame | Intersection::EShFrame)))
+            return;
 
         Vector3f n = (intersectionPoint - m_position).normalized();
         
         Frame frame = Frame(n);
-        its.shFrame = frame;
-        its.geoFrame = frame;
-
-        Point2f coords = sphericalCoordinates(n);
-        coords[0] = 0.5 + coords[0] * (INV_TWOPI);
-        coords[1] *= INV_PI;
-        its.uv = coords;
+        its.setShFrame(frame);
+        its.setGeoFrame(frame);
+
+        if (fields & Intersection::EUV) {
+            Point2f coords = sphericalCoordinates(n);
+            coords[0] = 0.5 + coords[0] * (INV_TWOPI);
+            coords[1] *= INV_PI;
+            its.setUV(coords);
+        }
     }
 
     virtual void sampleSurface(ShapeQueryRecord &sRec, const Point2f &sample) const override {
@@ -22,6 +22,17 @@
 #include <nori/bsdf.h>
 #include <nori/scene.h>
 #include <nori/photon.h>
+#include <nori/lowdiscrepancy.h>
+#include <nori/timer.h>
+#include <nori/mesh.h>
+#include <nori/mmap.h>
+#include <nori/roulette.h>
+#include <filesystem/resolver.h>
+#include <pcg32.h>
+#include <tbb/tbb.h>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
 
 NORI_NAMESPACE_BEGIN
 
@@ -31,89 +42,121 @@ public:
     /// Photon map data structure
     typedef PointKDTree<Photon> PhotonMap;
 
-    PhotonMapper(const PropertyList &props)
+    PhotonMapper(const PropertyList &props) : m_roulette(props, 0.99f)
     {
         /* Lookup parameters */
         m_photonCount = props.getInteger("photonCount", 1000000);
         m_photonRadius = props.getFloat("photonRadius", 0.0f /* Default: automatic */);
+
+        /* Number of nearest photons used for the density estimate; 0 uses all
+           photons within photonRadius, otherwise photonRadius (if given)
+           bounds the adaptive radius */
+        m_photonNeighbors = props.getInteger("photonNeighbors", 0);
+        if (m_photonNeighbors < 0 || m_photonNeighbors > MAX_PHOTON_NEIGHBORS)
+            throw NoriException("PhotonMapper: photonNeighbors must be in [0, %i]", MAX_PHOTON_NEIGHBORS);
+
+        /* Directory in which built photon maps are stored and reused by later
+           runs with the same geometry, lights and photon count (empty: off) */
+        m_photonCache = props.getString("photonCache", "");
     }
 
     virtual void preprocess(const Scene *scene) override
     {
-        cout << "Gathering " << m_photonCount << " photons .. ";
-        cout.flush();
-
-        /* Create a sample generator for the preprocess step */
-        Sampler *sampler = static_cast<Sampler *>(
-            NoriObjectFactory::createInstance("independent", PropertyList()));
-
         /* Allocate memory for the photon map */
         m_photonMap = std::unique_ptr<PhotonMap>(new PhotonMap());
-        m_photonMap->reserve(m_photonCount);
+        m_photonMapFile.reset();
+        m_emittedCount = 0;
 
         /* Estimate a default photon radius */
+        m_maxSearchRadius = m_photonRadius > 0 ? m_photonRadius : std::numeric_limits<float>::infinity();
         if (m_photonRadius == 0)
             m_photonRadius = scene->getBoundingBox().getExtents().norm() / 500.0f;
 
-        /* How to add a photon?
-         * m_photonMap->push_back(Photon(
-         *	Point3f(0, 0, 0),  // Position
-         *	Vector3f(0, 0, 1), // Direction
-         *	Color3f(1, 2, 3)   // Power
-         * ));
-         */
-
-        // Trace each photon
-        while (true)
+        /* Reuse a photon map from the cache if there is one for this scene */
+        std::string cacheFilename;
+        uint64_t cacheKey = 0;
+        if (!m_photonCache.empty())
         {
+            filesystem::path directory(m_photonCache);
+            if (!directory.is_absolute())
+                directory = getFileResolver()->resolve(directory);
+            if (!directory.is_directory())
+                throw NoriException("PhotonMapper: the photon cache directory \"%s\" does not exist", m_photonCache);
+            cacheKey = computeCacheKey(scene);
+            cacheFilename = (directory / filesystem::path(tfm::format("photons_%016x.pmap", cacheKey))).str();
+            if (loadPhotonMap(cacheFilename, cacheKey))
+                return;
+        }
 
-            // Get an emitter
-            const Emitter *light = scene->getRandomEmitter(sampler->next1D());
-
-            // Start the tracing
-            Ray3f currentRay;
-            Color3f power = light->samplePhoton(currentRay, sampler->next2D(), sampler->next2D()) * scene->getLights().size();
-
-            // Continue until the the Russian Roulette breaks
-            while (true)
-            {
-
-                // Check if there is an intersection
-                Intersection its;
-                if (!scene->rayIntersect(currentRay, its))
-                    break;
-
-                // If we hit a diffuse surface ==> Store the photon
-                if (its.mesh->getBSDF()->isDiffuse())
-                {
-                    m_photonMap->push_back(Photon(its.p, -currentRay.d, power));
-
-                    // Return if the map is full
-                    if(m_photonMap->size() == m_photonCount) {
-                        return;
-                    }               
+        cout << "Gathering " << m_photonCount << " photons .. ";
+        cout.flush();
+        Timer timer;
+
+        /* Photons are traced in batches of paths with their own random number
+           streams. Each round traces a number of batches in parallel, and the
+           batches are appended in order until the map is full, so that the
+           result does not depend on thread scheduling. */
+        std::vector<PhotonBatch> batches(PHOTON_BATCHES_PER_ROUND);
+        std::vector<size_t> offsets(PHOTON_BATCHES_PER_ROUND);
+        size_t photonCount = (size_t) m_photonCount;
+        size_t stored = 0;
+        uint32_t batchIndex = 0;
+
+        while (stored < photonCount && !scene->getLights().empty()) {
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, batches.size(), 1),
+                [&](const tbb::blocked_range<size_t> &range) {
+                    for (size_t i = range.begin(); i != range.end(); ++i)
+                        tracePhotons(scene, batchIndex + (uint32_t) i, batches[i]);
                 }
-
-                // Perform Russian Roulette
-                float probability = std::min(power.x(), 0.99f);
-                if (sampler->next1D() > probability)
-                {
-                    break;
+            );
+            batchIndex += (uint32_t) batches.size();
+
+            /* Determine which batches (and paths) are needed to fill the map */
+            size_t used = 0;
+            for (; used < batches.size() && stored < photonCount; ++used) {
+                PhotonBatch &batch = batches[used];
+                offsets[used] = stored;
+                if (stored + batch.photons.size() <= photonCount) {
+                    stored += batch.photons.size();
+                    m_emittedCount += batch.pathEnds.size();
+                } else {
+                    /* Stop after the path that fills the map */
+                    size_t path = 0;
+                    while (stored + batch.pathEnds[path] < photonCount)
+                        ++path;
+                    batch.photons.resize(photonCount - stored);
+                    stored = photonCount;
+                    m_emittedCount += path + 1;
                 }
-                power /= probability;
+            }
 
-                // Sample the brdf
-                BSDFQueryRecord bRec(its.toLocal(-currentRay.d));
-                Color3f brdf = its.mesh->getBSDF()->sample(bRec, sampler->next2D());
-                power *= brdf;
+            /* Append the photons of the used batches */
+            size_t previous = m_photonMap->size();
+            m_photonMap->resize(stored);
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, used, 1),
+                [&](const tbb::blocked_range<size_t> &range) {
+                    for (size_t i = range.begin(); i != range.end(); ++i)
+                        std::copy(batches[i].photons.begin(), batches[i].photons.end(),
+                                  &(*m_photonMap)[offsets[i]]);
+                }
+            );
 
-                // Continue the recursion
-                currentRay = Ray3f(its.p, its.toWorld(bRec.wo));
+            /* Give up if no path reaches a diffuse surface */
+            if (stored == previous) {
+                cout << "no photons were deposited .. ";
+                break;
             }
         }
 
+        cout << "done. (took " << timer.elapsedString() << ", "
+             << m_emittedCount << " photons emitted)" << endl;
+
         /* Build the photon map */
-        m_photonMap->build();
+        if (m_photonMap->size() > 0)
+            m_photonMap->build(true);
+
+        if (!cacheFilename.empty())
+            savePhotonMap(cacheFilename, cacheKey);
     }
 
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &_ray) const override
@@ -142,7 +185,7 @@ public:
         Ray3f currentRay = _ray;
 
         // Continue until the Russian Roulette says stop
-        while (true)
+        for (int depth = 0; ; ++depth)
         {
             Intersection its;
             // If the ray has no intersection we can return the black color;
@@ -152,46 +195,30 @@ public:
             // We add the Le part to the record if the mesh is an emitter
             if (its.mesh->isEmitter())
             {
-                EmitterQueryRecord rec(currentRay.o, its.p, its.shFrame.n);
+                EmitterQueryRecord rec(currentRay.o, its.p(), its.shFrame().n);
                 color += attenuation * its.mesh->getEmitter()->eval(rec);
             }
 
             // If we are facing a diffuse surface, we can return the value given by the photons
             if (its.mesh->getBSDF()->isDiffuse())
             {
-
-                // Retrieve the photon list
-                std::vector<uint32_t> results;
-                m_photonMap->search(its.p, m_photonRadius, results);
-                Color3f photonColor = BLACK;
-
-                // Compute value for each photon
-                for (auto idx : results)
-                {
-                    const Photon &p = (*m_photonMap)[idx];
-                    BSDFQueryRecord bRec(its.shFrame.toLocal(-currentRay.d), its.shFrame.toLocal(p.getDirection()), ESolidAngle);
-                    photonColor += its.mesh->getBSDF()->eval(bRec) * p.getPower();
-                }
-
                 // Return estimated density
-                return color + attenuation * (photonColor * INV_PI / (m_photonRadius * m_photonRadius * m_photonCount));
+                return color + attenuation * estimateRadiance(its, -currentRay.d);
             }
 
             // Update the russian roulette
-            float probability = std::min(attenuation.x(), 0.99f);
-            if (sampler->next1D() > probability)
+            if (m_roulette.evaluate(attenuation, depth, sampler->next1D()) == 0)
             {
                 return color;
             }
-            attenuation /= probability;
 
             // Sample the BRDF
-            BSDFQueryRecord bRec(its.shFrame.toLocal(-currentRay.d));
+            BSDFQueryRecord bRec(its.shFrame().toLocal(-currentRay.d));
             Color3f brdf = its.mesh->getBSDF()->sample(bRec, sampler->next2D());
             attenuation *= brdf;
 
             // Continue the recursion
-            currentRay = Ray3f(its.p, its.toWorld(bRec.wo));
+            currentRay = Ray3f(its.p(), its.toWorld(bRec.wo));
         }
     }
 
@@ -200,20 +227,331 @@ public:
         return tfm::format(
             "PhotonMapper[\n"
             "  photonCount = %i,\n"
-            "  photonRadius = %f\n"
+            "  photonRadius = %f,\n"
+            "  photonNeighbors = %i,\n"
+            "  photonCache = \"%s\",\n"
+            "  roulette = %s\n"
             "]",
             m_photonCount,
-            m_photonRadius);
+            m_photonRadius,
+            m_photonNeighbors,
+            m_photonCache,
+            m_roulette.toString());
+    }
+
+protected:
+    /// Upper bound of the photonNeighbors parameter (size of the query buffer)
+    enum { MAX_PHOTON_NEIGHBORS = 1024 };
+
+    /**
+     * \brief Estimate the reflected radiance from the photon density
+     *
+     * The photons are accumulated while the kd-tree is traversed (or from a
+     * fixed-size buffer in the k-nearest-neighbor mode), so a query does not
+     * allocate memory.
+     */
+    Color3f estimateRadiance(const Intersection &its, const Vector3f &wo) const
+    {
+        if (m_emittedCount == 0)
+            return BLACK;
+
+        const BSDF *bsdf = its.mesh->getBSDF();
+        Vector3f woLocal = its.shFrame().toLocal(wo);
+        Color3f photonColor = BLACK;
+        const PhotonMap &photonMap = *m_photonMap;
+        auto addPhoton = [&](uint32_t index)
+        {
+            const Photon &photon = photonMap[index];
+            BSDFQueryRecord bRec(woLocal, its.shFrame().toLocal(photon.getDirection()), ESolidAngle);
+            photonColor += bsdf->eval(bRec) * photon.getPower();
+        };
+
+        float radiusSquared;
+        if (m_photonNeighbors == 0)
+        {
+            m_photonMap->search(its.p(), m_photonRadius, addPhoton);
+            radiusSquared = m_photonRadius * m_photonRadius;
+        }
+        else
+        {
+            PhotonMap::SearchResult results[MAX_PHOTON_NEIGHBORS + 1];
+            radiusSquared = m_maxSearchRadius * m_maxSearchRadius;
+            size_t found = m_photonMap->nnSearch(its.p(), radiusSquared, (size_t) m_photonNeighbors, results);
+
+            /* Without a bound, the radius is the distance of the farthest photon */
+            if (found > 0 && (found == (size_t) m_photonNeighbors || !std::isfinite(radiusSquared)))
+            {
+                radiusSquared = 0.0f;
+                for (size_t i = 0; i < found; ++i)
+                    radiusSquared = std::max(radiusSquared, results[i].distSquared);
+            }
+            for (size_t i = 0; i < found; ++i)
+                addPhoton(results[i].index);
+            if (found == 0 || radiusSquared == 0.0f)
+                return BLACK;
+        }
+
+        return photonColor * INV_PI / (radiusSquared * m_emittedCount);
+    }
+
+    /// Number of photon paths traced per batch
+    static const uint32_t PHOTON_BATCH_SIZE = 4096;
+
+    /// Number of batches traced in parallel before they are appended to the map
+    static const uint32_t PHOTON_BATCHES_PER_ROUND = 64;
+
+    /// Photons deposited by a batch of photon paths
+    struct PhotonBatch {
+        std::vector<Photon> photons;
+        /// Number of photons in the batch after each path
+        std::vector<uint32_t> pathEnds;
+    };
+
+    /// Trace a batch of photon paths with a random number stream of its own
+    void tracePhotons(const Scene *scene, uint32_t index, PhotonBatch &batch) const
+    {
+        batch.photons.clear();
+        batch.pathEnds.clear();
+
+        uint32_t seed = LowDiscrepancy::hashPixel(Point2i((int) index, 0), 0x9407u);
+        pcg32 rng(seed, LowDiscrepancy::mix(seed));
+        auto next2D = [&rng]() { float x = rng.nextFloat(); return Point2f(x, rng.nextFloat()); };
+
+        for (uint32_t i = 0; i < PHOTON_BATCH_SIZE; ++i)
+        {
+            // Get an emitter
+            const Emitter *light = scene->getRandomEmitter(rng.nextFloat());
+
+            // Start the tracing
+            Ray3f currentRay;
+            Point2f positionSample = next2D(), directionSample = next2D();
+            Color3f power = light->samplePhoton(currentRay, positionSample, directionSample) * scene->getLights().size();
+
+            // Throughput of the path, which decides the Russian Roulette
+            Color3f throughput(1.0f);
+
+            // Continue until the the Russian Roulette breaks
+            for (int depth = 0; ; ++depth)
+            {
+
+                // Check if there is an intersection
+                Intersection its;
+                if (!scene->rayIntersect(currentRay, its))
+                    break;
+
+                // If we hit a diffuse surface ==> Store the photon
+                if (its.mesh->getBSDF()->isDiffuse())
+                    batch.photons.push_back(Photon(its.p(), -currentRay.d, power));
+
+                // Perform Russian Roulette
+                float probability = m_roulette.getSurvivalProbability(throughput, depth);
+                if (!(probability > 0.0f) || rng.nextFloat() >= probability)
+                {
+                    break;
+                }
+                power /= probability;
+                throughput /= probability;
+
+                // Sample the brdf
+                BSDFQueryRecord bRec(its.toLocal(-currentRay.d));
+                Color3f brdf = its.mesh->getBSDF()->sample(bRec, next2D());
+                power *= brdf;
+                throughput *= brdf;
+
+                // Continue the recursion
+                currentRay = Ray3f(its.p(), its.toWorld(bRec.wo));
+            }
+
+            batch.pathEnds.push_back((uint32_t) batch.photons.size());
+        }
+    }
+
+    /// Version of the photon map cache format (increase when it changes)
+    static const uint32_t PHOTON_CACHE_VERSION = 1;
+
+    /// Offset of the photon array in a cache file
+    static const size_t PHOTON_CACHE_DATA_OFFSET = 128;
+
+    /// Header of a photon map cache file, followed by the kd-tree nodes
+    struct PhotonCacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t photonSize;
+        uint64_t key;
+        uint64_t photonCount;
+        uint64_t emittedCount;
+        uint64_t depth;
+        float radius;
+        float bboxMin[3];
+        float bboxMax[3];
+    };
+    static_assert(sizeof(PhotonCacheHeader) <= PHOTON_CACHE_DATA_OFFSET,
+                  "The photon cache header overlaps the photon array");
+
+    /**
+     * \brief Hash everything that the photon map depends on
+     *
+     * This covers the format, the photon count, the shapes (including their
+     * BSDFs, the world space mesh data and the files of lazily loaded
+     * geometry) and the emitters, but not the camera. Image textures and
+     * normal maps enter through their descriptions, which contain the size
+     * and modification time of the image file.
+     */
+    uint64_t computeCacheKey(const Scene *scene) const
+    {
+        /* 64-bit FNV-1a */
+        uint64_t hash = 0xcbf29ce484222325ull;
+        auto add = [&hash](const void *data, size_t size)
+        {
+            const uint8_t *bytes = (const uint8_t *) data;
+            for (size_t i = 0; i < size; ++i)
+                hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        };
+        auto addString = [&add](const std::string &str) { add(str.data(), str.size()); };
+
+        uint32_t version = PHOTON_CACHE_VERSION, photonSize = (uint32_t) sizeof(Photon);
+        add(&version, sizeof(version));
+        add(&photonSize, sizeof(photonSize));
+        add(&m_photonCount, sizeof(m_photonCount));
+
+        for (const Shape *shape : scene->getShapes())
+        {
+            std::string deferred = shape->getDeferredSource();
+            if (!deferred.empty())
+            {
+                /* Don't load the geometry just to hash it */
+                addString(deferred);
+                addString(shape->getBSDF() ? shape->getBSDF()->toString() : std::string("null"));
+                continue;
+            }
+
+            addString(shape->toString());
+            if (const Mesh *mesh = dynamic_cast<const Mesh *>(shape))
+            {
+                /* World space positions, which also covers the transform
+                   of instances and positions that are stored quantized */
+                for (uint32_t i = 0; i < mesh->getVertexCount(); ++i)
+                {
+                    Point3f p = mesh->getVertex(i);
+                    add(p.data(), sizeof(float) * 3);
+                }
+                const MatrixXu &F = mesh->getIndices();
+                add(F.data(), sizeof(uint32_t) * F.size());
+            }
+        }
+        for (const Emitter *emitter : scene->getLights())
+            addString(emitter->toString());
+
+        /* The termination of the photon paths changes the photons */
+        addString(m_roulette.toString());
+
+        return hash;
+    }
+
+    /// Memory-map a cached photon map, returns false if there is no valid one
+    bool loadPhotonMap(const std::string &filename, uint64_t key)
+    {
+        if (!filesystem::path(filename).exists())
+            return false;
+
+        std::unique_ptr<MemoryMappedFile> file;
+        try
+        {
+            file.reset(new MemoryMappedFile(filename));
+        }
+        catch (const NoriException &)
+        {
+            /* E.g. an empty file left behind by an interrupted render */
+            cout << "Ignoring the invalid photon map cache \"" << filename << "\"" << endl;
+            return false;
+        }
+
+        const PhotonCacheHeader *header = (const PhotonCacheHeader *) file->getData();
+        if (file->getSize() < PHOTON_CACHE_DATA_OFFSET ||
+            memcmp(header->magic, "NORIPMAP", 8) != 0 ||
+            header->version != PHOTON_CACHE_VERSION ||
+            header->photonSize != sizeof(Photon) ||
+            header->key != key ||
+            file->getSize() != PHOTON_CACHE_DATA_OFFSET + header->photonCount * sizeof(Photon))
+        {
+            cout << "Ignoring the invalid photon map cache \"" << filename << "\"" << endl;
+            return false;
+        }
+
+        PhotonMap::BoundingBoxType bbox(
+            Point3f(header->bboxMin[0], header->bboxMin[1], header->bboxMin[2]),
+            Point3f(header->bboxMax[0], header->bboxMax[1], header->bboxMax[2]));
+        m_photonMap->setExternalNodes((const Photon *) (file->getData() + PHOTON_CACHE_DATA_OFFSET),
+                                      (size_t) header->photonCount, bbox, (size_t) header->depth);
+        m_emittedCount = (size_t) header->emittedCount;
+        if (m_photonRadius != header->radius)
+            cout << "Note: the cached photon map was gathered with photonRadius = "
+                 << header->radius << endl;
+        m_photonMapFile = std::move(file);
+
+        cout << "Loaded " << m_photonMap->size() << " photons (" << m_emittedCount
+             << " emitted) from \"" << filename << "\"" << endl;
+        return true;
+    }
+
+    /**
+     * \brief Store the photon map in the cache
+     *
+     * The file is written under a temporary name and renamed afterwards, so
+     * that concurrent renders never see a partially written file.
+     */
+    void savePhotonMap(const std::string &filename, uint64_t key) const
+    {
+        PhotonCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "NORIPMAP", 8);
+        header.version = PHOTON_CACHE_VERSION;
+        header.photonSize = (uint32_t) sizeof(Photon);
+        header.key = key;
+        header.photonCount = m_photonMap->size();
+        header.emittedCount = m_emittedCount;
+        header.depth = m_photonMap->getDepth();
+        header.radius = m_photonRadius;
+        const PhotonMap::BoundingBoxType &bbox = m_photonMap->getBoundingBox();
+        for (int i = 0; i < 3; ++i)
+        {
+            header.bboxMin[i] = bbox.min[i];
+            header.bboxMax[i] = bbox.max[i];
+        }
+
+        std::string tempFilename = tfm::format("%s.%x.tmp", filename,
+            (uint64_t) std::chrono::high_resolution_clock::now().time_since_epoch().count());
+        std::ofstream os(tempFilename, std::ios::binary);
+        char padding[PHOTON_CACHE_DATA_OFFSET] = { 0 };
+        os.write((const char *) &header, sizeof(header));
+        os.write(padding, PHOTON_CACHE_DATA_OFFSET - sizeof(header));
+        os.write((const char *) m_photonMap->getNodes(), sizeof(Photon) * m_photonMap->size());
+        os.close();
+
+        if (!os || std::rename(tempFilename.c_str(), filename.c_str()) != 0)
+        {
+            std::remove(tempFilename.c_str());
+            cout << "Unable to write the photon map cache \"" << filename << "\"" << endl;
+            return;
+        }
+        cout << "Saved the photon map to \"" << filename << "\"" << endl;
     }
 
 private:
     /*
      * Important: m_photonCount is the total number of photons deposited in the photon map,
-     * NOT the number of emitted photons. You will need to keep track of those yourself.
+     * NOT the number of emitted photons, which is tracked in m_emittedCount.
      */
     int m_photonCount;
     float m_photonRadius;
+    int m_photonNeighbors;
+    float m_maxSearchRadius;
+    std::string m_photonCache;
+    RussianRoulette m_roulette;
+    /// Mapping of the cache file that holds the photons of m_photonMap (if any)
+    std::unique_ptr<MemoryMappedFile> m_photonMapFile;
     std::unique_ptr<PhotonMap> m_photonMap;
+    size_t m_emittedCount = 0;
 
     const Color3f BLACK = Color3f(0.0f);
     const Color3f WHITE = Color3f(1.0f);
@@ -1,5 +1,7 @@
 #include <nori/integrator.h>
 #include <nori/scene.h>
+#include <nori/lightbvh.h>
+#include <nori/warp.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -12,7 +14,7 @@ public:
         this->power = props.getColor("power", Color3f());
     }
 
-    Color3f sample(EmitterQueryRecord &lRec, const Point2f &sample) const
+    Color3f sample(EmitterQueryRecord &lRec, const Point2f &sample) const override
     {
         lRec.wi = (this->position - lRec.ref).normalized();
         lRec.p = this->position;
@@ -22,17 +24,52 @@ public:
         return this->power / (4.f * M_PI * (this->position - lRec.ref).squaredNorm());
     }
 
-    Color3f eval(const EmitterQueryRecord &lRec) const
+    Color3f eval(const EmitterQueryRecord &lRec) const override
     {
         return this->power / (4.f * M_PI * (this->position - lRec.ref).squaredNorm());
     }
 
-    float pdf(const EmitterQueryRecord &lRec) const
+    float pdf(const EmitterQueryRecord &lRec) const override
     {
         return PDF_VALUE;
     }
 
-    std::string toString() const
+    using Emitter::samplePhoton;
+
+    Color3f samplePhoton(Ray3f &ray, Normal3f &n, float &pdfPos, float &pdfDir,
+                         const Point2f &sample1, const Point2f &sample2) const override
+    {
+        /* Uniformly distributed direction */
+        Vector3f d = Warp::squareToUniformSphere(sample1);
+        ray = Ray3f(this->position, d);
+        n = Normal3f(0.0f);
+        pdfPos = 1.0f;
+        pdfDir = Warp::squareToUniformSpherePdf(d);
+        return this->power;
+    }
+
+    void pdfPhoton(const Point3f &p, const Normal3f &n, const Vector3f &d,
+                   float &pdfPos, float &pdfDir) const override
+    {
+        pdfPos = 1.0f;
+        pdfDir = Warp::squareToUniformSpherePdf(d);
+    }
+
+    bool isDeltaPosition() const override
+    {
+        return true;
+    }
+
+    bool getLightBounds(LightBounds &bounds) const override
+    {
+        /* Isotropic emission from a single point */
+        BoundingBox3f bbox(this->position);
+        bounds = LightBounds(bbox, Vector3f(0, 0, 1), this->power.getLuminance(),
+                             -1.0f, 0.0f, false);
+        return true;
+    }
+
+    std::string toString() const override
     {
         return tfm::format("[Point light emitter position = %s power = %s]",
                            this->position.toString(),
@@ -0,0 +1,260 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/bitmap.h>
+#include <nori/dpdf.h>
+#include <nori/mltsampler.h>
+#include <nori/path_mis.h>
+#include <nori/timer.h>
+#include <tbb/tbb.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Primary sample space Metropolis light transport
+ *
+ * Runs Markov chains over the random numbers consumed by \c path_mis (and
+ * the film and aperture position of the camera ray) with the mutations of
+ * \ref MetropolisSampler, so that once a chain has found a path that carries
+ * light it explores its neighborhood ("A Simple and Robust Mutation Strategy
+ * for the Metropolis Light Transport Algorithm", Kelemen et al. 2002). The
+ * properties of \c path_mis (e.g. the roulette) apply to the wrapped
+ * estimator.
+ *
+ * The chains are distributed in proportion to the luminance of the paths,
+ * so the image is normalized with the average luminance over primary sample
+ * space, which is estimated in a bootstrap phase from \c bootstrapSamples
+ * independent paths. The chains start from bootstrap samples that are
+ * chosen by their luminance, which avoids start-up bias.
+ *
+ * Every render pass runs one mutation per pixel (so the sampler's
+ * \c sampleCount sets the number of mutations per pixel), spread over
+ * \c chains chains that run in parallel. Both the current and the proposed
+ * sample are splatted, weighted by the acceptance probability, into a
+ * lock-free \ref SplatBuffer, which is added to the image at the end. The
+ * number of chains does not depend on the thread count, so images are
+ * reproducible.
+ *
+ * The image blocks stay empty, so the preview of the GUI remains black
+ * while rendering and the image only appears in the output file. There is
+ * no per-ray estimate either: \ref Li() throws, since the chains do not
+ * sample individual camera rays.
+ */
+class PSSMLTIntegrator : public Integrator {
+public:
+    PSSMLTIntegrator(const PropertyList &props) : m_integrator(props) {
+        /* Number of independent paths used to estimate the normalization */
+        m_bootstrapSamples = props.getInteger("bootstrapSamples", 100000);
+
+        /* Number of Markov chains */
+        m_chainCount = props.getInteger("chains", 1024);
+
+        /* Probability of a mutation that draws a new independent sample */
+        m_largeStepProbability = props.getFloat("largeStepProbability", 0.3f);
+
+        /* Standard deviation of the small step perturbations in primary sample space */
+        m_sigma = props.getFloat("sigma", 0.01f);
+
+        if (m_bootstrapSamples < 1 || m_chainCount < 1)
+            throw NoriException("PSSMLTIntegrator: bootstrapSamples and chains must be positive");
+        if (m_largeStepProbability < 0.0f || m_largeStepProbability > 1.0f)
+            throw NoriException("PSSMLTIntegrator: largeStepProbability must be in [0, 1]");
+        if (m_sigma <= 0.0f)
+            throw NoriException("PSSMLTIntegrator: sigma must be positive");
+    }
+
+    void preprocess(const Scene *scene) override {
+        m_integrator.preprocess(scene);
+
+        Vector2i size = scene->getCamera()->getOutputSize();
+        m_splats.init(size);
+        m_mutations = 0;
+
+        cout << "Bootstrapping " << m_bootstrapSamples << " paths for PSSMLT .. ";
+        cout.flush();
+        Timer timer;
+
+        /* Luminance of independent samples */
+        std::vector<float> luminance(m_bootstrapSamples);
+        tbb::parallel_for(tbb::blocked_range<int>(0, m_bootstrapSamples),
+            [&](const tbb::blocked_range<int> &range) {
+                for (int i = range.begin(); i != range.end(); ++i) {
+                    MetropolisSampler sampler((uint32_t) i, m_sigma, m_largeStepProbability);
+                    Point2f pixel;
+                    luminance[i] = getLuminance(evaluate(scene, sampler, pixel));
+                }
+            }
+        );
+
+        DiscretePDF bootstrap(m_bootstrapSamples);
+        double sum = 0.0;
+        for (float value : luminance) {
+            bootstrap.append(value);
+            sum += value;
+        }
+        m_normalization = (float) (sum / m_bootstrapSamples);
+
+        /* Start the chains from bootstrap samples chosen by their luminance */
+        m_chains.clear();
+        if (m_normalization > 0.0f) {
+            bootstrap.normalize();
+            m_chains.reserve(m_chainCount);
+            for (int i = 0; i < m_chainCount; ++i) {
+                uint32_t index = (uint32_t) bootstrap.sample((i + 0.5f) / m_chainCount);
+                m_chains.push_back(Chain(index, m_sigma, m_largeStepProbability));
+            }
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, m_chains.size()),
+                [&](const tbb::blocked_range<size_t> &range) {
+                    for (size_t i = range.begin(); i != range.end(); ++i) {
+                        Chain &chain = m_chains[i];
+                        chain.value = evaluate(scene, chain.sampler, chain.pixel);
+                    }
+                }
+            );
+        }
+
+        cout << "done. (took " << timer.elapsedString() << ", normalization = "
+             << m_normalization << ")" << endl;
+    }
+
+    /// Not supported, the image is only estimated by the chains (see \ref endPass())
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const override {
+        throw NoriException("PSSMLTIntegrator: radiance along individual rays is not supported");
+    }
+
+    /// All light is splatted by the chains, so the image blocks stay empty
+    bool renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) const override {
+        return true;
+    }
+
+    /// Advance the chains by one mutation per pixel
+    void endPass(const Scene *scene) override {
+        if (m_chains.empty())
+            return;
+
+        Vector2i size = scene->getCamera()->getOutputSize();
+        uint64_t mutations = (uint64_t) size.x() * size.y();
+        size_t chainCount = m_chains.size();
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, chainCount),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    uint64_t count = mutations * (i + 1) / chainCount - mutations * i / chainCount;
+                    for (uint64_t j = 0; j < count; ++j)
+                        mutate(scene, m_chains[i]);
+                }
+            }
+        );
+        m_mutations += mutations;
+    }
+
+    void addSplats(Bitmap &bitmap, uint32_t sampleCount) const override {
+        if (m_mutations == 0)
+            return;
+        Vector2i size = m_splats.getSize();
+        float pixelCount = (float) size.x() * size.y();
+        m_splats.addTo(bitmap, m_normalization * pixelCount / m_mutations);
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "PSSMLTIntegrator[\n"
+            "  bootstrapSamples = %i,\n"
+            "  chains = %i,\n"
+            "  largeStepProbability = %f,\n"
+            "  sigma = %f,\n"
+            "  integrator = %s\n"
+            "]",
+            m_bootstrapSamples, m_chainCount, m_largeStepProbability, m_sigma,
+            indent(m_integrator.toString()));
+    }
+
+protected:
+    /// State of a Markov chain
+    struct Chain {
+        MetropolisSampler sampler;
+        Point2f pixel;                  ///< Film position of the current sample
+        Color3f value;                  ///< Contribution of the current sample
+
+        Chain(uint32_t index, float sigma, float largeStepProbability)
+            : sampler(index, sigma, largeStepProbability), pixel(0.0f), value(0.0f) { }
+    };
+
+    /// Scalar contribution that the chains are distributed by
+    static float getLuminance(const Color3f &value) {
+        return std::max(value.getLuminance(), 0.0f);
+    }
+
+    /// Evaluate the contribution of the current sample of \c sampler and its film position
+    Color3f evaluate(const Scene *scene, MetropolisSampler &sampler, Point2f &pixel) const {
+        const Camera *camera = scene->getCamera();
+        Vector2i size = camera->getOutputSize();
+
+        Point2f film = sampler.next2D();
+        pixel = Point2f(film.x() * size.x(), film.y() * size.y());
+
+        Ray3f ray;
+        Color3f value = camera->sampleRay(ray, pixel, sampler.next2D());
+        if (value.isZero())
+            return Color3f(0.0f);
+        return value * m_integrator.LiKernel(scene, &sampler, ray);
+    }
+
+    /// Propose a mutation, splat the expected values of both samples and accept or reject
+    void mutate(const Scene *scene, Chain &chain) {
+        chain.sampler.startIteration();
+        Point2f pixel;
+        Color3f proposed = evaluate(scene, chain.sampler, pixel);
+
+        float current = getLuminance(chain.value);
+        float candidate = getLuminance(proposed);
+        float accept = current > 0.0f ? std::min(1.0f, candidate / current) : 1.0f;
+
+        if (candidate > 0.0f)
+            m_splats.splat(pixel, proposed * (accept / candidate));
+        if (accept < 1.0f)
+            m_splats.splat(chain.pixel, chain.value * ((1.0f - accept) / current));
+
+        if (chain.sampler.nextRandom() < accept) {
+            chain.pixel = pixel;
+            chain.value = proposed;
+            chain.sampler.accept();
+        } else {
+            chain.sampler.reject();
+        }
+    }
+
+private:
+    PathMisIntegrator m_integrator;
+    int m_bootstrapSamples;
+    int m_chainCount;
+    float m_largeStepProbability;
+    float m_sigma;
+
+    float m_normalization = 0.0f;
+    std::vector<Chain> m_chains;
+    uint64_t m_mutations = 0;
+    SplatBuffer m_splats;
+};
+
+NORI_REGISTER_CLASS(PSSMLTIntegrator, "pssmlt");
+NORI_NAMESPACE_END
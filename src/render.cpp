@@ -25,6 +25,7 @@
 #include <nori/bitmap.h>
 #include <nori/sampler.h>
 #include <nori/integrator.h>
+#include <nori/renderkernel.h>
 #include <nori/gui.h>
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
@@ -77,61 +78,6 @@ float RenderThread::getProgress() {
     else return 1.f;
 }
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) {
-    const Camera *camera = scene->getCamera();
-    const Integrator *integrator = scene->getIntegrator();
-
-    Point2i offset = block.getOffset();
-    Vector2i size  = block.getSize();
-
-    // Color Channels
-    #define RED 0
-    #define GREEN 1
-    #define BLUE 2
-
-    /* Clear the block contents */
-    block.clear();
-
-    /* For each pixel and pixel sample sample */
-    for (int y=0; y<size.y(); ++y) {
-        for (int x=0; x<size.x(); ++x) {
-            Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
-            Point2f apertureSample = sampler->next2D();
-
-            /* Sample a ray from the camera */
-            Ray3f ray;
-            Color3f value;
-            
-            // Check for chromatic aberrations
-            if(camera->hasChromaticAberrations()) {
-                Ray3f ray0, ray1, ray2;
-                Color3f value0, value1, value2;
-
-                // Sample each color channel separately
-                value0 = camera->sampleRay(ray0, pixelSample, apertureSample, RED);
-                value1 = camera->sampleRay(ray1, pixelSample, apertureSample, GREEN);
-                value2 = camera->sampleRay(ray2, pixelSample, apertureSample, BLUE);
-
-                // Compute incident radience for each channel
-                value0 *= integrator->Li(scene, sampler, ray0);
-                value1 *= integrator->Li(scene, sampler, ray1);
-                value2 *= integrator->Li(scene, sampler, ray2);
-
-                // Sum all of the color channels
-                value = value0 + value1 + value2;
-            } else {
-                // Sample all color channels together
-                value = camera->sampleRay(ray, pixelSample, apertureSample);
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
-            }
-
-            /* Store in the image block */
-            block.put(pixelSample, value);
-        }
-    }
-}
-
 void RenderThread::renderScene(const std::string & filename) {
 
     filesystem::path path(filename);
@@ -177,6 +123,13 @@ void RenderThread::renderScene(const std::string & filename) {
             /* Create a block generator (i.e. a work scheduler) */
             BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
 
+            /* Pick a render kernel specialized for the scene's camera,
+               sampler and integrator if one was compiled in */
+            bool specialized = false;
+            RenderKernel::Function renderBlock = RenderKernel::get(m_scene, &specialized);
+            if (specialized)
+                cout << "Using a specialized render kernel" << endl;
+
             cout << "Rendering .. ";
             cout.flush();
             Timer timer;
@@ -187,10 +140,23 @@ void RenderThread::renderScene(const std::string & filename) {
             tbb::concurrent_vector< std::unique_ptr<Sampler> > samplers;
             samplers.resize(numBlocks);
 
+            /* Every block is rendered into its own buffer and merged into
+               'image' in block order after each pass. Together with the
+               per-pixel seeding of the samplers, this makes the image
+               independent of thread scheduling. Finished blocks are also
+               added to the preview right away, which is then replaced by
+               'image' at the end of the pass. */
+            std::vector< std::unique_ptr<ImageBlock> > blocks(numBlocks);
+            ImageBlock image(outputSize, camera->getReconstructionFilter());
+            image.clear();
+
+            /* Holds the estimate of a single pass, whose per-pixel mean and
+               second moment are accumulated for the variance estimate */
             ImageBlock varianceBlock(camera->getOutputSize(),camera->getReconstructionFilter());
             Bitmap sumBitmap(camera->getOutputSize());
             Bitmap sum2Bitmap(camera->getOutputSize());
 
+            uint32_t renderedSamples = 0;
             for (uint32_t k = 0; k < numSamples ; ++k) {
                 m_progress = k/float(numSamples);
                 if(m_render_status == 2)
@@ -199,7 +165,7 @@ void RenderThread::renderScene(const std::string & filename) {
                 tbb::blocked_range<int> range(0, numBlocks);
 
                 auto map = [&](const tbb::blocked_range<int> &range) {
-                    // Allocate memory for a small image block to be rendered by the current thread
+                    // Image block that receives the position of the next block from the generator
                     ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
                                      camera->getReconstructionFilter());
 
@@ -213,16 +179,20 @@ void RenderThread::renderScene(const std::string & filename) {
                             std::unique_ptr<Sampler> sampler(m_scene->getSampler()->clone());
                             sampler->prepare(block);
                             samplers.at(blockId) = std::move(sampler);
+                            blocks.at(blockId).reset(new ImageBlock(Vector2i(NORI_BLOCK_SIZE),
+                                                                    camera->getReconstructionFilter()));
                         }
 
-                        // Render all contained pixels
-                        renderBlock(m_scene, samplers.at(blockId).get(), block);
+                        ImageBlock &result = *blocks.at(blockId);
+                        result.setOffset(block.getOffset());
+                        result.setSize(block.getSize());
+                        result.setBlockId(blockId);
 
-                        // The image block has been processed. Now add it to the "big" block that represents the entire image
-                        m_block.put(block);
+                        // Render all contained pixels
+                        renderBlock(m_scene, samplers.at(blockId).get(), result);
 
-                        // We also add this to a variance block
-                        varianceBlock.put(block);
+                        // Show the block in the preview until the pass is merged
+                        m_block.put(result);
                     }
                 };
 
@@ -232,6 +202,21 @@ void RenderThread::renderScene(const std::string & filename) {
                 /// Default: parallel rendering
                 tbb::parallel_for(range, map);
 
+                m_scene->getIntegrator()->endPass(m_scene);
+
+                varianceBlock.clear();
+                for (auto &result : blocks) {
+                    // The image block has been processed. Now add it to the "big" block that represents the entire image
+                    image.put(*result);
+
+                    // We also add this to a variance block
+                    varianceBlock.put(*result);
+                }
+
+                m_block.lock();
+                static_cast<ImageBlock::Base &>(m_block) = image;
+                m_block.unlock();
+
                 const int sizeX = sumBitmap.rows();
                 const int sizeY = sumBitmap.cols();
 
@@ -247,9 +232,11 @@ void RenderThread::renderScene(const std::string & filename) {
                 }
 
                 blockGenerator.reset();
+                ++renderedSamples;
             }
 
-            cout << "done. (took " << timer.elapsedString() << ")" << endl;
+            cout << "done. (took " << timer.elapsedString() << ", peak memory usage "
+                 << memString(getPeakMemoryUsage()) << ")" << endl;
 
             /* Now turn the rendered image block into
                a properly normalized bitmap */
@@ -257,6 +244,10 @@ void RenderThread::renderScene(const std::string & filename) {
             std::unique_ptr<Bitmap> bitmap(m_block.toBitmap());
             m_block.unlock();
 
+            /* Add the contributions of e.g. light tracing, which are not
+               part of the image blocks */
+            m_scene->getIntegrator()->addSplats(*bitmap, renderedSamples);
+
             /* Save using the OpenEXR format */
             bitmap->save(outputName);
 
@@ -266,12 +257,15 @@ void RenderThread::renderScene(const std::string & filename) {
 
             Bitmap pixelVarianceEstimates(camera->getOutputSize());
 
-            // V(X) = E(X2) − (E(X))2 
+            // V(X) = E(X2) − (E(X))2 of a single pass, divided by the number
+            // of passes to obtain the variance of the pixel mean
             for(int i = 0; i < sizeX;i++) {
                 for(int j = 0; j < sizeY;j++) {
-                    sumBitmap(i,j) /= numSamples;
-                    sum2Bitmap(i,j) /= numSamples;
-                    pixelVarianceEstimates(i,j) = sum2Bitmap(i,j) - pow(sumBitmap(i,j),2);
+                    sumBitmap(i,j) /= renderedSamples;
+                    sum2Bitmap(i,j) /= renderedSamples;
+                    pixelVarianceEstimates(i,j) = renderedSamples > 1
+                        ? Color3f((sum2Bitmap(i,j) - pow(sumBitmap(i,j),2)) / float(renderedSamples - 1))
+                        : Color3f(0.0f);
                 }
             }
 
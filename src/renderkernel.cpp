@@ -0,0 +1,59 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/renderkernel.h>
+#include <nori/perspective.h>
+#include <nori/independent.h>
+#include <nori/sobol.h>
+#include <nori/path_mis.h>
+#include <nori/path_mats.h>
+
+NORI_NAMESPACE_BEGIN
+
+std::map<RenderKernel::Key, RenderKernel::Function> *RenderKernel::m_kernels = nullptr;
+
+void RenderKernel::registerKernel(const std::type_info &camera, const std::type_info &sampler,
+                                  const std::type_info &integrator, Function kernel) {
+    if (!m_kernels)
+        m_kernels = new std::map<Key, Function>();
+    (*m_kernels)[Key(camera, sampler, integrator)] = kernel;
+}
+
+RenderKernel::Function RenderKernel::get(const Scene *scene, bool *specialized) {
+    if (m_kernels) {
+        Key key(typeid(*scene->getCamera()), typeid(*scene->getSampler()),
+                typeid(*scene->getIntegrator()));
+        auto it = m_kernels->find(key);
+        if (it != m_kernels->end()) {
+            if (specialized)
+                *specialized = true;
+            return it->second;
+        }
+    }
+    if (specialized)
+        *specialized = false;
+    return renderBlockKernel<Camera, Sampler, Integrator>;
+}
+
+/* Frequently used combinations, see \ref renderBlockKernel() */
+NORI_REGISTER_RENDER_KERNEL(PerspectiveCamera, Independent, PathMisIntegrator);
+NORI_REGISTER_RENDER_KERNEL(PerspectiveCamera, SobolSampler, PathMisIntegrator);
+NORI_REGISTER_RENDER_KERNEL(PerspectiveCamera, Independent, PathMatsIntegrator);
+NORI_REGISTER_RENDER_KERNEL(PerspectiveCamera, SobolSampler, PathMatsIntegrator);
+
+NORI_NAMESPACE_END
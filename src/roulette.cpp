@@ -0,0 +1,119 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/roulette.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/lowdiscrepancy.h>
+#include <tbb/tbb.h>
+
+NORI_NAMESPACE_BEGIN
+
+RussianRoulette::RussianRoulette(const PropertyList &props, float defaultMaxProbability,
+                                 bool supportsAdjoint) {
+    /* Quantity that determines the survival probability */
+    std::string strategy = props.getString("rrStrategy", "max");
+    if (strategy == "red")
+        m_strategy = ERed;
+    else if (strategy == "luminance")
+        m_strategy = ELuminance;
+    else if (strategy == "max")
+        m_strategy = EMaxComponent;
+    else if (strategy == "adrrs")
+        m_strategy = EAdjoint;
+    else
+        throw NoriException("RussianRoulette: unknown rrStrategy \"%s\"", strategy);
+    if (m_strategy == EAdjoint && !supportsAdjoint)
+        throw NoriException("RussianRoulette: this integrator does not support rrStrategy \"adrrs\"");
+
+    /* Number of path vertices that are always continued */
+    m_minDepth = props.getInteger("rrDepth", 0);
+
+    /* Upper bound of the survival probability */
+    m_maxProbability = props.getFloat("rrMaxProbability", defaultMaxProbability);
+
+    /* Ratio of the upper and lower bound of the ADRRS weight window */
+    m_windowRatio = props.getFloat("adrrsWindow", 5.0f);
+
+    /* Maximum number of paths into which a path is split */
+    m_maxSplit = props.getInteger("adrrsMaxSplit", 8);
+
+    if (m_minDepth < 0 || m_maxProbability <= 0.0f || m_maxProbability > 1.0f)
+        throw NoriException("RussianRoulette: invalid rrDepth or rrMaxProbability");
+    if (m_windowRatio < 1.0f || m_maxSplit < 1)
+        throw NoriException("RussianRoulette: invalid adrrsWindow or adrrsMaxSplit");
+
+    /* The window is centered on the expected contribution of a path that
+       contributes as much as the pixel, i.e. (lower + upper) / 2 = 1 */
+    m_windowLower = 2.0f / (1.0f + m_windowRatio);
+}
+
+std::string RussianRoulette::toString() const {
+    const char *strategies[] = { "red", "luminance", "max", "adrrs" };
+    if (m_strategy == EAdjoint)
+        return tfm::format("RussianRoulette[strategy = adrrs, depth = %i, maxProbability = %f, "
+                           "window = %f, maxSplit = %i]",
+                           m_minDepth, m_maxProbability, m_windowRatio, m_maxSplit);
+    return tfm::format("RussianRoulette[strategy = %s, depth = %i, maxProbability = %f]",
+                       strategies[m_strategy], m_minDepth, m_maxProbability);
+}
+
+RadianceCache::RadianceCache(const BoundingBox3f &bbox, int resolution) : m_bbox(bbox) {
+    Vector3f extents = bbox.getExtents();
+    float cellSize = std::max(extents.maxCoeff(), Epsilon) / resolution;
+    for (int i = 0; i < 3; ++i)
+        m_resolution[i] = std::max(1, (int) std::ceil(extents[i] / cellSize));
+    m_scale = Vector3f(m_resolution.x(), m_resolution.y(), m_resolution.z())
+        .cwiseQuotient(extents.cwiseMax(Vector3f(Epsilon)));
+    size_t cells = (size_t) m_resolution.x() * m_resolution.y() * m_resolution.z();
+    m_sum.resize(cells);
+    m_count.resize(cells);
+}
+
+void RadianceCache::train(const Scene *scene, int spp,
+                          const std::function<void(PathSampler &, const Ray3f &)> &trace) {
+    const Camera *camera = scene->getCamera();
+    Vector2i size = camera->getOutputSize();
+
+    tbb::parallel_for(tbb::blocked_range<int>(0, size.y()),
+        [&](const tbb::blocked_range<int> &range) {
+            for (int y = range.begin(); y != range.end(); ++y) {
+                for (int x = 0; x < size.x(); ++x) {
+                    uint32_t seed = LowDiscrepancy::hashPixel(Point2i(x, y), 0xadc5u);
+                    pcg32 rng(seed, LowDiscrepancy::mix(seed));
+                    PathSampler sampler { rng };
+                    for (int s = 0; s < spp; ++s) {
+                        Ray3f ray;
+                        Point2f pixelSample = Point2f((float) x, (float) y) + sampler.next2D();
+                        if (!camera->sampleRay(ray, pixelSample, sampler.next2D()).isZero())
+                            trace(sampler, ray);
+                    }
+                }
+            }
+        }
+    );
+}
+
+size_t RadianceCache::getOccupiedCells() const {
+    size_t occupied = 0;
+    for (const AtomicFloat &count : m_count)
+        occupied += count.get() > 0.0f ? 1 : 0;
+    return occupied;
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,50 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <nori/block.h>
+
+NORI_NAMESPACE_BEGIN
+
+void PixelSampler::prepare(const ImageBlock &block) {
+    m_blockOffset = block.getOffset();
+    m_blockSize = block.getSize();
+    m_sampleCounts.assign(m_blockSize.x() * m_blockSize.y(), m_sampleOffset);
+    m_outsideCount = m_sampleOffset;
+}
+
+void PixelSampler::generate(const Point2i &pixel) {
+    m_pixel = pixel;
+    m_sampleIndex = sampleCounter();
+    m_dimension = 0;
+}
+
+void PixelSampler::advance() {
+    m_sampleIndex = ++sampleCounter();
+    m_dimension = 0;
+}
+
+uint32_t &PixelSampler::sampleCounter() {
+    Vector2i local = m_pixel - m_blockOffset;
+    if (local.x() < 0 || local.y() < 0 ||
+        local.x() >= m_blockSize.x() || local.y() >= m_blockSize.y())
+        return m_outsideCount;
+    return m_sampleCounts[local.y() * m_blockSize.x() + local.x()];
+}
+
+NORI_NAMESPACE_END
@@ -23,15 +23,19 @@
 #include <nori/camera.h>
 #include <nori/emitter.h>
 #include <nori/medium.h>
+#include <nori/mesh.h>
+#include <nori/assetcache.h>
 
 NORI_NAMESPACE_BEGIN
 
 Scene::Scene(const PropertyList &) {
     m_bvh = new BVH();
+    m_lightBVH = new LightBVH();
 }
 
 Scene::~Scene() {
     delete m_bvh;
+    delete m_lightBVH;
     delete m_sampler;
     delete m_camera;
     delete m_integrator;
@@ -55,6 +59,27 @@ void Scene::activate() {
         m_sampler->activate();
     }
 
+    /* Area lights are placed in the light BVH according to their surface
+       area. Shapes that do not report one end up among the unbounded
+       lights, which are chosen uniformly, and a mesh without any area
+       cannot be sampled at all. */
+    for (const Shape *shape : m_shapes) {
+        if (!shape->isEmitter() || shape->getSurfaceArea() > 0)
+            continue;
+        if (const Mesh *mesh = dynamic_cast<const Mesh *>(shape))
+            throw NoriException("Scene: the area emitter of mesh \"%s\" has zero surface area!",
+                                mesh->getName());
+        cerr << "Warning: an area emitter is attached to a shape without a known "
+                "surface area; it is sampled like an infinite light" << endl;
+    }
+
+    m_lightBVH->build(m_emitters);
+
+    const AssetCache &cache = AssetCache::getInstance();
+    if (cache.getHitCount() > 0)
+        cout << "Asset cache: " << cache.getHitCount() << " shared asset references, saved "
+             << memString(cache.getSavedMemory()) << endl;
+
     cout << endl;
     cout << "Configuration: " << toString() << endl;
     cout << endl;
@@ -0,0 +1,265 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sdtree.h>
+#include <tbb/tbb.h>
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    /// Maximum depth of the directional quadtrees
+    const int MAX_DTREE_DEPTH = 20;
+
+    /// Largest float below one
+    const float ONE_MINUS_EPSILON = 0.99999994f;
+
+    /// Quadrant of a point in the unit square
+    inline int quadrant(const Point2f &p) {
+        return (p.x() >= 0.5f ? 1 : 0) + (p.y() >= 0.5f ? 2 : 0);
+    }
+
+    /// Map a point of a quadrant to the unit square
+    inline Point2f toChild(const Point2f &p, int quadrant) {
+        return Point2f(
+            std::min(2.0f * p.x() - (quadrant & 1), ONE_MINUS_EPSILON),
+            std::min(2.0f * p.y() - (quadrant >> 1), ONE_MINUS_EPSILON)
+        );
+    }
+
+    /// Choose between two halves with weights \c a and \c b and rescale \c u
+    inline int chooseHalf(float a, float b, float &u) {
+        float total = a + b;
+        float pA = total > 0.0f ? a / total : 0.5f;
+        if (u < pA) {
+            u = std::min(u / pA, ONE_MINUS_EPSILON);
+            return 0;
+        }
+        u = std::min((u - pA) / (1.0f - pA), ONE_MINUS_EPSILON);
+        return 1;
+    }
+}
+
+DTree::DTree() : m_nodes(1) { }
+
+Point2f DTree::dirToCanonical(const Vector3f &d) {
+    float cosTheta = clamp(d.z(), -1.0f, 1.0f);
+    float phi = std::atan2(d.y(), d.x());
+    if (phi < 0.0f)
+        phi += 2.0f * M_PI;
+    return Point2f(
+        clamp((cosTheta + 1.0f) * 0.5f, 0.0f, ONE_MINUS_EPSILON),
+        clamp(phi * INV_TWOPI, 0.0f, ONE_MINUS_EPSILON)
+    );
+}
+
+Vector3f DTree::canonicalToDir(const Point2f &p) {
+    float cosTheta = 2.0f * p.x() - 1.0f;
+    float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    float phi = 2.0f * M_PI * p.y();
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+void DTree::record(const Vector3f &d, float value) {
+    m_weight.add(1.0f);
+    if (!std::isfinite(value) || value <= 0.0f)
+        return;
+
+    Point2f p = dirToCanonical(d);
+    uint32_t node = 0;
+    while (true) {
+        int i = quadrant(p);
+        m_nodes[node].sum[i].add(value);
+        if (m_nodes[node].child[i] == 0)
+            break;
+        node = m_nodes[node].child[i];
+        p = toChild(p, i);
+    }
+}
+
+float DTree::pdf(const Vector3f &d) const {
+    if (!(m_nodes[0].total() > 0.0f))
+        return INV_FOURPI;
+
+    Point2f p = dirToCanonical(d);
+    float result = INV_FOURPI;
+    uint32_t node = 0;
+    while (true) {
+        const Node &n = m_nodes[node];
+        int i = quadrant(p);
+        float total = n.total();
+        if (!(total > 0.0f))
+            return 0.0f;
+        result *= 4.0f * n.sum[i].get() / total;
+        if (n.child[i] == 0)
+            break;
+        node = n.child[i];
+        p = toChild(p, i);
+    }
+    return result;
+}
+
+Vector3f DTree::sample(Point2f sample) const {
+    if (!(m_nodes[0].total() > 0.0f))
+        return canonicalToDir(sample);
+
+    Point2f origin(0.0f), result;
+    float size = 1.0f;
+    uint32_t node = 0;
+    while (true) {
+        const Node &n = m_nodes[node];
+        /* Choose the column first, then the quadrant within it */
+        int x = chooseHalf(n.sum[0].get() + n.sum[2].get(),
+                           n.sum[1].get() + n.sum[3].get(), sample.x());
+        int y = chooseHalf(n.sum[x].get(), n.sum[x + 2].get(), sample.y());
+        int i = x + 2 * y;
+
+        size *= 0.5f;
+        origin += Vector2f(x * size, y * size);
+        if (n.child[i] == 0) {
+            result = origin + sample * size;
+            break;
+        }
+        node = n.child[i];
+    }
+    return canonicalToDir(Point2f(
+        std::min(result.x(), ONE_MINUS_EPSILON),
+        std::min(result.y(), ONE_MINUS_EPSILON)));
+}
+
+DTree DTree::refine(float threshold, size_t maxNodes) const {
+    DTree result;
+    float total = m_nodes[0].total();
+    if (!(total > 0.0f))
+        return result;
+
+    /* Node of the new tree, node of this tree (0 if there is none) and the
+       energy of the region if it is not resolved by this tree */
+    struct Entry {
+        uint32_t node;
+        uint32_t oldNode;
+        float energy;
+        int depth;
+    };
+
+    std::vector<Entry> stack;
+    stack.push_back(Entry { 0, 0, total, 1 });
+    while (!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+        bool hasOld = entry.node == 0 || entry.oldNode != 0;
+
+        for (int i = 0; i < 4; ++i) {
+            float energy = hasOld ? m_nodes[entry.oldNode].sum[i].get() : entry.energy * 0.25f;
+            if (energy / total <= threshold || entry.depth >= MAX_DTREE_DEPTH ||
+                result.m_nodes.size() >= maxNodes)
+                continue;
+
+            uint32_t child = (uint32_t) result.m_nodes.size();
+            result.m_nodes.emplace_back();
+            result.m_nodes[entry.node].child[i] = child;
+            stack.push_back(Entry { child, hasOld ? m_nodes[entry.oldNode].child[i] : 0u,
+                                    energy, entry.depth + 1 });
+        }
+    }
+    return result;
+}
+
+SDTree::SDTree(const BoundingBox3f &bounds) {
+    /* Cubify the bounds so that alternating splits produce cubic cells */
+    float extent = std::max(bounds.getExtents().maxCoeff(), Epsilon);
+    m_bounds = BoundingBox3f(bounds.min, bounds.min + Vector3f(extent));
+
+    Node root;
+    root.child = 0;
+    root.leaf = 0;
+    root.axis = 0;
+    m_nodes.push_back(root);
+    m_leaves.emplace_back();
+}
+
+SDTree::Leaf &SDTree::getLeaf(const Point3f &p_) {
+    Point3f p = (p_ - m_bounds.min).cwiseQuotient(m_bounds.getExtents());
+    const Node *node = &m_nodes[0];
+    while (node->child != 0) {
+        int axis = node->axis;
+        if (p[axis] < 0.5f) {
+            p[axis] = 2.0f * p[axis];
+            node = &m_nodes[node->child];
+        } else {
+            p[axis] = 2.0f * p[axis] - 1.0f;
+            node = &m_nodes[node->child + 1];
+        }
+    }
+    return m_leaves[node->leaf];
+}
+
+size_t SDTree::getMemory() const {
+    size_t memory = m_nodes.size() * sizeof(Node);
+    for (const Leaf &leaf : m_leaves)
+        memory += leaf.sampling.getMemory() + leaf.building.getMemory();
+    return memory;
+}
+
+void SDTree::refine(float spatialThreshold, float directionalThreshold, size_t maxMemory) {
+    /* Split the leaves that recorded enough samples, as long as the copied
+       directional trees fit into the memory budget */
+    size_t memory = getMemory();
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        if (m_nodes[i].child != 0)
+            continue;
+        Leaf &leaf = m_leaves[m_nodes[i].leaf];
+        size_t leafMemory = leaf.sampling.getMemory() + leaf.building.getMemory();
+        if (leaf.building.getWeight() <= spatialThreshold ||
+            memory + leafMemory + 2 * sizeof(Node) > maxMemory)
+            continue;
+
+        leaf.building.scaleWeight(0.5f);
+        uint32_t leafIndex = m_nodes[i].leaf;
+        uint32_t copyIndex = (uint32_t) m_leaves.size();
+        m_leaves.push_back(m_leaves[leafIndex]);
+        memory += leafMemory + 2 * sizeof(Node);
+
+        Node child;
+        child.child = 0;
+        child.axis = (uint8_t) ((m_nodes[i].axis + 1) % 3);
+        child.leaf = leafIndex;
+        m_nodes[i].child = (uint32_t) m_nodes.size();
+        m_nodes.push_back(child);
+        child.leaf = copyIndex;
+        m_nodes.push_back(child);
+    }
+
+    /* The recorded trees become the sampling trees. Subdivide the new trees
+       where the recorded energy is concentrated; every leaf gets an equal
+       share of the memory budget for its two trees */
+    size_t nodeMemory = m_nodes.size() * sizeof(Node);
+    size_t perLeaf = (maxMemory > nodeMemory ? maxMemory - nodeMemory : 0) / m_leaves.size();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_leaves.size()),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                Leaf &leaf = m_leaves[i];
+                size_t nodeSize = leaf.building.getMemory() / leaf.building.getNodeCount();
+                size_t maxNodes = std::max((size_t) 1, perLeaf / (2 * nodeSize));
+                leaf.sampling = leaf.building;
+                leaf.building = leaf.sampling.refine(directionalThreshold, maxNodes);
+            }
+        }
+    );
+}
+
+NORI_NAMESPACE_END
@@ -86,11 +86,11 @@ std::string Intersection::toString() const {
         "  geoFrame = %s,\n"
         "  mesh = %s\n"
         "]",
-        p.toString(),
+        p().toString(),
         t,
-        uv.toString(),
-        indent(shFrame.toString()),
-        indent(geoFrame.toString()),
+        uv().toString(),
+        indent(shFrame().toString()),
+        indent(geoFrame().toString()),
         mesh ? mesh->toString() : std::string("null")
     );
 }
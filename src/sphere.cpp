@@ -40,7 +40,7 @@ public:
     virtual Point3f getCentroid(uint32_t index) const override { return m_position; }
 
     // Ressource used as inspiration : https://raytracing.github.io/books/RayTracingInOneWeekend.html
-    virtual bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const override
+    virtual bool rayIntersect(uint32_t &index, const Ray3f &ray, float &u, float &v, float &t) const override
     {
         Vector3f oc = ray.o - m_position;
 
@@ -75,21 +75,26 @@ public:
         return false;
     }
 
-    virtual void setHitInformation(uint32_t index, const Ray3f &ray, Intersection &its) const override
+    virtual void setHitInformation(const Intersection &its, uint32_t fields) const override
     {
-        Point3f intersectionPoint = ray.o + its.t * ray.d;
-        its.p = intersectionPoint;
+        Point3f intersectionPoint = its.rayOrigin + its.t * its.rayDirection;
+        its.setP(intersectionPoint);
+
+        if (!(fields & (Intersection::EUV | Intersection::EGeoFrame | Intersection::EShFrame)))
+            return;
 
         Vector3f n = (intersectionPoint - m_position).normalized();
         
         Frame frame = Frame(n);
-        its.shFrame = frame;
-        its.geoFrame = frame;
-
-        Point2f coords = sphericalCoordinates(n);
-        coords[0] = 0.5 + coords[0] / (2*M_PI);
-        coords[1] /= M_PI;
-        its.uv = coords;
+        its.setShFrame(frame);
+        its.setGeoFrame(frame);
+
+        if (fields & Intersection::EUV) {
+            Point2f coords = sphericalCoordinates(n);
+            coords[0] = 0.5 + coords[0] / (2*M_PI);
+            coords[1] /= M_PI;
+            its.setUV(coords);
+        }
     }
 
     virtual void sampleSurface(ShapeQueryRecord &sRec, const Point2f &sample) const override
@@ -104,6 +109,11 @@ public:
         return std::pow(1.f / m_radius, 2) * Warp::squareToUniformSpherePdf(Vector3f(0.0f, 0.0f, 1.0f));
     }
 
+    virtual float getSurfaceArea() const override
+    {
+        return 4 * M_PI * m_radius * m_radius;
+    }
+
     virtual std::string toString() const override
     {
         return tfm::format(
@@ -1,5 +1,7 @@
 #include <nori/integrator.h>
 #include <nori/scene.h>
+#include <nori/lightbvh.h>
+#include <nori/warp.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -16,7 +18,7 @@ public:
         this->cosTotalWidth = std::cos(M_PI / 180 * props.getFloat("totalWidth"));
     }
 
-    Color3f sample(EmitterQueryRecord &lRec, const Point2f &sample) const
+    Color3f sample(EmitterQueryRecord &lRec, const Point2f &sample) const override
     {
         lRec.wi = (this->position - lRec.ref).normalized();
         lRec.p = this->position;
@@ -35,18 +37,55 @@ public:
         return (std::acos(cosTotalWidth) - std::acos(cosTheta))/ (std::acos(cosTotalWidth) - std::acos(cosFalloffStart));
     }
 
-    Color3f eval(const EmitterQueryRecord &lRec) const
+    Color3f eval(const EmitterQueryRecord &lRec) const override
     {
         Color3f c = this->power / (4.f * M_PI);
         return c * 2 * M_PI * (1 - 0.5 * (cosFalloffStart + cosTotalWidth));
     }
 
-    float pdf(const EmitterQueryRecord &lRec) const
+    float pdf(const EmitterQueryRecord &lRec) const override
     {
         return lRec.pdf;
     }
 
-    std::string toString() const
+    using Emitter::samplePhoton;
+
+    Color3f samplePhoton(Ray3f &ray, Normal3f &n, float &pdfPos, float &pdfDir,
+                         const Point2f &sample1, const Point2f &sample2) const override
+    {
+        /* Uniformly distributed direction within the cone of the spot */
+        Vector3f d = Frame(this->direction).toWorld(
+            Warp::squareToUniformSphereCap(sample1, cosTotalWidth));
+        ray = Ray3f(this->position, d);
+        n = Normal3f(0.0f);
+        pdfPos = 1.0f;
+        pdfDir = INV_TWOPI / (1.0f - cosTotalWidth);
+        return this->power * falloff(d) / (4.f * M_PI * pdfDir);
+    }
+
+    void pdfPhoton(const Point3f &p, const Normal3f &n, const Vector3f &d,
+                   float &pdfPos, float &pdfDir) const override
+    {
+        pdfPos = 1.0f;
+        pdfDir = this->direction.dot(d) >= cosTotalWidth ? INV_TWOPI / (1.0f - cosTotalWidth) : 0.0f;
+    }
+
+    bool isDeltaPosition() const override
+    {
+        return true;
+    }
+
+    bool getLightBounds(LightBounds &bounds) const override
+    {
+        /* Full intensity up to the falloff start, none beyond the total width */
+        BoundingBox3f bbox(this->position);
+        float phi = this->power.getLuminance() * (1 - 0.5f * (cosFalloffStart + cosTotalWidth)) / 2;
+        float cosTheta_e = std::cos(std::acos(cosTotalWidth) - std::acos(cosFalloffStart));
+        bounds = LightBounds(bbox, this->direction, phi, cosFalloffStart, cosTheta_e, false);
+        return true;
+    }
+
+    std::string toString() const override
     {
         return tfm::format("[Spot light emitter \n"
             "position = %s  \n"
@@ -0,0 +1,397 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/block.h>
+#include <nori/bitmap.h>
+#include <nori/atomic.h>
+#include <nori/lowdiscrepancy.h>
+#include <pcg32.h>
+#include <tbb/tbb.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Stochastic progressive photon mapping
+ *
+ * Every render pass is one iteration (so the sampler's \c sampleCount sets
+ * the number of iterations): the camera pass follows each pixel's path
+ * through specular surfaces to its first non-specular hit, the visible
+ * point, and computes the emitted and direct light there. After the pass,
+ * \c photonsPerPass photons are traced in parallel and splatted into the
+ * visible points, which are looked up in a hashed grid. Each pixel then
+ * shrinks its gather radius and rescales its accumulated flux as in
+ * "Stochastic Progressive Photon Mapping" (Hachisuka and Jensen 2009), so
+ * the estimate of the indirect light converges, including caustics.
+ *
+ * Photons are not stored, and the grid holds at most eight entries per
+ * pixel, so the memory usage only depends on the image size. The direct
+ * light is part of the image blocks, while the indirect light is added to
+ * the final image (see \ref addSplats()).
+ */
+class SPPMIntegrator : public Integrator {
+public:
+    SPPMIntegrator(const PropertyList &props) {
+        /* Number of photons traced after every pass */
+        m_photonsPerPass = props.getInteger("photonsPerPass", 100000);
+
+        /* Initial gather radius */
+        m_initialRadius = props.getFloat("initialRadius", 0.0f /* Default: automatic */);
+
+        /* Fraction of the new photons that is kept when shrinking the radius */
+        m_alpha = props.getFloat("alpha", 2.0f / 3.0f);
+
+        /* Maximum number of bounces of camera and photon paths */
+        m_maxDepth = props.getInteger("maxDepth", 8);
+
+        if (m_photonsPerPass <= 0 || m_maxDepth < 1)
+            throw NoriException("SPPMIntegrator: photonsPerPass and maxDepth must be positive");
+        if (m_alpha <= 0.0f || m_alpha >= 1.0f)
+            throw NoriException("SPPMIntegrator: alpha must be in (0, 1)");
+    }
+
+    void preprocess(const Scene *scene) override {
+        m_size = scene->getCamera()->getOutputSize();
+        size_t pixelCount = (size_t) m_size.x() * m_size.y();
+
+        /* Estimate a default radius */
+        float radius = m_initialRadius;
+        if (radius == 0.0f)
+            radius = scene->getBoundingBox().getExtents().norm() / 500.0f;
+
+        Pixel pixel;
+        pixel.radius = radius;
+        m_pixels.assign(pixelCount, pixel);
+        m_gridNodes.resize(pixelCount * 8);
+        m_gridHeads.reset(new std::atomic<uint32_t>[pixelCount]);
+        m_passes = 0;
+    }
+
+    /// Return the light that does not need photons (without updating the visible points)
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const override {
+        VisiblePoint vp;
+        return traceCameraPath(scene, sampler, ray, Color3f(1.0f), vp);
+    }
+
+    bool renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) const override {
+        const Camera *camera = scene->getCamera();
+        Point2i offset = block.getOffset();
+        Vector2i size = block.getSize();
+
+        for (int y = 0; y < size.y(); ++y) {
+            for (int x = 0; x < size.x(); ++x) {
+                Point2i pixel(x + offset.x(), y + offset.y());
+                sampler->generate(pixel);
+
+                Point2f pixelSample = pixel.cast<float>() + sampler->next2D();
+                Ray3f ray;
+                Color3f beta = camera->sampleRay(ray, pixelSample, sampler->next2D());
+
+                Pixel &p = m_pixels[(size_t) pixel.y() * m_size.x() + pixel.x()];
+                block.put(pixelSample, traceCameraPath(scene, sampler, ray, beta, p.vp));
+
+                sampler->advance();
+            }
+        }
+        return true;
+    }
+
+    void endPass(const Scene *scene) override {
+        buildGrid();
+        tracePhotons(scene);
+
+        /* Shrink the radii and fold the new photons into the flux */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, m_pixels.size()),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    Pixel &p = m_pixels[i];
+                    float M = p.M.get();
+                    if (M > 0.0f) {
+                        float N = p.N + m_alpha * M;
+                        float radius = p.radius * std::sqrt(N / (p.N + M));
+                        Color3f phi(p.phi[0].get(), p.phi[1].get(), p.phi[2].get());
+                        p.tau = (p.tau + p.vp.beta * phi) * (radius * radius) / (p.radius * p.radius);
+                        p.N = N;
+                        p.radius = radius;
+                        p.phi[0] = p.phi[1] = p.phi[2] = p.M = AtomicFloat();
+                    }
+                    p.vp.beta = Color3f(0.0f);
+                }
+            }
+        );
+        ++m_passes;
+    }
+
+    void addSplats(Bitmap &bitmap, uint32_t sampleCount) const override {
+        if (m_passes == 0)
+            return;
+        float photonCount = (float) m_passes * m_photonsPerPass;
+        for (int y = 0; y < m_size.y(); ++y) {
+            for (int x = 0; x < m_size.x(); ++x) {
+                const Pixel &p = m_pixels[(size_t) y * m_size.x() + x];
+                bitmap.coeffRef(y, x) += p.tau / (photonCount * M_PI * p.radius * p.radius);
+            }
+        }
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "SPPMIntegrator[\n"
+            "  photonsPerPass = %i,\n"
+            "  initialRadius = %f,\n"
+            "  alpha = %f,\n"
+            "  maxDepth = %i\n"
+            "]",
+            m_photonsPerPass, m_initialRadius, m_alpha, m_maxDepth);
+    }
+
+protected:
+    /// First non-specular hit of a camera path
+    struct VisiblePoint {
+        Intersection its;
+        Vector3f wo;                     ///< Direction towards the camera
+        Color3f beta = Color3f(0.0f);    ///< Path throughput, zero if there is no visible point
+    };
+
+    /// Per-pixel state of the progressive estimate
+    struct Pixel {
+        VisiblePoint vp;
+        float radius = 0.0f;             ///< Current gather radius
+        float N = 0.0f;                  ///< Accumulated photon count
+        Color3f tau = Color3f(0.0f);     ///< Accumulated flux
+        AtomicFloat phi[3];              ///< Flux of the photons of this pass
+        AtomicFloat M;                   ///< Number of photons of this pass
+    };
+
+    /// Entry of a grid cell list
+    struct GridNode {
+        uint32_t pixel;
+        uint32_t next;
+    };
+
+    static const uint32_t INVALID = 0xFFFFFFFFu;
+
+    /**
+     * \brief Follow a camera path to its visible point
+     *
+     * \return The emitted light along the specular prefix of the path
+     * and the direct light at the visible point
+     */
+    Color3f traceCameraPath(const Scene *scene, Sampler *sampler, Ray3f ray, Color3f beta,
+                            VisiblePoint &vp) const {
+        Color3f L(0.0f);
+        vp.beta = Color3f(0.0f);
+
+        for (int depth = 0; depth <= m_maxDepth && !beta.isZero(); ++depth) {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its))
+                break;
+
+            if (its.mesh->isEmitter()) {
+                EmitterQueryRecord eRec(ray.o, its.p(), its.shFrame().n);
+                L += beta * its.mesh->getEmitter()->eval(eRec);
+            }
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            if (!bsdf->isDelta()) {
+                L += beta * directLight(scene, sampler, its, -ray.d);
+                vp.its = its;
+                vp.wo = -ray.d;
+                vp.beta = beta;
+                break;
+            }
+
+            BSDFQueryRecord bRec(its.toLocal(-ray.d));
+            bRec.uv = its.uv();
+            beta *= bsdf->sample(bRec, sampler->next2D());
+            ray = Ray3f(its.p(), its.toWorld(bRec.wo));
+        }
+        return L;
+    }
+
+    /// Direct light at a visible point by emitter sampling
+    static Color3f directLight(const Scene *scene, Sampler *sampler, const Intersection &its,
+                               const Vector3f &wo) {
+        float lightPdf = 0.0f;
+        const Emitter *light = scene->sampleEmitter(its.p(), sampler->next1D(), lightPdf);
+        Point2f sample = sampler->next2D();
+        if (!light)
+            return Color3f(0.0f);
+
+        EmitterQueryRecord eRec(its.p());
+        Color3f Li = light->sample(eRec, sample) / lightPdf;
+        if (Li.isZero() || scene->rayIntersect(eRec.shadowRay))
+            return Color3f(0.0f);
+
+        BSDFQueryRecord bRec(its.toLocal(wo), its.toLocal(eRec.wi), ESolidAngle);
+        bRec.uv = its.uv();
+        float cosTheta = std::max(0.0f, Frame::cosTheta(bRec.wo));
+        return its.mesh->getBSDF()->eval(bRec) * cosTheta * Li;
+    }
+
+    /// Return the grid cell that contains \c p
+    Vector3i gridCell(const Point3f &p) const {
+        Vector3f rel = (p - m_gridBounds.min) / m_cellSize;
+        return Vector3i((int) std::floor(rel.x()), (int) std::floor(rel.y()), (int) std::floor(rel.z()));
+    }
+
+    /// Hash a grid cell into the list heads
+    uint32_t hashCell(const Vector3i &cell) const {
+        uint32_t h = ((uint32_t) cell.x() * 73856093u) ^ ((uint32_t) cell.y() * 19349663u) ^
+                     ((uint32_t) cell.z() * 83492791u);
+        return h % (uint32_t) m_pixels.size();
+    }
+
+    /**
+     * \brief Insert the visible points into the hashed grid
+     *
+     * The cells are twice as large as the largest radius, so that every
+     * visible point overlaps at most eight cells and can use its own
+     * preallocated list entries.
+     */
+    void buildGrid() {
+        size_t pixelCount = m_pixels.size();
+        m_gridBounds.reset();
+        float maxRadius = 0.0f;
+        for (const Pixel &p : m_pixels) {
+            if (p.vp.beta.isZero())
+                continue;
+            m_gridBounds.expandBy(p.vp.its.p());
+            maxRadius = std::max(maxRadius, p.radius);
+        }
+        m_cellSize = 2.0f * maxRadius;
+
+        for (size_t i = 0; i < pixelCount; ++i)
+            m_gridHeads[i].store(INVALID, std::memory_order_relaxed);
+        if (!m_gridBounds.isValid())
+            return;
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, pixelCount),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    const Pixel &p = m_pixels[i];
+                    if (p.vp.beta.isZero())
+                        continue;
+
+                    Vector3i cMin = gridCell(p.vp.its.p() - Vector3f(p.radius));
+                    Vector3i cMax = gridCell(p.vp.its.p() + Vector3f(p.radius));
+                    cMax = cMax.cwiseMin(cMin + Vector3i(1));
+                    uint32_t node = (uint32_t) i * 8;
+                    for (int z = cMin.z(); z <= cMax.z(); ++z) {
+                        for (int y = cMin.y(); y <= cMax.y(); ++y) {
+                            for (int x = cMin.x(); x <= cMax.x(); ++x, ++node) {
+                                std::atomic<uint32_t> &head = m_gridHeads[hashCell(Vector3i(x, y, z))];
+                                m_gridNodes[node].pixel = (uint32_t) i;
+                                uint32_t next = head.load(std::memory_order_relaxed);
+                                do {
+                                    m_gridNodes[node].next = next;
+                                } while (!head.compare_exchange_weak(next, node));
+                            }
+                        }
+                    }
+                }
+            }
+        );
+    }
+
+    /// Add the flux of a photon to the visible points around \c pos
+    void deposit(const Point3f &pos, const Vector3f &wi, const Color3f &power) const {
+        Vector3i cell = gridCell(pos);
+        for (uint32_t node = m_gridHeads[hashCell(cell)].load(std::memory_order_relaxed);
+             node != INVALID; node = m_gridNodes[node].next) {
+            Pixel &p = m_pixels[m_gridNodes[node].pixel];
+            const Intersection &its = p.vp.its;
+            if ((its.p() - pos).squaredNorm() > p.radius * p.radius)
+                continue;
+
+            BSDFQueryRecord bRec(its.toLocal(p.vp.wo), its.toLocal(wi), ESolidAngle);
+            bRec.uv = its.uv();
+            Color3f phi = power * its.mesh->getBSDF()->eval(bRec);
+            if (phi.isZero() || !phi.isValid())
+                continue;
+            for (int c = 0; c < 3; ++c)
+                p.phi[c].add(phi[c]);
+            p.M.add(1.0f);
+        }
+    }
+
+    /// Trace the photons of one pass; the direct light is not deposited
+    void tracePhotons(const Scene *scene) const {
+        const std::vector<Emitter *> &lights = scene->getLights();
+        if (!m_gridBounds.isValid() || lights.empty())
+            return;
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, m_photonsPerPass, 1024),
+            [&](const tbb::blocked_range<int> &range) {
+                for (int i = range.begin(); i != range.end(); ++i) {
+                    uint32_t seed = LowDiscrepancy::hashPixel(Point2i(i, (int) m_passes), 0x5ee9u);
+                    pcg32 rng(seed, LowDiscrepancy::mix(seed));
+
+                    const Emitter *light = scene->getRandomEmitter(rng.nextFloat());
+                    Ray3f ray;
+                    Point2f s1(rng.nextFloat(), rng.nextFloat()), s2(rng.nextFloat(), rng.nextFloat());
+                    Color3f power = light->samplePhoton(ray, s1, s2) * (float) lights.size();
+
+                    for (int depth = 0; depth < m_maxDepth && !power.isZero(); ++depth) {
+                        Intersection its;
+                        if (!scene->rayIntersect(ray, its))
+                            break;
+
+                        if (depth > 0)
+                            deposit(its.p(), -ray.d, power);
+
+                        BSDFQueryRecord bRec(its.toLocal(-ray.d));
+                        bRec.uv = its.uv();
+                        Color3f weight = its.mesh->getBSDF()->sample(
+                            bRec, Point2f(rng.nextFloat(), rng.nextFloat()));
+
+                        /* Russian roulette on the largest component of the weight */
+                        float probability = std::min(weight.maxCoeff(), 0.99f);
+                        if (rng.nextFloat() >= probability)
+                            break;
+                        power *= weight / probability;
+                        ray = Ray3f(its.p(), its.toWorld(bRec.wo));
+                    }
+                }
+            }
+        );
+    }
+
+private:
+    int m_photonsPerPass;
+    float m_initialRadius;
+    float m_alpha;
+    int m_maxDepth;
+
+    Vector2i m_size;
+    uint32_t m_passes = 0;
+    mutable std::vector<Pixel> m_pixels;
+    std::vector<GridNode> m_gridNodes;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_gridHeads;
+    BoundingBox3f m_gridBounds;
+    float m_cellSize = 0.0f;
+};
+
+NORI_REGISTER_CLASS(SPPMIntegrator, "sppm");
+NORI_NAMESPACE_END
@@ -0,0 +1,121 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sampler.h>
+#include <nori/lowdiscrepancy.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Correlated multi-jittered sampler
+ *
+ * 1D and 2D requests are counted separately, so that 1D requests between
+ * them (e.g. the emitter choice or the roulette) do not shift the 2D
+ * dimensions. The first \c dimensions calls to \ref next2D() of every
+ * pixel sample draw from a per-pixel correlated multi-jittered pattern
+ * with \c sampleCount points, following Kensler's "Correlated
+ * Multi-Jittered Sampling" (2013). With the default of 4, these are the
+ * pixel position, the aperture sample, and for \c path_mis the position
+ * of the first light sample and the first BSDF sample. The first
+ * \c dimensions calls to \ref next1D() draw from shuffled 1D strata.
+ * Each of these dimensions uses its own pattern with shuffled strata,
+ * which pads the patterns without correlating them. Any further
+ * dimensions are uniformly random.
+ *
+ * Patterns are evaluated in closed form from (pixel, dimension, seed), so
+ * there is no per-pixel storage and the result is independent of the order
+ * in which image blocks are rendered. Sample indices beyond
+ * \c sampleCount continue with freshly scrambled patterns.
+ */
+class StratifiedSampler : public PixelSampler {
+public:
+    StratifiedSampler(const PropertyList &propList) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_sampleOffset = (uint32_t) propList.getInteger("sampleOffset", 0);
+        m_dimensions = (uint32_t) propList.getInteger("dimensions", 4);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+    }
+
+    std::unique_ptr<Sampler> clone() const {
+        std::unique_ptr<StratifiedSampler> cloned(new StratifiedSampler(*this));
+        return cloned;
+    }
+
+    void generate(const Point2i &pixel) {
+        PixelSampler::generate(pixel);
+        m_pixelSeed = LowDiscrepancy::hashPixel(pixel, m_seed);
+        m_dimension1D = 0;
+    }
+
+    void advance() {
+        PixelSampler::advance();
+        m_dimension1D = 0;
+    }
+
+    float next1D() {
+        uint32_t dim = m_dimension1D++;
+        uint32_t count = (uint32_t) m_sampleCount;
+        uint32_t seed = LowDiscrepancy::hashCombine(m_pixelSeed, dim | 0x80000000u);
+
+        if (dim >= m_dimensions) {
+            /* Pad with uniformly distributed values */
+            return LowDiscrepancy::toFloat(LowDiscrepancy::mix(
+                LowDiscrepancy::hashCombine(seed, m_sampleIndex)));
+        }
+
+        /* Jittered sample in a shuffled stratum, with a new shuffle every 'sampleCount' samples */
+        uint32_t pattern = LowDiscrepancy::hashCombine(seed, m_sampleIndex / count);
+        uint32_t index = m_sampleIndex % count;
+        uint32_t stratum = LowDiscrepancy::permute(index, count, pattern * 0x51633e2du);
+        float jitter = LowDiscrepancy::randomFloat(index, pattern * 0x967a889bu);
+        return std::min((stratum + jitter) / count, 0.99999994f);
+    }
+
+    Point2f next2D() {
+        uint32_t dim = m_dimension++;
+        uint32_t count = (uint32_t) m_sampleCount;
+        uint32_t seed = LowDiscrepancy::hashCombine(m_pixelSeed, dim);
+
+        if (dim >= m_dimensions) {
+            /* Pad with uniformly distributed values */
+            uint32_t hash = LowDiscrepancy::hashCombine(seed, m_sampleIndex);
+            return Point2f(
+                LowDiscrepancy::toFloat(LowDiscrepancy::mix(hash)),
+                LowDiscrepancy::toFloat(LowDiscrepancy::mix(hash ^ 0x5bd1e995u))
+            );
+        }
+
+        /* Every set of 'sampleCount' samples uses a new pattern */
+        uint32_t pattern = LowDiscrepancy::hashCombine(seed, m_sampleIndex / count);
+        return LowDiscrepancy::correlatedMultiJitter(m_sampleIndex % count, count, pattern);
+    }
+
+    virtual std::string toString() const override {
+        return tfm::format("StratifiedSampler[sampleCount=%i, dimensions=%i, seed=%i]",
+                           m_sampleCount, m_dimensions, m_seed);
+    }
+
+private:
+    uint32_t m_dimensions;
+    uint32_t m_seed;
+    uint32_t m_pixelSeed = 0;
+    uint32_t m_dimension1D = 0;             ///< Next 1D dimension of the current sample
+};
+
+NORI_REGISTER_CLASS(StratifiedSampler, "stratified");
+NORI_NAMESPACE_END
@@ -0,0 +1,57 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Romain Prévost
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/texture.h>
+#include <nori/assetcache.h>
+#include <filesystem/resolver.h>
+#include <stb_image.h>
+#include <sys/stat.h>
+
+NORI_NAMESPACE_BEGIN
+
+std::shared_ptr<const TexelBuffer> TexelBuffer::load(const std::string &filename, int channels) {
+    filesystem::path path = getFileResolver()->resolve(filename);
+    std::string key = tfm::format("%s|channels=%i", path.str(), channels);
+
+    return AssetCache::getInstance().acquire<TexelBuffer>(key, [&]() {
+        int width, height, fileChannels;
+        uint8_t *pixels = stbi_load(path.str().c_str(), &width, &height,
+                                    &fileChannels, channels);
+        if (!pixels)
+            throw NoriException("Unable to load image \"%s\": %s", path, stbi_failure_reason());
+
+        std::shared_ptr<TexelBuffer> buffer = std::make_shared<TexelBuffer>();
+        buffer->width = width;
+        buffer->height = height;
+        buffer->channels = channels;
+
+        /* Identify the file contents for caches derived from the scene */
+        struct stat st;
+        uint64_t size = 0, modified = 0;
+        if (stat(path.str().c_str(), &st) == 0) {
+            size = (uint64_t) st.st_size;
+            modified = (uint64_t) st.st_mtime;
+        }
+        buffer->source = tfm::format("%s|size=%i|mtime=%i", path, size, modified);
+        buffer->data.assign(pixels, pixels + (size_t) width * height * channels);
+        stbi_image_free(pixels);
+        return buffer;
+    });
+}
+
+NORI_NAMESPACE_END
@@ -21,6 +21,7 @@
 #include <nori/camera.h>
 #include <nori/integrator.h>
 #include <nori/sampler.h>
+#include <nori/block.h>
 #include <hypothesis.h>
 #include <pcg32.h>
 
@@ -54,6 +55,10 @@ NORI_NAMESPACE_BEGIN
  *
  * 2. that the average radiance received by a camera within some scene
  *    matches a given value (modulo noise).
+ *
+ * Scenes are rendered with independent random numbers, unless the test has a
+ * \c sampler child. That sampler then generates all samples of pixel (0, 0),
+ * as the renderer would, which checks that it converges to the right value.
  */
 class StudentsTTest : public NoriObject {
 public:
@@ -81,6 +86,7 @@ public:
             delete bsdf;
         for (auto scene : m_scenes)
             delete scene;
+        delete m_sampler;
     }
 
     virtual void addChild(NoriObject *obj) override {
@@ -93,6 +99,12 @@ public:
                 m_scenes.push_back(static_cast<Scene *>(obj));
                 break;
 
+            case ESampler:
+                if (m_sampler)
+                    throw NoriException("StudentsTTest: only one sampler can be specified!");
+                m_sampler = static_cast<Sampler *>(obj);
+                break;
+
             default:
                 throw NoriException("StudentsTTest::addChild(<%s>) is not supported!",
                     classTypeName(obj->getClassType()));
@@ -148,7 +160,7 @@ public:
             if (m_references.size() != m_scenes.size())
                 throw NoriException("Specified a different number of scenes and reference values!");
 
-            Sampler *sampler = static_cast<Sampler *>(
+            Sampler *independent = static_cast<Sampler *>(
                 NoriObjectFactory::createInstance("independent", PropertyList()));
 
             int ctr = 0;
@@ -161,8 +173,20 @@ public:
                 cout << "Testing scene: " << scene->toString() << endl;
                 ++total;
 
+                /* Let the integrator build its acceleration data as the renderer does */
+                scene->getIntegrator()->preprocess(scene);
+
                 cout << "Generating " << m_sampleCount << " paths.. " << endl;
 
+                std::unique_ptr<Sampler> pixelSampler;
+                if (m_sampler) {
+                    pixelSampler = m_sampler->clone();
+                    pixelSampler->prepare(ImageBlock(camera->getOutputSize(),
+                                                     camera->getReconstructionFilter()));
+                    pixelSampler->generate(Point2i(0, 0));
+                }
+                Sampler *sampler = pixelSampler ? pixelSampler.get() : independent;
+
                 double mean = 0, variance = 0;
                 for (int k=0; k<m_sampleCount; ++k) {
                     /* Sample a ray from the camera */
@@ -180,6 +204,9 @@ public:
                     double delta = result - mean;
                     mean += delta / (double) (k+1);
                     variance += delta * (result - mean);
+
+                    if (pixelSampler)
+                        pixelSampler->advance();
                 }
                 variance /= m_sampleCount - 1;
 
@@ -210,6 +237,7 @@ public:
 private:
     std::vector<BSDF *> m_bsdfs;
     std::vector<Scene *> m_scenes;
+    Sampler *m_sampler = nullptr;
     std::vector<float> m_angles;
     std::vector<float> m_references;
     float m_significanceLevel;
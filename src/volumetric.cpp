@@ -3,15 +3,15 @@
 #include <nori/warp.h>
 #include <nori/bsdf.h>
 #include <nori/medium.h>
+#include <nori/roulette.h>
 
 NORI_NAMESPACE_BEGIN
 
 class VolumetricIntegrator : public Integrator
 {
 public:
-    VolumetricIntegrator(const PropertyList &props)
+    VolumetricIntegrator(const PropertyList &props) : m_roulette(props, 0.80f)
     {
-        // This integrator contains no properties
     }
 
     /// Compute the radiance value for a given ray. Just return green here
@@ -29,12 +29,12 @@ public:
         bool intersection = scene->rayIntersect(currentRay,its);
 
         // Continue until the Russian Roulette says stop
-        while (true)
+        for (int depth = 0; ; ++depth)
         {
             // Step 1) Find the nearest surface
             float tmax;
             if (intersection) {
-                tmax = (its.p - currentRay.o).norm();
+                tmax = (its.p() - currentRay.o).norm();
             }  else {
                 tmax = its.t;
             }
@@ -54,33 +54,34 @@ public:
                 
 
                 // Sample an emitter
-                const Emitter *light = scene->getRandomEmitter(sampler->next1D());
+                float lightPdf = 0.0f;
+                const Emitter *light = scene->sampleEmitter(mQuery.p, sampler->next1D(), lightPdf);
+                Point2f lightSample = sampler->next2D();
                 EmitterQueryRecord eRec(mQuery.p);
 
                 // Evaluate emitter
-                Color3f Li = light->sample(eRec, sampler->next2D()) * scene->getLights().size();
+                Color3f Li = light ? Color3f(light->sample(eRec, lightSample) / lightPdf) : Color3f(0.0f);
                 attenuation *= sampledColor;
-                if (!scene->rayIntersect(eRec.shadowRay, its))
+                if (light && !scene->rayIntersect(eRec.shadowRay, its))
                 {
                     mQuery.tMax = eRec.shadowRay.maxt;
                     color += attenuation * medium->Tr(mQuery.p, eRec.p) * Li * pdf_mat;
                 }
 
                 // Update the russian roulette
-                float probability = std::min(attenuation.x(), 0.80f);
-                if (sampler->next1D() > probability)
+                if (m_roulette.evaluate(attenuation, depth, sampler->next1D()) == 0)
                 {
                     return color;
                 }
-                attenuation /= probability;
 
                 // Continue recursion
                 currentRay = Ray3f(mQuery.p,wo.normalized());
                 intersection = scene->rayIntersect(currentRay, its);
                 if(intersection) {    
                     if (its.mesh->isEmitter()) {
-                        EmitterQueryRecord lRec = EmitterQueryRecord(currentRay.o, its.p, its.shFrame.n);
-                        float pdf_em = its.mesh->getEmitter()->pdf(lRec);
+                        EmitterQueryRecord lRec = EmitterQueryRecord(currentRay.o, its.p(), its.shFrame().n);
+                        const Emitter *emitter = its.mesh->getEmitter();
+                        float pdf_em = emitter->pdf(lRec) * scene->pdfEmitter(currentRay.o, emitter);
                         w_mats = pdf_mat + pdf_em > 0.f ? pdf_mat / (pdf_mat + pdf_em) : pdf_mat;
                     }
                 }
@@ -91,20 +92,22 @@ public:
                 // We add the Le part to the record if the mesh is an emitter
                 if (its.mesh->isEmitter())
                 {
-                    EmitterQueryRecord eRec(currentRay.o, its.p, its.shFrame.n);
-                    color += attenuation * w_mats * its.mesh->getEmitter()->eval(eRec) *  medium->Tr(its.p, eRec.p);
+                    EmitterQueryRecord eRec(currentRay.o, its.p(), its.shFrame().n);
+                    color += attenuation * w_mats * its.mesh->getEmitter()->eval(eRec) *  medium->Tr(its.p(), eRec.p);
                 }
 
                 // Sample emitter
-                const Emitter *light = scene->getRandomEmitter(sampler->next1D());
-                EmitterQueryRecord eRec(its.p);
-                Color3f Li = light->sample(eRec, sampler->next2D()) * scene->getLights().size();
+                float lightPdf = 0.0f;
+                const Emitter *light = scene->sampleEmitter(its.p(), sampler->next1D(), lightPdf);
+                Point2f lightSample = sampler->next2D();
+                EmitterQueryRecord eRec(its.p());
+                Color3f Li = light ? Color3f(light->sample(eRec, lightSample) / lightPdf) : Color3f(0.0f);
                 
                 // Evaluate emitter
-                if (!scene->rayIntersect(eRec.shadowRay))
+                if (light && !scene->rayIntersect(eRec.shadowRay))
                 {
-                    float pdf_em = light->pdf(eRec);
-                    float theta = std::max(0.0f, Frame::cosTheta(its.shFrame.toLocal(eRec.wi)));
+                    float pdf_em = light->pdf(eRec) * lightPdf;
+                    float theta = std::max(0.0f, Frame::cosTheta(its.shFrame().toLocal(eRec.wi)));
 
                     BSDFQueryRecord bRec(its.toLocal(-currentRay.d), its.toLocal(eRec.wi), ESolidAngle);
 
@@ -113,31 +116,30 @@ public:
 
                     float w_ems = (pdf_mat + pdf_em) > 0.0f ? pdf_em / (pdf_mat + pdf_em) : pdf_em;
                     mQuery.tMax = eRec.shadowRay.maxt;
-                    color += attenuation * w_ems * brdf * theta * Li * medium->Tr(its.p, eRec.p);
+                    color += attenuation * w_ems * brdf * theta * Li * medium->Tr(its.p(), eRec.p);
                 }
 
                 // Update the russian roulette
-                float probability = std::min(attenuation.x(), 0.80f);
-                if (sampler->next1D() > probability)
+                if (m_roulette.evaluate(attenuation, depth, sampler->next1D()) == 0)
                 {
                     return color;
                 }
-                attenuation /= probability;
 
                 // Sample the BRDF
-                BSDFQueryRecord bRec(its.shFrame.toLocal(-currentRay.d));
+                BSDFQueryRecord bRec(its.shFrame().toLocal(-currentRay.d));
                 Color3f brdf = its.mesh->getBSDF()->sample(bRec, sampler->next2D());
                 attenuation *= brdf;
                 float pdf_mat = its.mesh->getBSDF()->pdf(bRec);
 
                 // Continue the recursion
-                currentRay = Ray3f(its.p, its.toWorld(bRec.wo));
+                currentRay = Ray3f(its.p(), its.toWorld(bRec.wo));
                 intersection = scene->rayIntersect(currentRay, its);
 
                 if (intersection) {
                     if (its.mesh->isEmitter()) {
-                        EmitterQueryRecord lRec = EmitterQueryRecord(currentRay.o, its.p, its.shFrame.n);
-                        float pdf_em = its.mesh->getEmitter()->pdf(lRec);
+                        EmitterQueryRecord lRec = EmitterQueryRecord(currentRay.o, its.p(), its.shFrame().n);
+                        const Emitter *emitter = its.mesh->getEmitter();
+                        float pdf_em = emitter->pdf(lRec) * scene->pdfEmitter(currentRay.o, emitter);
                         w_mats = pdf_mat + pdf_em > 0.f ? pdf_mat / (pdf_mat + pdf_em) : pdf_mat;
                     }
                     if (bRec.measure == EDiscrete)
@@ -158,11 +160,12 @@ public:
     /// Return a human-readable description for debugging purposes
     std::string toString() const
     {
-        return tfm::format("[Volumetric path integrator]");
+        return tfm::format("[Volumetric path integrator roulette = %s]", m_roulette.toString());
     }
 
 protected:
     float ray_length;
+    RussianRoulette m_roulette;
 
     const Color3f BLACK = Color3f(0.0f);
     const Color3f WHITE = Color3f(1.0f);
@@ -0,0 +1,448 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/sampler.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/roulette.h>
+#include <nori/lowdiscrepancy.h>
+#include <nori/timer.h>
+#include <pcg32.h>
+#include <tbb/tbb.h>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Instant radiosity with virtual point lights, for previews
+ *
+ * A parallel preprocess traces \c lightPaths paths from the emitters (with
+ * \ref Emitter::samplePhoton()) and stores every vertex on a non-specular
+ * surface as a virtual point light (VPL) that reflects the light it
+ * received ("Instant radiosity", Keller 1997). Camera paths follow specular
+ * bounces to the first non-specular surface, where the direct light is
+ * estimated by emitter sampling and the indirect light is the sum over the
+ * VPLs, each with a shadow ray. As the VPLs are the same for all pixels,
+ * the indirect light is free of noise (but biased and blotchy with few
+ * light paths).
+ *
+ * The geometry term of a VPL is clamped by never using a distance below
+ * \c clampDistance (default: 1% of the scene diagonal), which removes the
+ * bright spots near VPLs at the expense of some energy in corners.
+ *
+ * With \c lightcuts, the VPLs are clustered in a binary tree (by splitting
+ * their bounding box along the longest axis) and every shading point
+ * evaluates a cut through the tree, as in "Lightcuts: a scalable approach
+ * to illumination" (Walter et al. 2005): a cluster is shaded like its
+ * representative VPL with the power of the whole cluster, and the cluster
+ * with the largest error bound is refined until all bounds are below
+ * \c cutError times the estimate or the cut has \c maxCutSize clusters.
+ * The bounds assume diffuse BSDFs (so glossy surfaces get coarser cuts).
+ */
+class VPLIntegrator : public Integrator {
+public:
+    VPLIntegrator(const PropertyList &props) : m_roulette(props) {
+        /* Number of paths traced from the emitters */
+        m_lightPaths = props.getInteger("lightPaths", 1024);
+
+        /* Smallest distance used in the geometry term (0: automatic) */
+        m_clampDistance = props.getFloat("clampDistance", 0.0f);
+
+        /* Shade with a cut through a tree of VPL clusters instead of all VPLs */
+        m_lightcuts = props.getBoolean("lightcuts", false);
+
+        /* Largest relative error bound of a cluster in the cut */
+        m_cutError = props.getFloat("cutError", 0.02f);
+
+        /* Largest number of clusters in a cut */
+        m_maxCutSize = props.getInteger("maxCutSize", 256);
+
+        if (m_lightPaths < 1 || m_clampDistance < 0.0f)
+            throw NoriException("VPLIntegrator: invalid lightPaths or clampDistance");
+        if (m_cutError <= 0.0f || m_maxCutSize < 1 || m_maxCutSize > MAX_CUT_SIZE)
+            throw NoriException("VPLIntegrator: cutError must be positive and maxCutSize in [1, %i]",
+                                (int) MAX_CUT_SIZE);
+    }
+
+    void preprocess(const Scene *scene) override {
+        cout << "Tracing " << m_lightPaths << " light paths for VPLs .. ";
+        cout.flush();
+        Timer timer;
+
+        float clampDistance = m_clampDistance;
+        if (clampDistance == 0.0f)
+            clampDistance = scene->getBoundingBox().getExtents().norm() / 100.0f;
+        m_clampDistanceSquared = clampDistance * clampDistance;
+
+        /* Trace the paths in batches of their own, and append the VPLs in order */
+        m_vpls.clear();
+        if (!scene->getLights().empty()) {
+            int batchCount = (m_lightPaths + VPL_BATCH_SIZE - 1) / VPL_BATCH_SIZE;
+            std::vector<std::vector<VPL>> batches(batchCount);
+            tbb::parallel_for(tbb::blocked_range<int>(0, batchCount, 1),
+                [&](const tbb::blocked_range<int> &range) {
+                    for (int i = range.begin(); i != range.end(); ++i) {
+                        int end = std::min(m_lightPaths, (i + 1) * VPL_BATCH_SIZE);
+                        for (int path = i * VPL_BATCH_SIZE; path < end; ++path)
+                            traceLightPath(scene, (uint32_t) path, batches[i]);
+                    }
+                }
+            );
+            for (const std::vector<VPL> &batch : batches)
+                m_vpls.insert(m_vpls.end(), batch.begin(), batch.end());
+        }
+
+        m_nodes.clear();
+        if (m_lightcuts && !m_vpls.empty()) {
+            std::vector<uint32_t> indices(m_vpls.size());
+            for (uint32_t i = 0; i < (uint32_t) indices.size(); ++i)
+                indices[i] = i;
+            m_nodes.reserve(2 * m_vpls.size());
+            pcg32 rng;
+            buildTree(indices.begin(), indices.end(), rng);
+        }
+
+        cout << "done. (took " << timer.elapsedString() << ", " << m_vpls.size() << " VPLs";
+        if (m_lightcuts)
+            cout << ", " << m_nodes.size() << " clusters";
+        cout << ")" << endl;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const override {
+        Color3f color(0.0f);
+        Color3f attenuation(1.0f);
+        Ray3f currentRay = ray;
+
+        Intersection its;
+        if (!scene->rayIntersect(currentRay, its))
+            return color;
+
+        for (int depth = 0; ; ++depth) {
+            /* Emission seen by the camera or through specular bounces */
+            if (its.mesh->isEmitter()) {
+                EmitterQueryRecord eRec(currentRay.o, its.p(), its.shFrame().n);
+                color += attenuation * its.mesh->getEmitter()->eval(eRec);
+            }
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            Vector3f wi = its.toLocal(-currentRay.d);
+            if (!bsdf->isDelta()) {
+                Color3f indirect = m_lightcuts ? shadeCut(scene, its, wi) : shadeAll(scene, its, wi);
+                return color + attenuation * (directLight(scene, sampler, its, wi) + indirect);
+            }
+
+            /* Russian roulette */
+            if (m_roulette.evaluate(attenuation, depth, sampler->next1D()) == 0)
+                return color;
+
+            /* Follow the specular bounce */
+            BSDFQueryRecord bRec(wi);
+            bRec.uv = its.uv();
+            attenuation *= bsdf->sample(bRec, sampler->next2D());
+            if (attenuation.isZero())
+                return color;
+
+            currentRay = Ray3f(its.p(), its.toWorld(bRec.wo));
+            if (!scene->rayIntersect(currentRay, its))
+                return color;
+        }
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "VPLIntegrator[lightPaths = %i, clampDistance = %f, lightcuts = %s, "
+            "cutError = %f, maxCutSize = %i, roulette = %s]",
+            m_lightPaths, m_clampDistance, m_lightcuts ? "true" : "false",
+            m_cutError, m_maxCutSize, m_roulette.toString()
+        );
+    }
+
+protected:
+    /// Number of light paths that are traced by one task of the preprocess
+    static const int VPL_BATCH_SIZE = 64;
+
+    /// Upper bound of the maxCutSize parameter (size of the cut buffer)
+    enum { MAX_CUT_SIZE = 1024 };
+
+    static const uint32_t INVALID = 0xFFFFFFFFu;
+
+    /// Vertex of a light path that reflects light towards the camera paths
+    struct VPL {
+        Point3f p;
+        Frame frame;                    ///< Shading frame
+        Vector3f wi;                    ///< Direction towards the previous vertex (local)
+        Point2f uv;
+        Color3f power;                  ///< Incident power divided by the number of light paths
+        const BSDF *bsdf;
+    };
+
+    /// Cluster of VPLs
+    struct Node {
+        BoundingBox3f bbox;
+        Color3f power;                  ///< Total power of the VPLs
+        uint32_t representative;        ///< VPL that stands in for the cluster
+        uint32_t left, right;           ///< Children (INVALID for a single VPL)
+    };
+
+    /// Cluster of a cut
+    struct CutEntry {
+        float bound;                    ///< Upper bound of the error of the estimate
+        uint32_t node;
+        Color3f unit;                   ///< Contribution of the representative per unit power
+        Color3f estimate;
+
+        bool operator<(const CutEntry &other) const { return bound < other.bound; }
+    };
+
+    /// Trace a light path with a random number stream of its own and store its VPLs
+    void traceLightPath(const Scene *scene, uint32_t index, std::vector<VPL> &vpls) const {
+        uint32_t seed = LowDiscrepancy::hashPixel(Point2i((int) index, 0), 0x0b1fu);
+        pcg32 rng(seed, LowDiscrepancy::mix(seed));
+        auto next2D = [&rng]() { float x = rng.nextFloat(); return Point2f(x, rng.nextFloat()); };
+
+        const Emitter *light = scene->getRandomEmitter(rng.nextFloat());
+        Ray3f ray;
+        Point2f positionSample = next2D(), directionSample = next2D();
+        Color3f power = light->samplePhoton(ray, positionSample, directionSample)
+            * (float) scene->getLights().size() / (float) m_lightPaths;
+
+        /* Throughput of the path, which decides the Russian Roulette */
+        Color3f throughput(1.0f);
+
+        for (int depth = 0; ; ++depth) {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its))
+                break;
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            Vector3f wi = its.toLocal(-ray.d);
+            if (!bsdf->isDelta())
+                vpls.push_back(VPL { its.p(), its.shFrame(), wi, its.uv(), power, bsdf });
+
+            float probability = m_roulette.getSurvivalProbability(throughput, depth);
+            if (!(probability > 0.0f) || rng.nextFloat() >= probability)
+                break;
+
+            BSDFQueryRecord bRec(wi);
+            bRec.uv = its.uv();
+            Color3f weight = bsdf->sample(bRec, next2D()) / probability;
+            power *= weight;
+            throughput *= weight;
+            if (throughput.isZero())
+                break;
+
+            ray = Ray3f(its.p(), its.toWorld(bRec.wo));
+        }
+    }
+
+    /// Build the subtree of the VPLs in [begin, end) and return its index
+    uint32_t buildTree(std::vector<uint32_t>::iterator begin, std::vector<uint32_t>::iterator end,
+                       pcg32 &rng) {
+        uint32_t index = (uint32_t) m_nodes.size();
+        m_nodes.push_back(Node());
+
+        if (end - begin == 1) {
+            const VPL &vpl = m_vpls[*begin];
+            Node &node = m_nodes[index];
+            node.bbox = BoundingBox3f(vpl.p);
+            node.power = vpl.power;
+            node.representative = *begin;
+            node.left = node.right = INVALID;
+            return index;
+        }
+
+        BoundingBox3f bbox;
+        for (auto it = begin; it != end; ++it)
+            bbox.expandBy(m_vpls[*it].p);
+        int axis = bbox.getLargestAxis();
+        auto middle = begin + (end - begin) / 2;
+        std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b) {
+            return m_vpls[a].p[axis] < m_vpls[b].p[axis];
+        });
+
+        uint32_t left = buildTree(begin, middle, rng);
+        uint32_t right = buildTree(middle, end, rng);
+
+        /* The representative is one of the children's, chosen by power */
+        const Node &l = m_nodes[left], &r = m_nodes[right];
+        float lumLeft = std::max(l.power.getLuminance(), 0.0f);
+        float lumRight = std::max(r.power.getLuminance(), 0.0f);
+        bool pickLeft = lumLeft + lumRight > 0.0f ? rng.nextFloat() * (lumLeft + lumRight) < lumLeft : true;
+
+        Node &node = m_nodes[index];
+        node.bbox = bbox;
+        node.power = l.power + r.power;
+        node.representative = pickLeft ? l.representative : r.representative;
+        node.left = left;
+        node.right = right;
+        return index;
+    }
+
+    /**
+     * \brief Light reflected at \c its towards \c wi from a VPL with unit
+     * power, including the visibility
+     */
+    Color3f evalVPL(const Scene *scene, const Intersection &its, const Vector3f &wi, const VPL &vpl) const {
+        Vector3f d = vpl.p - its.p();
+        float distanceSquared = d.squaredNorm();
+        float distance = std::sqrt(distanceSquared);
+        if (distance == 0.0f)
+            return Color3f(0.0f);
+        d /= distance;
+
+        BSDFQueryRecord bRec(wi, its.toLocal(d), ESolidAngle);
+        bRec.uv = its.uv();
+        Color3f value = its.mesh->getBSDF()->eval(bRec) * std::max(0.0f, Frame::cosTheta(bRec.wo));
+        if (value.isZero())
+            return value;
+
+        BSDFQueryRecord vRec(vpl.wi, vpl.frame.toLocal(-d), ESolidAngle);
+        vRec.uv = vpl.uv;
+        value *= vpl.bsdf->eval(vRec) * std::max(0.0f, Frame::cosTheta(vRec.wo));
+        if (value.isZero())
+            return value;
+
+        if (scene->rayIntersect(Ray3f(its.p(), d, Epsilon, distance * (1.0f - Epsilon))))
+            return Color3f(0.0f);
+        return value / std::max(distanceSquared, m_clampDistanceSquared);
+    }
+
+    /// Sum of the light of all VPLs
+    Color3f shadeAll(const Scene *scene, const Intersection &its, const Vector3f &wi) const {
+        Color3f color(0.0f);
+        for (const VPL &vpl : m_vpls)
+            color += vpl.power * evalVPL(scene, its, wi, vpl);
+        return color;
+    }
+
+    /**
+     * \brief Upper bound of the light of the VPLs of a node (for diffuse
+     * BSDFs, without visibility)
+     *
+     * \param brdf
+     *    Luminance of the BSDF at the shading point
+     */
+    float getErrorBound(const Intersection &its, const Node &node, float brdf) const {
+        if (node.left == INVALID)
+            return 0.0f;
+
+        /* Largest cosine at the shading point, bounded with the box of the
+           cluster in the shading frame as in "Lightcuts" (Walter et al. 2005) */
+        BoundingBox3f local;
+        for (int i = 0; i < 8; ++i)
+            local.expandBy(its.toLocal(node.bbox.getCorner(i) - its.p()));
+        float z = local.max.z();
+        if (z <= 0.0f)
+            return 0.0f;
+        auto minSquared = [](float min, float max) {
+            return min > 0.0f ? min * min : (max < 0.0f ? max * max : 0.0f);
+        };
+        float cosine = z / std::sqrt(minSquared(local.min.x(), local.max.x()) +
+                                     minSquared(local.min.y(), local.max.y()) + z * z);
+
+        float distanceSquared = std::max(node.bbox.squaredDistanceTo(its.p()), m_clampDistanceSquared);
+        return std::max(node.power.getLuminance(), 0.0f) * brdf * INV_PI * cosine / distanceSquared;
+    }
+
+    /// Add a node to the cut, reusing the contribution of its representative if known
+    CutEntry makeEntry(const Scene *scene, const Intersection &its, const Vector3f &wi,
+                       float brdf, uint32_t index, const CutEntry *parent) const {
+        const Node &node = m_nodes[index];
+        CutEntry entry;
+        entry.bound = getErrorBound(its, node, brdf);
+        entry.node = index;
+        if (parent && m_nodes[parent->node].representative == node.representative)
+            entry.unit = parent->unit;
+        else
+            entry.unit = evalVPL(scene, its, wi, m_vpls[node.representative]);
+        entry.estimate = entry.unit * node.power;
+        return entry;
+    }
+
+    /// Light of the VPLs, estimated with a cut through the cluster tree
+    Color3f shadeCut(const Scene *scene, const Intersection &its, const Vector3f &wi) const {
+        if (m_nodes.empty())
+            return Color3f(0.0f);
+
+        /* Value of a diffuse BSDF, which does not depend on the direction */
+        BSDFQueryRecord bRec(wi, Vector3f(0.0f, 0.0f, 1.0f), ESolidAngle);
+        bRec.uv = its.uv();
+        float brdf = std::max(its.mesh->getBSDF()->eval(bRec).getLuminance(), 0.0f);
+
+        CutEntry cut[MAX_CUT_SIZE];
+        int size = 0;
+        cut[size++] = makeEntry(scene, its, wi, brdf, 0, nullptr);
+        Color3f total = cut[0].estimate;
+
+        /* Refine the cluster with the largest error bound */
+        while (size < m_maxCutSize) {
+            const CutEntry &worst = cut[0];
+            if (worst.bound <= m_cutError * std::max(total.getLuminance(), 0.0f))
+                break;
+
+            CutEntry parent = worst;
+            std::pop_heap(cut, cut + size);
+            --size;
+            total -= parent.estimate;
+
+            const Node &node = m_nodes[parent.node];
+            for (uint32_t child : { node.left, node.right }) {
+                cut[size] = makeEntry(scene, its, wi, brdf, child, &parent);
+                total += cut[size].estimate;
+                std::push_heap(cut, cut + ++size);
+            }
+        }
+
+        return total;
+    }
+
+    /// Next event estimation without MIS (no BSDF sampling follows)
+    Color3f directLight(const Scene *scene, Sampler *sampler, const Intersection &its, const Vector3f &wi) const {
+        float lightPdf = 0.0f;
+        const Emitter *light = scene->sampleEmitter(its.p(), sampler->next1D(), lightPdf);
+        Point2f lightSample = sampler->next2D();
+        if (!light)
+            return Color3f(0.0f);
+
+        EmitterQueryRecord eRec(its.p());
+        Color3f Li = light->sample(eRec, lightSample) / lightPdf;
+        if (Li.isZero() || scene->rayIntersect(eRec.shadowRay))
+            return Color3f(0.0f);
+
+        BSDFQueryRecord bRec(wi, its.toLocal(eRec.wi), ESolidAngle);
+        bRec.uv = its.uv();
+        return its.mesh->getBSDF()->eval(bRec) * std::max(0.0f, Frame::cosTheta(bRec.wo)) * Li;
+    }
+
+private:
+    int m_lightPaths;
+    float m_clampDistance;
+    bool m_lightcuts;
+    float m_cutError;
+    int m_maxCutSize;
+    RussianRoulette m_roulette;
+
+    float m_clampDistanceSquared = 0.0f;
+    std::vector<VPL> m_vpls;
+    std::vector<Node> m_nodes;
+};
+
+NORI_REGISTER_CLASS(VPLIntegrator, "vpl");
+NORI_NAMESPACE_END